@@ -1,56 +1,193 @@
 #include <mpi.h>
 #include "Utils.hpp"
 #include <filesystem>
+#include <fstream>
+#include <sstream>
 #include "Simulation.hpp"
 
-int main(int argc, char** argv) 
+namespace {
+    const int job_tag = 0;
+    const int stop_tag = 1;
+    const int result_tag = 2;
+    const uint num_bins = 101;
+    const uint num_power_bins = 32;
+    const uint result_length = 1 + num_bins + 3 * num_power_bins; // job index, correlation, then k, power and modes of the power spectrum
+}
+
+/**
+ * @brief: One simulation of the sweep. Sent to workers as 4 doubles (index, expansion factor, seed, number of cells).
+*/
+struct ComparisonJob
+{
+    double index;
+    double expansion_factor;
+    double random_seed;
+    double num_cells;
+};
+
+/**
+ * @brief: Analysis of the final particles of a job.
+*/
+struct JobResult
+{
+    std::vector<double> correlation;
+    PowerSpectrum spectrum;
+};
+
+/**
+ * @brief: Runs the simulation of a job with all OpenMP threads of the process and returns the correlation function and power spectrum of the final particles.
+ * The power spectrum is binned from the transform of the last step, so it costs no extra FFT.
+*/
+JobResult RunJob(const ComparisonJob &job, const std::optional<std::string> &wisdom)
+{
+    uint num_cells = job.num_cells;
+    uint average_particles_per_cell = 13;
+    double width = 100.0;
+    uint num_particles = num_cells * num_cells * num_cells * average_particles_per_cell;
+    double mass = 10.0 * 10.0 * 10.0 * 10.0 * 10.0/num_particles;
+    double t_max = 1.5;
+    double time_step = 0.01;
+    Simulation sim(t_max, time_step, particle_group(mass, num_particles, static_cast<uint>(job.random_seed)), width, num_cells, job.expansion_factor, mass_assignment::NGP, wisdom);
+    OutputSchedule schedule;
+    schedule.at_end({output_type::power_spectrum});
+    sim.set_output_schedule(schedule);
+    PowerSpectrumOptions options;
+    options.num_bins = num_power_bins;
+    options.subtract_shot_noise = true;
+    options.deconvolve_window = true;
+    sim.set_power_spectrum_options(options);
+    sim.run();
+    return {correlationFunction(sim.get_particle_collection(), num_bins), *sim.get_power_spectrum()}; // analysed in place through a view
+}
+
+/**
+ * @brief: Packs a job result into the result_length doubles sent to the master.
+*/
+std::vector<double> PackResult(const ComparisonJob &job, const JobResult &result)
+{
+    std::vector<double> message = {job.index};
+    message.insert(message.end(), result.correlation.begin(), result.correlation.end());
+    message.insert(message.end(), result.spectrum.k.begin(), result.spectrum.k.end());
+    message.insert(message.end(), result.spectrum.power.begin(), result.spectrum.power.end());
+    message.insert(message.end(), result.spectrum.num_modes.begin(), result.spectrum.num_modes.end());
+    return message;
+}
+
+/**
+ * @brief: Unpacks a message of PackResult.
+*/
+JobResult UnpackResult(const std::vector<double> &message)
+{
+    JobResult result;
+    auto start = message.begin() + 1;
+    result.correlation.assign(start, start + num_bins);
+    start += num_bins;
+    result.spectrum.k.assign(start, start + num_power_bins);
+    start += num_power_bins;
+    result.spectrum.power.assign(start, start + num_power_bins);
+    start += num_power_bins;
+    result.spectrum.num_modes.assign(start, start + num_power_bins);
+    return result;
+}
+
+/**
+ * @brief: Writes the correlation row of a finished job to the correlation csv file and one row per power spectrum bin to the power spectrum csv file.
+*/
+void WriteJobRows(std::ofstream &file, std::ofstream &power_file, const ComparisonJob &job, const JobResult &result)
+{
+    std::vector<std::string> labels = {findsigfig(job.expansion_factor), std::to_string(static_cast<uint>(job.random_seed)), std::to_string(static_cast<uint>(job.num_cells))};
+    Append_csv_row(file, labels, result.correlation);
+    for (size_t bin = 0; bin < result.spectrum.k.size(); bin++){
+        Append_csv_row(power_file, labels, {result.spectrum.k[bin], result.spectrum.power[bin], static_cast<double>(result.spectrum.num_modes[bin])});
+    }
+}
+
+/**
+ * @brief: Parses a comma separated list of grid sizes such as "51,101".
+*/
+std::vector<uint> ParseCellList(const std::string &list)
+{
+    std::vector<uint> cells;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')){
+        int value = std::stoi(item);
+        if (value <= 0){
+            throw std::invalid_argument("Error - the number of cells must be positive!");
+        }
+        cells.push_back(value);
+    }
+    if (cells.empty()){
+        throw std::invalid_argument("Error - no number of cells given!");
+    }
+    return cells;
+}
+
+int main(int argc, char** argv)
 {
     MPI_Init(&argc, &argv);
     int process_id;
     int num_proc;
     MPI_Comm_rank(MPI_COMM_WORLD, &process_id);
     MPI_Comm_size(MPI_COMM_WORLD, &num_proc);
-    uint num_bins = 101;
-    
+
+    std::string wisdom_folder; // empty if FFTW wisdom is not used
+    std::string output_folder;
+    std::vector<ComparisonJob> jobs;
+    double minimum_expansion_factor = 0.0;
+    double maximum_expansion_factor = 0.0;
+
     if (process_id == 0){
         if (argc < 7) { // Checks if the minimum required arguments are provided
-            std::cerr << "Usage: mpirun -np <num_processes> " << argv[0] << " -o <output_folder> -emin <min_expansion_factor> -emax <max_expansion_factor>" << std::endl;
+            std::cerr << "Usage: mpirun -np <num_processes> " << argv[0] << " -o <output_folder> -emin <min_expansion_factor> -emax <max_expansion_factor> [-ne <number_expansion_factors>] [-ns <number_seeds>] [-nc <number_of_cells>[,<number_of_cells>...]] [-w <wisdom_folder>]" << std::endl;
             MPI_Abort(MPI_COMM_WORLD, 1);
             return 1;
         }
 
-        std::string output_folder;
-        double minimum_expansion_factor = 0.0;
-        double maximum_expansion_factor = 0.0;
         bool emin_set = false, emax_set = false;
+        int num_expansion_factors = std::max(num_proc, 2); // one simulation per process by default, as each process used to run one
+        int num_seeds = 1;
+        std::vector<uint> cell_list = {101};
 
-        for (uint i = 1; i < argc; i+=2){
+        for (int i = 1; i + 1 < argc; i+=2){
             std::string arg(argv[i]);
-            if (arg == "-o"){
-                output_folder = argv[i+1];
-            }
-            else if (arg == "-emin"){
-                try {
-                    std::string arg1(argv[i+1]);
+            std::string arg1(argv[i+1]);
+            try {
+                if (arg == "-o"){
+                    output_folder = arg1;
+                }
+                else if (arg == "-emin"){
                     minimum_expansion_factor = std::stod(arg1);
                     emin_set = true;
-                } catch (const std::invalid_argument& ia) {
-                    std::cerr << "Invalid argument for minimum expansion factor: " << argv[i+1] << std::endl;
-                    MPI_Abort(MPI_COMM_WORLD, 1);
                 }
-            }
-            else if (arg == "-emax"){
-                try {
-                    std::string arg1(argv[i+1]);
+                else if (arg == "-emax"){
                     maximum_expansion_factor = std::stod(arg1);
                     emax_set = true;
-                } catch (const std::invalid_argument& ia) {
-                    std::cerr << "Invalid argument for maximum expansion factor: " << argv[i+1] << std::endl;
+                }
+                else if (arg == "-ne"){
+                    num_expansion_factors = std::stoi(arg1);
+                    if (num_expansion_factors < 2){
+                        throw std::invalid_argument("Error - at least 2 expansion factors are needed to span the range!");
+                    }
+                }
+                else if (arg == "-ns"){
+                    num_seeds = std::stoi(arg1);
+                    if (num_seeds < 1){
+                        throw std::invalid_argument("Error - at least 1 seed is needed!");
+                    }
+                }
+                else if (arg == "-nc"){
+                    cell_list = ParseCellList(arg1);
+                }
+                else if (arg == "-w"){
+                    wisdom_folder = arg1;
+                }
+                else { // extra error handling
+                    std::cerr << "Invalid Flag Detected: " << arg << std::endl;
                     MPI_Abort(MPI_COMM_WORLD, 1);
                 }
-            }
-            else { // extra error handling
-                std::cerr << "Invalid Flag Detected: " << arg << std::endl;
+            } catch (const std::invalid_argument& ia) {
+                std::cerr << "Invalid argument for " << arg << ": " << arg1 << std::endl;
                 MPI_Abort(MPI_COMM_WORLD, 1);
             }
         }
@@ -60,78 +197,101 @@ int main(int argc, char** argv)
             std::cerr << "Both minimum and maximum expansion factors are required." << std::endl;
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
-        
-        
+
         if (minimum_expansion_factor >= maximum_expansion_factor) {
             std::cerr << "Minimum expansion factor must be less than the maximum expansion factor." << std::endl;
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
 
+        // every combination of expansion factor, seed and grid is an independent job
+        double expansion_factor_step = (maximum_expansion_factor - minimum_expansion_factor)/(num_expansion_factors - 1);
+        for (int e = 0; e < num_expansion_factors; e++){
+            for (int s = 0; s < num_seeds; s++){
+                for (uint num_cells : cell_list){
+                    double index = jobs.size();
+                    jobs.push_back({index, minimum_expansion_factor + e * expansion_factor_step, 42.0 + s, static_cast<double>(num_cells)});
+                }
+            }
+        }
+    }
 
+    int wisdom_length = wisdom_folder.size();
+    MPI_Bcast(&wisdom_length, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    wisdom_folder.resize(wisdom_length);
+    MPI_Bcast(wisdom_folder.data(), wisdom_length, MPI_CHAR, 0, MPI_COMM_WORLD);
+    std::optional<std::string> wisdom;
+    if (!wisdom_folder.empty()){
+        wisdom = wisdom_folder;
+    }
 
-        uint num_cells = 101;
-        uint average_particles_per_cell = 13;
-        double width = 100.0;
-        uint num_particles = num_cells * num_cells * num_cells * average_particles_per_cell;
-        double mass = 10.0 * 10.0 * 10.0 * 10.0 * 10.0/num_particles;
-        double expansion_factor_step = (maximum_expansion_factor - minimum_expansion_factor)/(num_proc - 1);
-        double expansion_factor = minimum_expansion_factor + process_id * expansion_factor_step;
-        std::vector<std::string> expansion_fac_vec = {findsigfig(expansion_factor)};
-
-        for (int i = 1; i < num_proc; i++){
-            MPI_Send(&minimum_expansion_factor, 1, MPI_DOUBLE, i, 0, MPI_COMM_WORLD);
-            MPI_Send(&expansion_factor_step, 1, MPI_DOUBLE, i, 1, MPI_COMM_WORLD);
+    if (process_id == 0){
+        std::string file_suffix = std::to_string(jobs.size()) + "_" + findsigfig(minimum_expansion_factor) + "_" + findsigfig(maximum_expansion_factor) + ".csv";
+        std::string filepath = output_folder + "/Comparison_" + file_suffix;
+        std::string power_filepath = output_folder + "/PowerSpectrum_" + file_suffix;
+        std::filesystem::create_directories(output_folder);
+        std::ofstream file(filepath);
+        std::ofstream power_file(power_filepath);
+        if (!file.is_open() || !power_file.is_open()) {
+            std::cerr << "Failed to open the file " << (file.is_open() ? power_filepath : filepath) << std::endl;
+            MPI_Abort(MPI_COMM_WORLD, 1);
         }
-        uint random_seed = 42;
-        double t_max = 1.5;
-        double time_step = 0.01;
-        Simulation sim(t_max, time_step, particle_group(mass, num_particles, random_seed), width, num_cells, expansion_factor);
-        sim.run();
-        const particle_group particle_collection = sim.get_particle_collection();
-        std::vector<double> corr_func = correlationFunction(particle_collection, num_bins);
-        std::vector<std::vector<double>> corr_funcs = {corr_func,};
-        for (int i = 1; i < num_proc; i++){
-            // collect expansion_factors into vector
-            expansion_fac_vec.push_back(findsigfig(minimum_expansion_factor + i * expansion_factor_step));
-            
-            // receive data from non-master processes
-            int receive_size;
-            MPI_Recv(&receive_size, 1, MPI_INT, i, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            std::vector<double> receive_vec(receive_size);
-            MPI_Recv(receive_vec.data(), receive_size, MPI_DOUBLE, i, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            corr_funcs.push_back(receive_vec);
+        std::vector<std::string> header = {"expansion_factor", "random_seed", "num_cells"};
+        std::vector<std::string> power_header = header;
+        for (uint bin = 0; bin < num_bins; bin++){
+            header.push_back("log_1_plus_xi_bin_" + std::to_string(bin)); // log(1 + xi) of the correlation function in the bin
         }
-        std::string filepath = output_folder + "/Comparison_" + std::to_string(num_proc) + "_" + findsigfig(minimum_expansion_factor) + "_" 
-        + findsigfig(maximum_expansion_factor) + ".csv";
+        power_header.insert(power_header.end(), {"k", "power", "modes"}); // one row per bin, so grids of any size share the columns
+        Append_csv_row(file, header, {});
+        Append_csv_row(power_file, power_header, {});
 
-        std::filesystem::create_directories(output_folder);
-        Save_Correlations_csv(corr_funcs, expansion_fac_vec, filepath);
+        size_t next_job = 0;
+        if (num_proc == 1){ // no workers, so the only process runs every job itself
+            for (; next_job < jobs.size(); next_job++){
+                WriteJobRows(file, power_file, jobs[next_job], RunJob(jobs[next_job], wisdom));
+            }
+        }
+        else{
+            // the master only hands out jobs and writes rows, every worker keeps a receive for its current result posted
+            int num_workers = num_proc - 1;
+            std::vector<MPI_Request> requests(num_workers, MPI_REQUEST_NULL);
+            std::vector<std::vector<double>> results(num_workers, std::vector<double>(result_length));
+            auto dispatch = [&](int worker){
+                int worker_rank = worker + 1;
+                if (next_job < jobs.size()){
+                    MPI_Send(&jobs[next_job], 4, MPI_DOUBLE, worker_rank, job_tag, MPI_COMM_WORLD);
+                    MPI_Irecv(results[worker].data(), result_length, MPI_DOUBLE, worker_rank, result_tag, MPI_COMM_WORLD, &requests[worker]);
+                    next_job++;
+                }
+                else{
+                    MPI_Send(nullptr, 0, MPI_DOUBLE, worker_rank, stop_tag, MPI_COMM_WORLD);
+                }
+            };
+            for (int worker = 0; worker < num_workers; worker++){
+                dispatch(worker);
+            }
+            while (true){
+                int worker;
+                MPI_Waitany(num_workers, requests.data(), &worker, MPI_STATUS_IGNORE);
+                if (worker == MPI_UNDEFINED){ // no receives left, every worker has been stopped
+                    break;
+                }
+                const std::vector<double> &result = results[worker];
+                WriteJobRows(file, power_file, jobs[static_cast<size_t>(result[0])], UnpackResult(result)); // rows are written in the order jobs finish
+                dispatch(worker);
+            }
+        }
     }
     else{
-        double expansion_factor_step;
-        double minimum_expansion_factor;
-
-        uint num_cells = 101;
-        uint average_particles_per_cell = 13;
-        double width = 100.0;
-        uint num_particles = num_cells * num_cells * num_cells * average_particles_per_cell;
-        double mass = 10.0 * 10.0 * 10.0 * 10.0 * 10.0/num_particles;
-
-        MPI_Recv(&expansion_factor_step, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        MPI_Recv(&minimum_expansion_factor, 1, MPI_DOUBLE, 0, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-        double expansion_factor = minimum_expansion_factor + process_id * expansion_factor_step;
-        uint random_seed = 42;
-        double t_max = 1.5;
-        double time_step = 0.01;
-
-        Simulation sim(t_max, time_step, particle_group(mass, num_particles, random_seed), width, num_cells, expansion_factor);
-        sim.run();
-        const particle_group particle_collection = sim.get_particle_collection();
-        std::vector<double> corr_func = correlationFunction(particle_collection, num_bins);
-        MPI_Send(&num_bins, 1, MPI_UNSIGNED, 0, 2, MPI_COMM_WORLD);
-        MPI_Send(corr_func.data(), num_bins, MPI_DOUBLE, 0, 3, MPI_COMM_WORLD);
-
+        while (true){
+            ComparisonJob job;
+            MPI_Status status;
+            MPI_Recv(&job, 4, MPI_DOUBLE, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            if (status.MPI_TAG == stop_tag){
+                break;
+            }
+            std::vector<double> result = PackResult(job, RunJob(job, wisdom));
+            MPI_Send(result.data(), result_length, MPI_DOUBLE, 0, result_tag, MPI_COMM_WORLD);
+        }
     }
     MPI_Finalize();
-}
\ No newline at end of file
+}
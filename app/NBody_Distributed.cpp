@@ -0,0 +1,144 @@
+#include <mpi.h>
+#include "DistributedSimulation.hpp"
+#include "Utils.hpp"
+#include <iostream>
+#include <optional>
+#include <string>
+
+/**
+ * @brief: This function prints a help message for the NBody_Distributed application
+*/
+void HelpMessage(){
+    std::cout << "This program runs the particle mesh simulation of NBody_Visualiser with the grid and particles split over MPI processes, for grids too large for one node.\n\nBrief instructions can be found below." << std::endl;
+    std::cout << "Usage: mpirun -np <num_processes> NBody_Distributed -nc <number_of_cells> -np <average_particles_per_cell> -t <total_time> -dt <time_step> -F <expansion_factor> -o <output_folder> -s <random_seed> [-m <mass_assignment>]\n"
+              << "Options:\n"
+              << "  -h                                       Show this help message\n"
+              << "  -nc <number_of_cells>                    Number of cells wide the equal sided box has, at least twice the number of processes\n"
+              << "  -np <average_particles_per_cell>         Average number of particles each cell has\n"
+              << "  -t  <total_time>                         Total time the simulation will run for\n"
+              << "  -dt <time_step>                          Amount of time that is incremented each propagation\n"
+              << "  -F  <expansion_factor>                   Factor that the absolute value of the box expands\n"
+              << "  -o  <output_folder>                      Folder that output images are sent to\n"
+              << "  -s  <random_seed>                        Seed that is used to generate initial randomised positions\n"
+              << "  -m  <mass_assignment>                    Optional mass assignment scheme NGP, CIC or TSC (default NGP)" << std::endl;
+}
+
+/**
+ * @brief: Parses the arguments and runs the simulation. Every process parses the same arguments, only the first one reports errors.
+ * @returns: Exit code of the process.
+*/
+int RunDistributed(int argc, char** argv, int process_id, int num_proc)
+{
+    bool report = process_id == 0;
+    std::optional<std::string> output_folder;
+    std::optional<uint> num_cells, random_seed;
+    std::optional<double> average_particles_per_cell, time_step, expansion_factor, max_time;
+    mass_assignment scheme = mass_assignment::NGP;
+
+    for (int i = 1; i < argc; i+=2){
+        std::string arg(argv[i]);
+        if (arg == "-h"){
+            if (report){
+                HelpMessage();
+            }
+            return 0;
+        }
+        if (i + 1 >= argc){
+            if (report){
+                std::cerr << "Error - Missing value for flag " << arg << "!" << std::endl;
+                HelpMessage();
+            }
+            return 1;
+        }
+        std::string arg1(argv[i+1]);
+        try{
+            if (arg == "-o"){
+                output_folder = arg1;
+            }
+            else if (arg == "-nc"){
+                num_cells = std::stoi(arg1);
+            }
+            else if (arg == "-np"){
+                average_particles_per_cell = std::stod(arg1);
+            }
+            else if (arg == "-t"){
+                max_time = std::stod(arg1);
+            }
+            else if (arg == "-dt"){
+                time_step = std::stod(arg1);
+            }
+            else if (arg == "-F"){
+                expansion_factor = std::stod(arg1);
+            }
+            else if (arg == "-s"){
+                random_seed = std::stoi(arg1);
+            }
+            else if (arg == "-m"){
+                scheme = mass_assignment_from_string(arg1);
+            }
+            else{ // extra error handling
+                if (report){
+                    std::cerr << "Invalid Flag Detected: " << arg << std::endl;
+                    HelpMessage();
+                }
+                return 1;
+            }
+        }
+        catch (const std::exception &e){
+            if (report){
+                std::cerr << "Invalid argument for " << arg << ": " << arg1 << std::endl;
+                HelpMessage();
+            }
+            return 1;
+        }
+    }
+
+    if (!(output_folder && num_cells && average_particles_per_cell && time_step && expansion_factor && random_seed && max_time)){
+        if (report){
+            std::cerr << "Please Input the Required Flags!" << std::endl;
+            HelpMessage();
+        }
+        return 1;
+    }
+
+    try{
+        // every process generates its own share of the same particles a single process would generate for this seed
+        double width = 100.0;
+        size_t num_particles = static_cast<size_t>(*num_cells) * *num_cells * *num_cells * *average_particles_per_cell;
+        double mass = 10.0 * 10.0 * 10.0 * 10.0 * 10.0/num_particles;
+        size_t share = num_particles / num_proc;
+        size_t remainder = num_particles % num_proc;
+        size_t local_particles = share + (static_cast<size_t>(process_id) < remainder ? 1 : 0);
+        size_t first_particle = process_id * share + std::min<size_t>(process_id, remainder);
+
+        DistributedSimulation sim(*max_time, *time_step, particle_group(mass, local_particles, *random_seed, first_particle), width, *num_cells, *expansion_factor, scheme);
+        sim.run(*output_folder + "/" + removeTrailingDecimalPlaces(*random_seed));
+    }
+    catch (const std::bad_alloc &e){
+        std::cerr << "Error - Memory Overflow: Please use smaller values for -nc <number_of_cells> or -np <average_number_particles_per_cell> arguments, or more processes!" << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    catch (const std::exception &e){
+        // argument errors are found by every process in the constructor before any communication
+        if (report){
+            std::cerr << e.what() << std::endl;
+            HelpMessage();
+        }
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    MPI_Init(&argc, &argv);
+    int process_id;
+    int num_proc;
+    MPI_Comm_rank(MPI_COMM_WORLD, &process_id);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_proc);
+
+    int exit_code = RunDistributed(argc, argv, process_id, num_proc);
+
+    MPI_Finalize();
+    return exit_code;
+}
@@ -3,14 +3,17 @@
 #include <optional>
 #include <filesystem>
 #include <memory>
+#include <type_traits>
 #include "Utils.hpp"
+#include "Checkpoint.hpp"
 
 /**
  * @brief: This function prints a help message for the NBody_Visualiser application
 */
 void HelpMessage(){
     std::cout << "This program visualises a developing universe through modelling the graviational fields of multiple particles with the same mass using the particle mesh method.\n\nBrief instructions can be found below." << std::endl;
-    std::cout << "Usage: NBody_Visualiser -nc <number_of_cells> -np <average_particles_per_cell> -t <total_time> -dt <time_step> -F <expansion_factor> -o <output_folder> -s <random_seed>\n"
+    std::cout << "Usage: NBody_Visualiser -nc <number_of_cells> -np <average_particles_per_cell> -t <total_time> -dt <time_step> -F <expansion_factor> -o <output_folder> -s <random_seed> [-m <mass_assignment>] [-w <wisdom_folder>] [-g <gradient_method>] [-v <velocity_frame>] [-k <sort_interval>] [-I <integrator>] [-cf <courant_factor>] [-dtmax <max_time_step>] [-p <precision>] [-c <checkpoint_interval>] [-i <image_format>] [-d <snapshot_format>] [-O <output_trigger>]...\n"
+              << "       NBody_Visualiser -r <checkpoint_file> [-t <total_time>] [-w <wisdom_folder>] [-c <checkpoint_interval>] [-i <image_format>] [-d <snapshot_format>] [-O <output_trigger>]...\n"
               << "Options:\n"
               << "  -h                                       Show this help message\n"
               << "  -nc <number_of_cells>                    Number of cells wide the equal sided box has\n"
@@ -19,19 +22,42 @@ void HelpMessage(){
               << "  -dt <time_step>                          Amount of time that is incremented each propagation\n"
               << "  -F  <expansion_factor>                   Factor that the absolute value of the box expands\n"
               << "  -o  <output_folder>                      Folder that output images are sent to\n"
-              << "  -s  <random_seed>                        Seed that is used to generate initial randomised positions" << std::endl;
+              << "  -s  <random_seed>                        Seed that is used to generate initial randomised positions\n"
+              << "  -m  <mass_assignment>                    Optional mass assignment scheme NGP, CIC or TSC (default NGP)\n"
+              << "  -w  <wisdom_folder>                      Optional folder that FFTW wisdom is loaded from and saved to so FFT planning is only slow once\n"
+              << "  -g  <gradient_method>                    Optional gradient method FD (finite difference) or SPECTRAL (default FD)\n"
+              << "  -v  <velocity_frame>                     Optional velocities stored for the particles, PHYSICAL or COMOVING (default PHYSICAL).\n"
+              << "                                           COMOVING folds the expansion into the kick and drift so expanding the box touches no particles\n"
+              << "  -k  <sort_interval>                      Optional number of steps between reorderings of the particles along a space filling curve, for cache locality\n"
+              << "  -I  <integrator>                         Optional integrator EULER (fixed -dt steps) or KDK (second order leapfrog with adaptive steps) (default EULER)\n"
+              << "  -cf <courant_factor>                     Optional fraction of a cell a particle may cross in a KDK step (default 0.25)\n"
+              << "  -dtmax <max_time_step>                   Optional largest KDK step (default -dt). -F stays the expansion per -dt of elapsed time\n"
+              << "  -p  <precision>                          Optional floating point precision DOUBLE, FLOAT (single precision particles, grids and FFTs)\n"
+              << "                                           or MIXED (single precision with the density accumulated in double) (default DOUBLE)\n"
+              << "  -c  <checkpoint_interval>                Optional number of steps between checkpoints written to <output_folder>/<random_seed>/checkpoint.pmsim\n"
+              << "  -r  <checkpoint_file>                    Resume from a checkpoint. The other settings are read from it, -t may extend the run,\n"
+              << "                                           and outputs and checkpoints are written to the folder of the checkpoint\n"
+              << "  -i  <image_format>                       Optional image format P6 (binary) or P3 (text) (default P6)\n"
+              << "  -d  <snapshot_format>                    Optional binary snapshots of the full density and particles next to every image, RAW or ZLIB (compressed).\n"
+              << "                                           With -O it only selects the compression of the density and particles outputs\n"
+              << "  -O  <output_trigger>                     Optional, repeatable output trigger replacing the default image every 10 steps:\n"
+              << "                                           every:<steps>:<outputs>, times:<t1>,<t2>,...:<outputs>, expansions:<a1>,<a2>,...:<outputs> or end:<outputs>,\n"
+              << "                                           where <outputs> is a comma separated list of projection, density, particles and power_spectrum" << std::endl;
 }
 
 int main(int argc, char** argv)
 {
     
     std::string output_folder;
-    uint num_cells;
-    uint random_seed;
-    double average_particles_per_cell;
-    double time_step;
-    double expansion_factor;
-    double max_time;
+    std::optional<std::string> wisdom_folder;
+    mass_assignment scheme = mass_assignment::NGP;
+    force_method gradient_method = force_method::finite_difference;
+    uint num_cells = 0;
+    uint random_seed = 0;
+    double average_particles_per_cell = 0;
+    double time_step = 0;
+    double expansion_factor = 0;
+    double max_time = 0;
 
     bool output_folder_set = false;
     bool num_cells_set = false;
@@ -40,6 +66,20 @@ int main(int argc, char** argv)
     bool expansion_factor_set = false;
     bool random_seed_set = false;
     bool max_time_set = false;
+    bool scheme_set = false;
+    bool gradient_method_set = false;
+    std::optional<velocity_frame> frame;
+    uint sort_interval = 0;
+    std::optional<integrator> time_integrator;
+    std::optional<double> courant_factor;
+    std::optional<double> max_step;
+    precision real_precision = precision::double_precision;
+    bool precision_set = false;
+    uint checkpoint_interval = 0;
+    std::optional<std::string> resume_file;
+    std::optional<image_format> images;
+    std::optional<snapshot_compression> snapshots;
+    std::optional<OutputSchedule> schedule;
     
     for (uint i = 1; i < argc; i+=2){
         std::string arg(argv[i]);
@@ -120,6 +160,228 @@ int main(int argc, char** argv)
             random_seed = std::atoi(arg1.c_str());
             random_seed_set = true;
         }
+        else if (arg == "-m"){
+            if (scheme_set){
+                std::cerr << "Error - the mass assignment scheme has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            try{
+                scheme = mass_assignment_from_string(arg1);
+            }
+            catch (const std::invalid_argument &e){
+                std::cerr << e.what() << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            scheme_set = true;
+        }
+        else if (arg == "-w"){
+            if (wisdom_folder){
+                std::cerr << "Error - the wisdom folder has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            wisdom_folder = arg1;
+        }
+        else if (arg == "-g"){
+            if (gradient_method_set){
+                std::cerr << "Error - the gradient method has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            if (arg1 == "FD" || arg1 == "fd"){
+                gradient_method = force_method::finite_difference;
+            }
+            else if (arg1 == "SPECTRAL" || arg1 == "spectral"){
+                gradient_method = force_method::spectral;
+            }
+            else{
+                std::cerr << "Error - the gradient method must be FD or SPECTRAL!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            gradient_method_set = true;
+        }
+        else if (arg == "-v"){
+            if (frame){
+                std::cerr << "Error - the velocity frame has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            if (arg1 == "PHYSICAL" || arg1 == "physical"){
+                frame = velocity_frame::physical;
+            }
+            else if (arg1 == "COMOVING" || arg1 == "comoving"){
+                frame = velocity_frame::comoving;
+            }
+            else{
+                std::cerr << "Error - the velocity frame must be PHYSICAL or COMOVING!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+        }
+        else if (arg == "-k"){
+            if (sort_interval != 0){
+                std::cerr << "Error - the sort interval has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            int interval = std::atoi(arg1.c_str());
+            if (interval <= 0){
+                std::cerr << "Error - the sort interval must be a positive number of steps!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            sort_interval = interval;
+        }
+        else if (arg == "-I"){
+            if (time_integrator){
+                std::cerr << "Error - the integrator has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            if (arg1 == "EULER" || arg1 == "euler"){
+                time_integrator = integrator::euler;
+            }
+            else if (arg1 == "KDK" || arg1 == "kdk"){
+                time_integrator = integrator::leapfrog_kdk;
+            }
+            else{
+                std::cerr << "Error - the integrator must be EULER or KDK!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+        }
+        else if (arg == "-cf"){
+            if (courant_factor){
+                std::cerr << "Error - the courant factor has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            double factor = std::atof(arg1.c_str());
+            if (factor <= 0){
+                std::cerr << "Error - the courant factor must be larger than 0!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            courant_factor = factor;
+        }
+        else if (arg == "-dtmax"){
+            if (max_step){
+                std::cerr << "Error - the largest time step has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            double step = std::atof(arg1.c_str());
+            if (step <= 0){
+                std::cerr << "Error - the largest time step must be larger than 0!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            max_step = step;
+        }
+        else if (arg == "-p"){
+            if (precision_set){
+                std::cerr << "Error - the precision has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            try{
+                real_precision = precision_from_string(arg1);
+            }
+            catch (const std::invalid_argument &e){
+                std::cerr << e.what() << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            precision_set = true;
+        }
+        else if (arg == "-c"){
+            if (checkpoint_interval != 0){
+                std::cerr << "Error - the checkpoint interval has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            int interval = std::atoi(arg1.c_str());
+            if (interval <= 0){
+                std::cerr << "Error - the checkpoint interval must be a positive number of steps!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            checkpoint_interval = interval;
+        }
+        else if (arg == "-r"){
+            if (resume_file){
+                std::cerr << "Error - the checkpoint to resume from has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            resume_file = arg1;
+        }
+        else if (arg == "-i"){
+            if (images){
+                std::cerr << "Error - the image format has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            if (arg1 == "P6" || arg1 == "p6"){
+                images = image_format::binary;
+            }
+            else if (arg1 == "P3" || arg1 == "p3"){
+                images = image_format::ascii;
+            }
+            else{
+                std::cerr << "Error - the image format must be P6 or P3!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+        }
+        else if (arg == "-d"){
+            if (snapshots){
+                std::cerr << "Error - the snapshot format has already been set!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+            std::string arg1(argv[i + 1]);
+            if (arg1 == "RAW" || arg1 == "raw"){
+                snapshots = snapshot_compression::none;
+            }
+            else if (arg1 == "ZLIB" || arg1 == "zlib"){
+                snapshots = snapshot_compression::zlib;
+            }
+            else{
+                std::cerr << "Error - the snapshot format must be RAW or ZLIB!" << std::endl;
+                HelpMessage();
+                return 1;
+            }
+        }
+        else if (arg == "-O"){
+            if (!schedule){
+                schedule.emplace();
+            }
+            std::string arg1(argv[i + 1]);
+            try{
+                schedule->add_trigger(arg1);
+            }
+            catch (const std::invalid_argument &e){
+                std::cerr << e.what() << std::endl;
+                HelpMessage();
+                return 1;
+            }
+        }
         else{ // extra error handling
             std::cerr << "Invalid Flag Detected: " << arg << std::endl;
             HelpMessage();
@@ -127,34 +389,112 @@ int main(int argc, char** argv)
         }
     }
     
-    if (!(output_folder_set && num_cells_set && average_particle_per_cell_set && time_step_set && expansion_factor_set && random_seed_set && max_time_set)){
+    if (resume_file){
+        // a resumed run must continue with exactly the state it was checkpointed with
+        if (num_cells_set || average_particle_per_cell_set || time_step_set || expansion_factor_set || scheme_set || gradient_method_set || frame || sort_interval != 0 || time_integrator || courant_factor || max_step || precision_set){
+            std::cerr << "Error - only -t, -w, -c, -i, -d and -O can be used with -r as the other settings are read from the checkpoint!" << std::endl;
+            HelpMessage();
+            return 1;
+        }
+        if (output_folder_set || random_seed_set){
+            std::cerr << "Error - -o and -s cannot be used with -r as the run continues in the folder of its checkpoint!" << std::endl;
+            HelpMessage();
+            return 1;
+        }
+    }
+    else if (!(output_folder_set && num_cells_set && average_particle_per_cell_set && time_step_set && expansion_factor_set && random_seed_set && max_time_set)){
         std::cerr << "Please Input the Required Flags!" << std::endl;
         HelpMessage();
         return 1;
     }
 
-    double width = 100.0;
-    uint num_particles = num_cells * num_cells * num_cells * average_particles_per_cell;
-    double mass = 10.0 * 10.0 * 10.0 * 10.0 * 10.0/num_particles;
-    
-    std::unique_ptr<Simulation> Simulation_ptr;
-
-    try{
-        particle_group particles(mass, num_particles, random_seed);
-        Simulation_ptr = std::make_unique<Simulation>(max_time, time_step, particles, width, num_cells, expansion_factor);
+    std::optional<SimulationCheckpoint> checkpoint;
+    if (resume_file){
+        try{
+            checkpoint = load_checkpoint(*resume_file);
+        }
+        catch(const std::exception &e){
+            std::cerr << e.what() << std::endl;
+            HelpMessage();
+            return 1;
+        }
+        if (max_time_set){
+            checkpoint->time_max = max_time;
+        }
+        real_precision = checkpoint->real_precision; // a resumed run continues in the precision it was checkpointed with
+        // checkpoints are written to <output_folder>/<random_seed>/, so the resumed run writes its outputs and checkpoints next to the one it continues
+        output_folder = std::filesystem::path(*resume_file).parent_path().string();
+        if (output_folder.empty()){
+            output_folder = ".";
+        }
     }
-    catch (const std::bad_alloc &e){
-        std::cerr << "Error - Memory Overflow: Please use smaller values for -nc <number_of_cells> or -np <average_number_particles_per_cell> arguments!" << std::endl;
-        HelpMessage();
-        return 1;
+    else{
+        output_folder += "/" +  removeTrailingDecimalPlaces(random_seed);
     }
-    catch(const std::exception &e){
-        std::cerr << e.what() << std::endl;
-        HelpMessage();
-        return 1;
+
+    // the simulation type is selected by the precision, so the rest of the set up is written once for every type
+    auto run_simulation = [&](auto simulation_type) -> int {
+        using SimulationType = std::remove_pointer_t<decltype(simulation_type)>;
+        std::unique_ptr<SimulationType> Simulation_ptr;
+
+        try{
+            if (checkpoint){
+                Simulation_ptr = SimulationType::from_checkpoint(std::move(*checkpoint), wisdom_folder);
+            }
+            else{
+                double width = 100.0;
+                uint num_particles = num_cells * num_cells * num_cells * average_particles_per_cell;
+                double mass = 10.0 * 10.0 * 10.0 * 10.0 * 10.0/num_particles;
+                particle_group particles(mass, num_particles, random_seed); // drawn in double so every precision starts from the same particles
+                Simulation_ptr = std::make_unique<SimulationType>(max_time, time_step, basic_particle_group<typename SimulationType::real_type>(std::move(particles)), 
+                                                                  width, num_cells, expansion_factor, scheme, wisdom_folder);
+                Simulation_ptr->set_force_method(gradient_method);
+                if (frame){
+                    Simulation_ptr->set_velocity_frame(*frame);
+                }
+                Simulation_ptr->set_particle_sorting(sort_interval);
+                if (time_integrator || courant_factor || max_step){
+                    Simulation_ptr->set_integrator(time_integrator.value_or(integrator::euler), courant_factor.value_or(0.25), max_step.value_or(0));
+                }
+            }
+            if (images){
+                Simulation_ptr->set_image_format(*images);
+            }
+            if (snapshots){
+                Simulation_ptr->set_snapshot_compression(*snapshots);
+                if (!schedule){ // snapshots next to the default images
+                    schedule = OutputSchedule::projection_every(10);
+                    schedule->every_steps(10, {output_type::density, output_type::particles});
+                }
+            }
+            if (schedule){
+                Simulation_ptr->set_output_schedule(std::move(*schedule));
+            }
+        }
+        catch (const std::bad_alloc &e){
+            std::cerr << "Error - Memory Overflow: Please use smaller values for -nc <number_of_cells> or -np <average_number_particles_per_cell> arguments!" << std::endl;
+            HelpMessage();
+            return 1;
+        }
+        catch(const std::exception &e){
+            std::cerr << e.what() << std::endl;
+            HelpMessage();
+            return 1;
+        }
+        if (checkpoint_interval > 0){
+            std::filesystem::create_directories(output_folder);
+            Simulation_ptr->set_checkpointing(output_folder + "/checkpoint.pmsim", checkpoint_interval);
+        }
+        Simulation_ptr->run(output_folder);
+        return 0;
+    };
+
+    switch (real_precision){
+        case precision::single_precision:
+            return run_simulation(static_cast<SimulationFloat *>(nullptr));
+        case precision::mixed:
+            return run_simulation(static_cast<SimulationMixed *>(nullptr));
+        default:
+            return run_simulation(static_cast<Simulation *>(nullptr));
     }
-    output_folder += "/" +  removeTrailingDecimalPlaces(random_seed);
-    Simulation_ptr->run(output_folder);
-    
-    return 0;
-}
\ No newline at end of file
+}
@@ -3,7 +3,16 @@
 #include <string>
 #include <omp.h>
 #include <chrono>
+#include <optional>
+#include <filesystem>
+#include <random>
+#include <cmath>
+#include <tuple>
+#include <algorithm>
+#include <type_traits>
 #include "Simulation.hpp"
+#include "FFTPlans.hpp"
+#include "Utils.hpp"
 
 class BenchmarkData
 {
@@ -29,6 +38,49 @@ public:
     std::chrono::high_resolution_clock::time_point t1;
 };
 
+/**
+ * @brief: Generates particles clustered in a few tight gaussian blobs, similar to a late time distribution, wrapped into the unit box.
+*/
+particle_group ClusteredParticles(double mass, uint num_particles, uint num_clusters, double cluster_width, uint random_seed)
+{
+    std::default_random_engine generator(random_seed);
+    std::uniform_real_distribution<double> centre_dist(0, 1);
+    std::normal_distribution<double> offset_dist(0, cluster_width);
+    std::vector<std::array<double, 3>> centres(num_clusters);
+    for (auto &centre : centres){
+        centre = {centre_dist(generator), centre_dist(generator), centre_dist(generator)};
+    }
+    std::vector<std::array<double, 3>> positions(num_particles);
+    for (uint i = 0; i < num_particles; i++){
+        for (uint j = 0; j < 3; j++){
+            double position = centres[i % num_clusters][j] + offset_dist(generator);
+            position -= std::floor(position);
+            positions[i][j] = position < 1 ? position : 0;
+        }
+    }
+    return particle_group(mass, num_particles, positions);
+}
+
+/**
+ * @brief: Fraction of consecutive particles whose cells lie in different 64 byte lines of the density buffer, a proxy for the cache misses of the deposit
+ * and force interpolation that needs no hardware counters (run the benchmark under perf stat -e cache-misses for those).
+*/
+double CacheLineSwitches(const particle_group &particles, uint num_cells)
+{
+    size_t switches = 0;
+    size_t previous_line = 0;
+    for (size_t index = 0; index < particles.get_num_particles(); index++){
+        size_t cell[3];
+        for (uint dim = 0; dim < 3; dim++){
+            cell[dim] = std::min<size_t>(particles.position[dim][index] * num_cells, num_cells - 1);
+        }
+        size_t line = (cell[2] + num_cells * (cell[1] + num_cells * cell[0])) / 8;
+        switches += index > 0 && line != previous_line;
+        previous_line = line;
+    }
+    return particles.get_num_particles() > 1 ? static_cast<double>(switches) / (particles.get_num_particles() - 1) : 0;
+}
+
 std::ostream& operator<<(std::ostream &os, const BenchmarkData& b)
 {
     std::cout << "Benchmarking " << b.name << " with " << b.num_threads << " threads." << std::endl;
@@ -52,6 +104,37 @@ int main()
 
     std::string info = "The number of cells per length of the box is " + std::to_string(num_cells) + " and the number of particles is " + std::to_string(num_particles) + ".";
     
+    // startup cost of FFT planning with FFTW_MEASURE, without wisdom, when wisdom is saved and when it is loaded again
+    std::string wisdom_folder = (std::filesystem::temp_directory_path() / "pm_simulation_wisdom").string();
+    std::filesystem::remove(FFTPlans::wisdom_filename(wisdom_folder, num_cells, max_threads));
+    std::vector<std::pair<std::string, std::optional<std::string>>> startup_configs = {{"Simulation Startup without Wisdom", std::nullopt}, 
+        {"Simulation Startup saving Wisdom", wisdom_folder}, {"Simulation Startup loading Wisdom", wisdom_folder}};
+    particle_group no_particles(mass, 0, {}); // particles are not part of the planning cost
+    std::vector<BenchmarkData> startup_benches;
+    for (auto & [name, wisdom] : startup_configs){
+        FFTPlans::clear_cache(); // force planning as if this was a new process
+        fftw_forget_wisdom();
+        BenchmarkData startup_bench(name, max_threads);
+        startup_bench.start();
+        Simulation sim(1.5, 0.01, no_particles, 100.0, num_cells, 1.02, mass_assignment::NGP, wisdom);
+        startup_bench.finish();
+        bool imported = FFTPlans::get_plans(num_cells, max_threads)->get_wisdom_imported();
+        startup_bench.info = "The number of cells per length of the box is " + std::to_string(num_cells) + ". Wisdom imported: " + (imported ? "yes" : "no") + ".";
+        startup_benches.push_back(startup_bench);
+    }
+    
+    // parallel initialisation of the particles
+    std::vector<BenchmarkData> init_benches;
+    for (uint i = 1; i <= max_threads; i++){
+        omp_set_num_threads(i);
+        BenchmarkData init_bench("Particle Initialisation", i);
+        init_bench.start();
+        particle_group init_particles(mass, num_particles, 42);
+        init_bench.finish();
+        init_bench.info = info;
+        init_benches.push_back(init_bench);
+    }
+
     std::vector<BenchmarkData> density_benches;
     std::vector<BenchmarkData> potential_benches;
     std::vector<BenchmarkData> gradient_benches;
@@ -104,6 +187,309 @@ int main()
         expansion_bench.info = info;
         expansion_benches.push_back(expansion_bench);
     }
+    // cost of the smoother mass assignment schemes at the maximum number of threads
+    std::vector<BenchmarkData> scheme_benches;
+    omp_set_num_threads(max_threads);
+    for (mass_assignment scheme : {mass_assignment::NGP, mass_assignment::CIC, mass_assignment::TSC}){
+        Simulation sim(1.5, 0.01, particles, 100.0, num_cells, 1.02, scheme);
+        std::string scheme_name = mass_assignment_to_string(scheme);
+
+        BenchmarkData density_bench(scheme_name + " Density Calculation", max_threads);
+        density_bench.start();
+        sim.fill_density_buffer();
+        density_bench.finish();
+        density_bench.info = info;
+        scheme_benches.push_back(density_bench);
+
+        sim.fill_potential_buffer();
+        BenchmarkData update_par_bench(scheme_name + " Particle Update and Gradient Calc", max_threads);
+        update_par_bench.start();
+        sim.update_particles();
+        update_par_bench.finish();
+        update_par_bench.info = info;
+        scheme_benches.push_back(update_par_bench);
+    }
+
+    // particle update followed by a separate expansion pass against the fused kernel run uses. Bytes are the streamed particle arrays only:
+    // the kick and drift read and write 3 positions and 3 velocities (96 bytes per particle) and the expansion reads and writes the velocities again (48 bytes)
+    std::vector<BenchmarkData> fused_benches;
+    {
+        Simulation sim(1.5, 0.01, particles, 100.0, num_cells, 1.02);
+        for (bool fused : {false, true}){
+            sim.fill_density_buffer();
+            sim.fill_potential_buffer();
+            BenchmarkData step_bench(fused ? "Fused Particle Update and Expansion" : "Particle Update then Expansion", max_threads);
+            step_bench.start();
+            if (fused){
+                sim.update_particles_and_expand();
+            }
+            else{
+                sim.update_particles();
+                sim.box_expansion();
+            }
+            step_bench.finish();
+            double bytes = static_cast<double>(num_particles) * (fused ? 96 : 144);
+            step_bench.info = info + " Particle bytes moved per step: " + std::to_string(bytes / 1e6) + " MB (" + std::to_string(bytes / 1e9 / step_bench.time) + " GB/s).";
+            fused_benches.push_back(step_bench);
+        }
+
+        // with comoving velocities the expansion is a scalar update, so a step streams the particle arrays once without fusing anything
+        sim.set_velocity_frame(velocity_frame::comoving);
+        sim.fill_density_buffer();
+        sim.fill_potential_buffer();
+        BenchmarkData comoving_bench("Comoving Particle Update and Expansion", max_threads);
+        comoving_bench.start();
+        sim.update_particles();
+        sim.box_expansion();
+        comoving_bench.finish();
+        double bytes = static_cast<double>(num_particles) * 96;
+        comoving_bench.info = info + " Particle bytes moved per step: " + std::to_string(bytes / 1e6) + " MB (" + std::to_string(bytes / 1e9 / comoving_bench.time) + " GB/s).";
+        fused_benches.push_back(comoving_bench);
+    }
+
+    // atomic against plane binned density deposit for uniform and clustered particles (one particle per cell on average)
+    std::vector<BenchmarkData> deposit_benches;
+    uint deposit_particles = num_cells * num_cells * num_cells;
+    std::vector<std::pair<std::string, particle_group>> deposit_inputs;
+    deposit_inputs.emplace_back("Uniform", particle_group(mass, deposit_particles, 42));
+    deposit_inputs.emplace_back("Clustered", ClusteredParticles(mass, deposit_particles, 8, 0.01, 42));
+    std::string deposit_info = "The number of cells per length of the box is " + std::to_string(num_cells) + " and the number of particles is " + std::to_string(deposit_particles) + ".";
+    for (auto & [input_name, input_particles] : deposit_inputs){
+        for (mass_assignment scheme : {mass_assignment::NGP, mass_assignment::CIC}){
+            Simulation sim(1.5, 0.01, input_particles, 100.0, num_cells, 1.02, scheme);
+            for (deposit_method method : {deposit_method::atomic, deposit_method::plane_binned}){
+                sim.set_deposit_method(method);
+                std::string method_name = method == deposit_method::atomic ? "Atomic" : "Plane Binned";
+                BenchmarkData deposit_bench(method_name + " " + mass_assignment_to_string(scheme) + " Density Calculation (" + input_name + ")", max_threads);
+                deposit_bench.start();
+                sim.fill_density_buffer();
+                deposit_bench.finish();
+                deposit_bench.info = deposit_info;
+                deposit_benches.push_back(deposit_bench);
+            }
+        }
+    }
+
+    // finite difference against spectral gradient, both timed from the density to the filled gradient buffer
+    std::vector<BenchmarkData> force_benches;
+    for (force_method method : {force_method::finite_difference, force_method::spectral}){
+        Simulation sim(1.5, 0.01, particles, 100.0, num_cells, 1.02, mass_assignment::CIC);
+        sim.set_force_method(method);
+        sim.fill_density_buffer();
+        std::string method_name = method == force_method::finite_difference ? "Finite Difference" : "Spectral";
+        BenchmarkData force_bench(method_name + " Potential and Gradient Calc", max_threads);
+        force_bench.start();
+        sim.fill_potential_buffer();
+        if (method == force_method::finite_difference){
+            sim.calculate_gradient(sim.get_potential_buffer());
+        }
+        force_bench.finish();
+        force_bench.info = info + (method == force_method::finite_difference ? " One inverse transform." : " Three inverse transforms.");
+        force_benches.push_back(force_bench);
+    }
+
+    // deposit and force interpolation of particles in random order against particles sorted along the Morton curve, for a uniform and a clustered late time state
+    std::vector<BenchmarkData> sort_benches;
+    for (auto & [input_name, input_particles] : deposit_inputs){
+        Simulation sim(1.5, 0.01, input_particles, 100.0, num_cells, 1.02, mass_assignment::CIC);
+        for (bool sorted : {false, true}){
+            if (sorted){
+                BenchmarkData sort_bench(input_name + " Morton Sort", max_threads);
+                sort_bench.start();
+                sim.sort_particles();
+                sort_bench.finish();
+                sort_bench.info = deposit_info;
+                sort_benches.push_back(sort_bench);
+            }
+            std::string order = sorted ? " Sorted" : " Unsorted";
+            std::string locality = " Density cache line switches per particle: " + std::to_string(CacheLineSwitches(sim.get_particle_collection(), num_cells)) + ".";
+            BenchmarkData density_bench(input_name + order + " CIC Density Calculation", max_threads);
+            density_bench.start();
+            sim.fill_density_buffer();
+            density_bench.finish();
+            density_bench.info = deposit_info + locality;
+            sort_benches.push_back(density_bench);
+
+            sim.fill_potential_buffer();
+            BenchmarkData update_bench(input_name + order + " CIC Particle Update and Gradient Calc", max_threads);
+            update_bench.start();
+            sim.update_particles();
+            update_bench.finish();
+            update_bench.info = deposit_info + locality;
+            sort_benches.push_back(update_bench);
+        }
+    }
+
+    // potential step with and without binning the power spectrum from its forward transform, against measuring it with a separate deposit and transform
+    std::vector<BenchmarkData> power_spectrum_benches;
+    {
+        Simulation sim(1.5, 0.01, particles, 100.0, num_cells, 1.02, mass_assignment::CIC);
+        sim.fill_density_buffer();
+        BenchmarkData potential_bench("Potential Calc without Power Spectrum", max_threads);
+        potential_bench.start();
+        sim.fill_potential_buffer();
+        potential_bench.finish();
+        potential_bench.info = info;
+        power_spectrum_benches.push_back(potential_bench);
+
+        sim.fill_density_buffer();
+        sim.request_power_spectrum();
+        BenchmarkData binned_bench("Potential Calc with Binned Power Spectrum", max_threads);
+        binned_bench.start();
+        sim.fill_potential_buffer();
+        binned_bench.finish();
+        binned_bench.info = info + " Reuses the forward transform of the step.";
+        power_spectrum_benches.push_back(binned_bench);
+
+        BenchmarkData standalone_bench("Standalone Power Spectrum", max_threads);
+        standalone_bench.start();
+        powerSpectrum(sim.get_particle_collection(), num_cells, 100.0, mass_assignment::CIC);
+        standalone_bench.finish();
+        standalone_bench.info = info + " Own deposit and forward transform.";
+        power_spectrum_benches.push_back(standalone_bench);
+    }
+
+    // projection of the density along each axis and the colour map of the image, serial against every thread
+    std::vector<BenchmarkData> projection_benches;
+    {
+        Simulation sim(1.5, 0.01, particles, 100.0, num_cells, 1.02);
+        sim.fill_density_buffer();
+        std::vector<double> projection(num_cells * num_cells);
+        std::string image_file = (std::filesystem::temp_directory_path() / "pm_simulation_benchmark_image.ppm").string();
+        for (int threads : {1, static_cast<int>(max_threads)}){
+            omp_set_num_threads(threads);
+            for (uint axis = 0; axis < 3; axis++){
+                BenchmarkData projection_bench("Density Projection along axis " + std::to_string(axis), threads);
+                projection_bench.start();
+                ProjectDensity(sim.get_density_buffer(), num_cells, projection.data(), axis);
+                projection_bench.finish();
+                projection_bench.info = info;
+                projection_benches.push_back(projection_bench);
+            }
+            BenchmarkData image_bench("Image Colour Map and P6 Write", threads);
+            image_bench.start();
+            SaveProjectionToFile(projection.data(), num_cells, image_file);
+            image_bench.finish();
+            image_bench.info = info;
+            projection_benches.push_back(image_bench);
+        }
+        std::filesystem::remove(image_file);
+        omp_set_num_threads(max_threads);
+    }
+
+    // steps and accuracy of fixed step Euler runs and adaptive leapfrog runs on a small grid, against a leapfrog reference with very short steps.
+    // The error is the RMS periodic distance of the final positions from the reference, in box widths
+    std::vector<BenchmarkData> integrator_benches;
+    {
+        uint small_cells = 16;
+        uint small_particles = small_cells * small_cells * small_cells * 4;
+        particle_group small_particle_group(10.0 * 10.0 * 10.0 * 10.0 * 10.0/small_particles, small_particles, 42);
+        double t_max = 1.5;
+        double unit_step = 0.01; // the expansion factor is per unit_step of time
+        double unit_expansion = 1.02;
+        auto run_with = [&](integrator method, double time_step, double courant_factor, double max_time_step, BenchmarkData &bench){
+            // an Euler step expands by the expansion factor, so it is rescaled to expand by the same amount per unit of time
+            Simulation sim(t_max, method == integrator::euler ? time_step : unit_step, small_particle_group, 100.0, small_cells, 
+                           method == integrator::euler ? std::pow(unit_expansion, time_step / unit_step) : unit_expansion, mass_assignment::CIC);
+            sim.set_output_schedule(OutputSchedule());
+            sim.set_integrator(method, courant_factor, max_time_step);
+            bench.start();
+            sim.run();
+            bench.finish();
+            bench.info = "The number of cells per length of the box is " + std::to_string(small_cells) + " and the number of particles is " 
+                         + std::to_string(small_particles) + ". " + std::to_string(sim.get_step()) + " steps.";
+            return sim.get_physical_particle_collection();
+        };
+        auto rms_error = [](const particle_group &a, const particle_group &b){
+            double sum = 0;
+            for (uint dim = 0; dim < 3; dim++){
+                for (size_t index = 0; index < a.get_num_particles(); index++){
+                    double difference = a.position[dim][index] - b.position[dim][index];
+                    difference -= std::round(difference);
+                    sum += difference * difference;
+                }
+            }
+            return std::sqrt(sum / a.get_num_particles());
+        };
+        BenchmarkData reference_bench("Leapfrog Reference Run", max_threads);
+        particle_group reference = run_with(integrator::leapfrog_kdk, unit_step, 0.01, 0, reference_bench);
+        integrator_benches.push_back(reference_bench);
+        std::vector<std::tuple<std::string, integrator, double, double, double>> integrator_configs = {
+            {"Euler Run with dt 0.01", integrator::euler, 0.01, 1, 0}, {"Euler Run with dt 0.005", integrator::euler, 0.005, 1, 0},
+            {"Adaptive Leapfrog Run with Courant Factor 0.25", integrator::leapfrog_kdk, unit_step, 0.25, 0.1},
+            {"Adaptive Leapfrog Run with Courant Factor 0.1", integrator::leapfrog_kdk, unit_step, 0.1, 0.1}};
+        for (auto & [name, method, time_step, courant_factor, max_time_step] : integrator_configs){
+            BenchmarkData integrator_bench(name, max_threads);
+            double error = rms_error(run_with(method, time_step, courant_factor, max_time_step, integrator_bench), reference);
+            integrator_bench.info += " RMS position error " + std::to_string(error) + " box widths.";
+            integrator_benches.push_back(integrator_bench);
+        }
+    }
+
+    // double, single and mixed precision runs of 10 steps, with the RMS position error of the float runs against the double run
+    std::vector<BenchmarkData> precision_benches;
+    {
+        std::optional<particle_group> double_result;
+        auto run_in = [&](auto simulation_type, const std::string &name){
+            using SimulationType = std::remove_pointer_t<decltype(simulation_type)>;
+            SimulationType sim(0.1, 0.01, basic_particle_group<typename SimulationType::real_type>(particles), 100.0, num_cells, 1.02, mass_assignment::CIC);
+            sim.set_output_schedule(OutputSchedule());
+            BenchmarkData precision_bench(name, max_threads);
+            precision_bench.start();
+            sim.run();
+            precision_bench.finish();
+            precision_bench.info = info + " 10 steps.";
+            particle_group result(sim.get_particle_collection());
+            if (precision_benches.empty()){
+                double_result = std::move(result);
+            }
+            else{
+                double sum = 0;
+                for (uint dim = 0; dim < 3; dim++){
+                    for (size_t index = 0; index < result.get_num_particles(); index++){
+                        double difference = result.position[dim][index] - double_result->position[dim][index];
+                        difference -= std::round(difference);
+                        sum += difference * difference;
+                    }
+                }
+                precision_bench.info += " RMS position error against double " + std::to_string(std::sqrt(sum / result.get_num_particles())) + " box widths.";
+            }
+            precision_benches.push_back(precision_bench);
+        };
+        run_in(static_cast<Simulation *>(nullptr), "Double Precision Run");
+        run_in(static_cast<SimulationFloat *>(nullptr), "Single Precision Run");
+        run_in(static_cast<SimulationMixed *>(nullptr), "Mixed Precision Run");
+    }
+
+    // output overhead of a short run writing an image and raw snapshots every 10 steps, written in the step loop or on the background writer thread
+    std::vector<BenchmarkData> output_benches;
+    std::string output_folder = (std::filesystem::temp_directory_path() / "pm_simulation_benchmark_output").string();
+    std::vector<std::tuple<std::string, std::optional<std::string>, size_t>> output_configs = {{"Run without Output", std::nullopt, 0},
+        {"Run with Synchronous Output", output_folder, 0}, {"Run with Asynchronous Output", output_folder, 2}};
+    for (auto & [name, folder, queue_length] : output_configs){
+        Simulation sim(0.2, 0.01, particles, 100.0, num_cells, 1.02);
+        sim.set_output_queue_length(queue_length);
+        OutputSchedule schedule;
+        schedule.every_steps(10, {output_type::projection, output_type::density, output_type::particles});
+        sim.set_output_schedule(schedule);
+        BenchmarkData output_bench(name, max_threads);
+        output_bench.start();
+        sim.run(folder);
+        output_bench.finish();
+        output_bench.info = info + " 20 steps with 2 images and density and particle snapshots.";
+        output_benches.push_back(output_bench);
+        std::filesystem::remove_all(output_folder);
+    }
+    double output_cost = output_benches[1].time - output_benches[0].time;
+    double hidden_cost = output_benches[1].time - output_benches[2].time;
+    output_benches[2].info += " Hidden output overhead: " + std::to_string(output_cost > 0 ? 100 * hidden_cost / output_cost : 0) + "%.";
+
+    for (uint i = 0; i < startup_benches.size(); i++){
+        std::cout << startup_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < init_benches.size(); i++){
+        std::cout << init_benches[i] << std::endl;
+    }
     for (uint i = 0; i < density_benches.size(); i++){
         std::cout << density_benches[i] << std::endl;
     }
@@ -119,5 +505,35 @@ int main()
     for (uint i = 0; i < expansion_benches.size(); i++){
         std::cout << expansion_benches[i] << std::endl;
     }
+    for (uint i = 0; i < scheme_benches.size(); i++){
+        std::cout << scheme_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < fused_benches.size(); i++){
+        std::cout << fused_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < deposit_benches.size(); i++){
+        std::cout << deposit_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < force_benches.size(); i++){
+        std::cout << force_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < sort_benches.size(); i++){
+        std::cout << sort_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < power_spectrum_benches.size(); i++){
+        std::cout << power_spectrum_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < projection_benches.size(); i++){
+        std::cout << projection_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < integrator_benches.size(); i++){
+        std::cout << integrator_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < precision_benches.size(); i++){
+        std::cout << precision_benches[i] << std::endl;
+    }
+    for (uint i = 0; i < output_benches.size(); i++){
+        std::cout << output_benches[i] << std::endl;
+    }
     return 0;
 }
\ No newline at end of file
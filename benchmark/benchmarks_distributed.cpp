@@ -0,0 +1,75 @@
+#include <mpi.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <functional>
+#include <omp.h>
+#include "DistributedSimulation.hpp"
+
+/**
+ * @brief: Times one collective stage on every process and keeps the slowest, which is what a step of the distributed simulation waits for.
+*/
+double MaxTime(const std::function<void()> &stage)
+{
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    stage();
+    double local_time = MPI_Wtime() - start;
+    double max_time;
+    MPI_Allreduce(&local_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return max_time;
+}
+
+/**
+ * @brief: Benchmarks every stage of a step on a num_cells^3 grid with average_particles_per_cell particles per cell, split over all processes.
+*/
+void BenchmarkStep(const std::string &name, uint num_cells, uint average_particles_per_cell, int process_id, int num_proc)
+{
+    size_t num_particles = static_cast<size_t>(num_cells) * num_cells * num_cells * average_particles_per_cell;
+    double mass = 10.0 * 10.0 * 10.0 * 10.0 * 10.0/num_particles;
+    size_t share = num_particles / num_proc;
+    size_t remainder = num_particles % num_proc;
+    size_t local_particles = share + (static_cast<size_t>(process_id) < remainder ? 1 : 0);
+    size_t first_particle = process_id * share + std::min<size_t>(process_id, remainder);
+
+    DistributedSimulation sim(1.5, 0.01, particle_group(mass, local_particles, 42, first_particle), 100.0, num_cells, 1.02);
+    std::vector<std::pair<std::string, double>> timings;
+    timings.emplace_back("Density Calculation", MaxTime([&](){ sim.fill_density_buffer(); }));
+    timings.emplace_back("Potential Calculation", MaxTime([&](){ sim.fill_potential_buffer(); }));
+    timings.emplace_back("Particle Update, Gradient Calc and Exchange", MaxTime([&](){ sim.update_particles(); }));
+    timings.emplace_back("Expansion Calculation", MaxTime([&](){ sim.box_expansion(); }));
+
+    if (process_id == 0){
+        for (auto & [stage, time] : timings){
+            std::cout << "Benchmarking " << name << " " << stage << " with " << num_proc << " processes and " << omp_get_max_threads() << " threads each." << std::endl;
+            std::cout << "Time = " << time << std::endl;
+            std::cout << "Info: The number of cells per length of the box is " << num_cells << " and the number of particles is " << num_particles << "." << std::endl;
+            std::cout << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief: Strong and weak scaling of the distributed simulation. Run with increasing process counts (e.g. mpirun -np 1, 2, 4, 8) and compare the times:
+ * strong scaling keeps the grid fixed, weak scaling grows the grid with the number of processes so every process keeps about 64^3 cells.
+*/
+int main(int argc, char** argv)
+{
+    MPI_Init(&argc, &argv);
+    int process_id;
+    int num_proc;
+    MPI_Comm_rank(MPI_COMM_WORLD, &process_id);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_proc);
+
+    uint average_particles_per_cell = 10;
+    uint strong_num_cells = 128;
+    uint weak_num_cells = std::round(64 * std::cbrt(num_proc));
+    weak_num_cells = std::max<uint>(weak_num_cells, 2 * num_proc);
+
+    BenchmarkStep("Strong Scaling", strong_num_cells, average_particles_per_cell, process_id, num_proc);
+    BenchmarkStep("Weak Scaling", weak_num_cells, average_particles_per_cell, process_id, num_proc);
+
+    MPI_Finalize();
+    return 0;
+}
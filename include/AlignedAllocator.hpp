@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * @brief: Minimal STL allocator that returns memory aligned to a fixed boundary (a cache line by default).
+ * Used for particle arrays so that vectorised loops start on an aligned address.
+*/
+template <typename T, std::size_t Alignment = 64>
+class aligned_allocator
+{
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = aligned_allocator<U, Alignment>;
+    };
+
+    aligned_allocator() noexcept = default;
+
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Alignment> &) noexcept {}
+
+    T * allocate(std::size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T * p, std::size_t) noexcept
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+};
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator==(const aligned_allocator<T, Alignment> &, const aligned_allocator<U, Alignment> &) { return true; }
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator!=(const aligned_allocator<T, Alignment> &, const aligned_allocator<U, Alignment> &) { return false; }
+
+template <typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T>>;
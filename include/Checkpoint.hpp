@@ -0,0 +1,49 @@
+#pragma once
+#include "Simulation.hpp"
+#include "particle.hpp"
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief: Complete state of a Simulation between two steps. Restoring it and continuing gives the same particles, bit for bit, as a run that was never interrupted.
+ * The modes that change the arithmetic (scheme, deposit, force method, Green's function kernel, velocity frame, particle sorting, integrator and precision) are part of the state, and so is the particle order.
+ * Velocities are stored as the simulation holds them, i.e. multiplied by velocity_scale in the comoving frame.
+*/
+struct SimulationCheckpoint
+{
+    double time;
+    uint64_t step;
+    double time_max;
+    double time_step;
+    double box_width;
+    double expansion_factor;
+    uint num_cells;
+    mass_assignment scheme;
+    deposit_method density_deposit;
+    force_method gradient_method;
+    green_kernel kernel;
+    double smoothing_cells;
+    velocity_frame frame;
+    double velocity_scale;
+    uint sort_interval;
+    integrator time_integrator;
+    double courant_factor;
+    double max_time_step; // 0 uses time_step
+    precision real_precision; // of the simulation that wrote it, the particles are stored in double whatever it is
+    particle_group particles;
+    std::vector<uint64_t> particle_ids; // empty if the particles were never sorted
+};
+
+/**
+ * @brief: Writes a checkpoint in the binary format below. The file is written under a temporary name and renamed so an interrupted write never replaces the previous checkpoint.
+ * Format (native byte order): 8 byte magic "PMSIMCKP", uint32 version, uint32 num_cells, uint32 scheme, deposit, force method, kernel, velocity frame, sort interval,
+ * integrator and precision, uint64 step and number of particles, doubles time, time_max, time_step, box_width, expansion_factor, smoothing_cells, velocity_scale, courant_factor,
+ * max_time_step and particle mass, then the x, y and z position arrays, the x, y and z velocity arrays, uint64 number of particle ids and the ids.
+ * Throws std::runtime_error if the file cannot be written.
+*/
+void save_checkpoint(const SimulationCheckpoint &checkpoint, const std::string &filename);
+
+/**
+ * @brief: Reads a checkpoint written by save_checkpoint. Throws std::runtime_error if the file is missing, truncated, or has the wrong magic or version.
+*/
+SimulationCheckpoint load_checkpoint(const std::string &filename);
@@ -0,0 +1,147 @@
+#pragma once
+#include "particle.hpp"
+#include "MassAssignment.hpp"
+#include <fftw3.h>
+#include <mpi.h>
+#include <vector>
+#include <optional>
+#include <string>
+#include <cstdint>
+
+/**
+ * @brief: Distributed memory version of Simulation for grids too large for one node. The grid is split into slabs of x planes, one per MPI process,
+ * and every process only holds its slab of the density, potential and gradient and the particles that lie in it.
+ * The 3D transforms are done as 2D transforms of the local planes, a global transpose (MPI_Alltoallv) to slabs of y rows, and 1D transforms along x,
+ * so only serial and multithreaded FFTW is needed. Particles that move to another slab are sent to its process after every step.
+ * Forces use the plain Green's function and the finite difference gradient, so results match Simulation up to rounding. The deposit and the kick and drift
+ * use the same plane binned, atomic free deposit and vectorised, branch free kernel as Simulation.
+*/
+class DistributedSimulation
+{
+public:
+    /**
+     * @brief: Constructor for DistributedSimulation class. Collective over the communicator. Allocates the local slabs and plans the local transforms using omp_get_max_threads() threads.
+     * Particles can be given to any process, they are sent to the process owning their slab before returning.
+     * @param t_max: Time at which the simulation terminates.
+     * @param t_step: Timestep which separates each moment that the simulation evaluates particle positions for.
+     * @param local_particles: This process's share of the particles. All processes must use the same particle mass.
+     * @param W: Width of the box.
+     * @param num_cells: Number of cells per length of the cubic box. Every process needs at least 2 planes, so num_cells >= 2 * number of processes.
+     * @param e_factor: Expansion factor - Factor by which the simulation is scaled by every iteration.
+     * @param scheme: Mass assignment scheme used for the density and force interpolation.
+     * @param communicator: Processes that share the simulation. Defaults to MPI_COMM_WORLD.
+    */
+    DistributedSimulation(double t_max, double t_step, particle_group local_particles, double W, uint num_cells, double e_factor,
+                          mass_assignment scheme = mass_assignment::NGP, MPI_Comm communicator = MPI_COMM_WORLD);
+
+    /**
+     * @brief: Destructor destroys the FFTW plans and deallocates the slabs.
+    */
+    ~DistributedSimulation();
+
+    DistributedSimulation(const DistributedSimulation &) = delete;
+    DistributedSimulation & operator=(const DistributedSimulation &) = delete;
+
+    /**
+     * @brief: Run the simulation from t=0 to t_max in slices separated by dt. Collective over the communicator.
+     * @param output_folder: Optional folder that images of the density are written to every 10 steps by the first process, with the same names as Simulation::run.
+    */
+    void run(std::optional<std::string> output_folder = std::nullopt);
+
+    /**
+     * @brief: Deposits the local particles onto the local slab and adds the contributions that spilled over the slab edges to the neighbouring processes.
+    */
+    void fill_density_buffer();
+
+    /**
+     * @brief: Evaluates the potential of the local slab with the distributed transform and fetches the neighbouring planes needed by the gradient.
+    */
+    void fill_potential_buffer();
+
+    /**
+     * @brief: Evaluates the gradient of the local slab, updates the velocities and positions of the local particles and sends particles that left the slab to their new process.
+    */
+    void update_particles();
+
+    /**
+     * @brief: Applies expansion factor to width of box and velocity of every local particle.
+    */
+    void box_expansion();
+
+    /**
+     * @brief: Does update_particles followed by box_expansion with a single pass over the local particles, as run does every step. Bit-identical to calling the two in turn.
+    */
+    void update_particles_and_expand();
+
+    /**
+     * @brief: Collects the density of every slab on the root process (collective).
+     * @returns: The num_cells^3 density on the root process and an empty vector on the others.
+    */
+    std::vector<double> gather_density(int root = 0) const;
+
+    /**
+     * @brief: Local density slab of get_local_num_planes() planes, starting at global plane get_local_first_plane().
+    */
+    const double * get_density_slab() const;
+
+    /**
+     * @brief: Local potential slab of get_local_num_planes() planes, starting at global plane get_local_first_plane().
+    */
+    const double * get_potential_slab() const;
+
+    const particle_group & get_local_particles() const;
+    uint get_local_first_plane() const;
+    uint get_local_num_planes() const;
+    int get_rank() const;
+    int get_num_processes() const;
+
+    private:
+    template <mass_assignment Scheme>
+    void deposit_particles();
+    template <mass_assignment Scheme, bool Expand>
+    void kick_drift_particles();
+    void calculate_gradient();
+    void exchange_particles();
+    void forward_transform();
+    void backward_transform();
+
+    /**
+     * @brief: Index in the padded gradient or density slab (one ghost plane each side) of a global plane within one plane of the local slab.
+    */
+    uint padded_plane(uint global_plane) const;
+
+    double time_max;
+    double time_step;
+    particle_group particle_collection;
+    double box_width;
+    uint number_of_cells;
+    double expansion_factor;
+    mass_assignment assignment_scheme;
+
+    MPI_Comm comm;
+    int rank;
+    int num_processes;
+    std::vector<uint> first_plane; // first x plane (and first y row after the transpose) of each process
+    std::vector<uint> num_planes; // number of x planes (and y rows after the transpose) of each process
+    std::vector<int> plane_owner; // process owning each x plane
+    uint local_first_plane;
+    uint local_num_planes;
+    size_t plane_size; // num_cells^2 real values
+    size_t half_plane_size; // num_cells * (num_cells/2 + 1) complex values
+
+    double * density_buffer; // local planes with one ghost plane either side for deposits that spill over the slab edges
+    double * potential_buffer; // local planes with two ghost planes either side for the finite difference of the ghost gradient planes
+    double * gradient_buffer; // x, y and z components of local planes with one ghost plane either side, each gradient_stride apart
+    size_t gradient_stride;
+    fftw_complex * plane_spectra; // 2D transforms of the local x planes, num_planes x num_cells x (num_cells/2 + 1)
+    fftw_complex * column_spectra; // after the transpose, local y rows x (num_cells/2 + 1) x num_cells with x contiguous
+    std::vector<double> green_table; // Green's function of the local modes in the column_spectra layout
+    std::vector<double> transpose_buffer; // packed blocks for the all to all exchanges
+    std::vector<double> receive_buffer;
+    PlaneBins plane_bins; // local particles binned by x plane for the deposit, reused every step
+
+    fftw_plan plane_forward_plan;
+    fftw_plan plane_backward_plan;
+    fftw_plan column_forward_plan;
+    fftw_plan column_backward_plan;
+};
@@ -0,0 +1,141 @@
+#pragma once
+#include <fftw3.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+
+/**
+ * @brief: Types and functions of the FFTW library for a real type, fftw_* for double and fftwf_* for float.
+*/
+template <typename Real>
+struct fftw_traits;
+
+template <>
+struct fftw_traits<double>
+{
+    using complex = fftw_complex;
+    using plan = fftw_plan;
+    static constexpr const char * prefix = "fftw";
+    static void * malloc(size_t bytes) { return fftw_malloc(bytes); }
+    static void free(void * buffer) { fftw_free(buffer); }
+    static void init_threads() { fftw_init_threads(); }
+    static void plan_with_nthreads(int num_threads) { fftw_plan_with_nthreads(num_threads); }
+    static plan plan_r2c(int n, double * in, complex * out, unsigned flags) { return fftw_plan_dft_r2c_3d(n, n, n, in, out, flags); }
+    static plan plan_c2r(int n, complex * in, double * out, unsigned flags) { return fftw_plan_dft_c2r_3d(n, n, n, in, out, flags); }
+    static void execute_r2c(const plan p, double * in, complex * out) { fftw_execute_dft_r2c(p, in, out); }
+    static void execute_c2r(const plan p, complex * in, double * out) { fftw_execute_dft_c2r(p, in, out); }
+    static void destroy_plan(plan p) { fftw_destroy_plan(p); }
+    static int import_wisdom(const char * filename) { return fftw_import_wisdom_from_filename(filename); }
+    static int export_wisdom(const char * filename) { return fftw_export_wisdom_to_filename(filename); }
+};
+
+template <>
+struct fftw_traits<float>
+{
+    using complex = fftwf_complex;
+    using plan = fftwf_plan;
+    static constexpr const char * prefix = "fftwf";
+    static void * malloc(size_t bytes) { return fftwf_malloc(bytes); }
+    static void free(void * buffer) { fftwf_free(buffer); }
+    static void init_threads() { fftwf_init_threads(); }
+    static void plan_with_nthreads(int num_threads) { fftwf_plan_with_nthreads(num_threads); }
+    static plan plan_r2c(int n, float * in, complex * out, unsigned flags) { return fftwf_plan_dft_r2c_3d(n, n, n, in, out, flags); }
+    static plan plan_c2r(int n, complex * in, float * out, unsigned flags) { return fftwf_plan_dft_c2r_3d(n, n, n, in, out, flags); }
+    static void execute_r2c(const plan p, float * in, complex * out) { fftwf_execute_dft_r2c(p, in, out); }
+    static void execute_c2r(const plan p, complex * in, float * out) { fftwf_execute_dft_c2r(p, in, out); }
+    static void destroy_plan(plan p) { fftwf_destroy_plan(p); }
+    static int import_wisdom(const char * filename) { return fftwf_import_wisdom_from_filename(filename); }
+    static int export_wisdom(const char * filename) { return fftwf_export_wisdom_to_filename(filename); }
+};
+
+/**
+ * @brief: Class that owns the forward (real-to-complex) and backward (complex-to-real) FFTW plans for a cubic grid.
+ * Plans are created with the multithreaded FFTW planner and are executed through the new-array interface so that one set of plans can be shared by every Simulation with the same grid size and thread count.
+ * Real selects double (FFTPlans, fftw_* plans) or single (FFTPlansFloat, fftwf_* plans) precision transforms.
+*/
+template <typename Real>
+class BasicFFTPlans
+{
+public:
+    using complex = typename fftw_traits<Real>::complex;
+
+    /**
+     * @brief: Constructor for FFTPlans class. Plans the transforms on temporary aligned buffers using FFTW_MEASURE.
+     * If a wisdom folder is given, wisdom for this grid size and thread count is imported before planning (making FFTW_MEASURE almost free when it exists) and exported afterwards.
+     * @param num_cells: Number of cells per length of the cubic grid.
+     * @param num_threads: Number of threads FFTW uses to execute the plans.
+     * @param wisdom_folder: Optional folder that holds FFTW wisdom files. Created if it does not exist.
+    */
+    BasicFFTPlans(uint num_cells, int num_threads, std::optional<std::string> wisdom_folder = std::nullopt);
+
+    /**
+     * @brief: Destructor destroys the FFTW plans, holding the planner lock.
+    */
+    ~BasicFFTPlans();
+
+    BasicFFTPlans(const BasicFFTPlans &) = delete;
+    BasicFFTPlans & operator=(const BasicFFTPlans &) = delete;
+
+    /**
+     * @brief: Returns the plans for the grid size and thread count, planning them on first use and reusing them afterwards.
+     * The FFTW planner is not thread safe so access to the cache is serialised.
+     * @param num_cells: Number of cells per length of the cubic grid.
+     * @param num_threads: Number of threads FFTW uses to execute the plans.
+     * @param wisdom_folder: Optional folder of FFTW wisdom files used if the plans have to be created.
+    */
+    static std::shared_ptr<const BasicFFTPlans> get_plans(uint num_cells, int num_threads, std::optional<std::string> wisdom_folder = std::nullopt);
+
+    /**
+     * @brief: Path of the wisdom file for a grid size and thread count. Wisdom is keyed on both as FFTW plans differ between them.
+     * @returns: <wisdom_folder>/fftw_wisdom_num_cells_<num_cells>_threads_<num_threads>.wisdom, with fftwf_ for single precision as its wisdom is separate
+    */
+    static std::string wisdom_filename(const std::string & wisdom_folder, uint num_cells, int num_threads);
+
+    /**
+     * @brief: Initialises the multithreaded FFTW planner of this precision once per process. Called before any plan is made with fftw_plan_with_nthreads.
+    */
+    static void initialise_threads();
+
+    /**
+     * @brief: Locks the FFTW planner. FFTW planning, fftw_plan_with_nthreads and plan destruction are not thread safe (and the thread count is process-global),
+     * so code that plans its own transforms must hold the lock around them, as FFTPlans does. The lock is shared by both precisions.
+    */
+    static std::unique_lock<std::mutex> lock_planner();
+
+    /**
+     * @brief: Removes every plan from the cache. Plans still held by a Simulation are destroyed once it is.
+    */
+    static void clear_cache();
+
+    /**
+     * @brief: Real-to-complex transform of a num_cells^3 real buffer into a num_cells * num_cells * (num_cells/2 + 1) half spectrum.
+     * Both buffers must be allocated with fftw_malloc (fftwf_malloc for float).
+    */
+    void forward(Real * real_buffer, complex * k_space_buffer) const;
+
+    /**
+     * @brief: Complex-to-real transform of a half spectrum into a num_cells^3 real buffer. Overwrites the k space buffer.
+     * Both buffers must be allocated with fftw_malloc (fftwf_malloc for float).
+    */
+    void backward(complex * k_space_buffer, Real * real_buffer) const;
+
+    uint get_num_cells() const;
+    int get_num_threads() const;
+
+    /**
+     * @brief: Returns true if existing wisdom was imported from file when these plans were created.
+    */
+    bool get_wisdom_imported() const;
+
+    private:
+    uint number_of_cells;
+    int number_of_threads;
+    bool wisdom_imported = false;
+    typename fftw_traits<Real>::plan forward_plan;
+    typename fftw_traits<Real>::plan backward_plan;
+};
+
+using FFTPlans = BasicFFTPlans<double>;
+using FFTPlansFloat = BasicFFTPlans<float>;
@@ -0,0 +1,66 @@
+#pragma once
+#include <memory>
+#include <sys/types.h>
+#include "AlignedAllocator.hpp"
+#include "MassAssignment.hpp"
+
+/**
+ * @brief: Kernel the Green's function is multiplied by.
+ * plain: the -4pi/(i^2 + j^2 + k^2) factor of the solver, with i, j, k the transform indices of the mode in [0, num_cells), averaged with the factor of the mirrored mode, and the 1/(8 num_cells^3) normalisation.
+ * deconvolved: divided by the square of the mass assignment window (once for the deposit, once for the force interpolation) to undo the smoothing of the scheme.
+ * gaussian: multiplied by exp(-k^2 s^2) to suppress forces on scales below s cells.
+*/
+enum class green_kernel { plain, deconvolved, gaussian };
+
+/**
+ * @brief: Class that holds the Green's function of the potential for every mode of the real-to-complex half spectrum of a cubic grid.
+ * Entries are built once per mode, addressed by its wrapped (signed) frequencies, and exclude the box width, so the table stays valid as the box expands and
+ * the potential spectrum is the density spectrum times box_width^2 times the table.
+*/
+class GreenFunction
+{
+public:
+    /**
+     * @brief: Constructor for GreenFunction class. Fills the num_cells * num_cells * (num_cells/2 + 1) table.
+     * @param num_cells: Number of cells per length of the cubic grid.
+     * @param kernel: Kernel applied on top of the plain factor.
+     * @param scheme: Mass assignment scheme whose window is removed by the deconvolved kernel. Ignored by the other kernels.
+     * @param smoothing_cells: Width of the gaussian kernel in cells. Ignored by the other kernels.
+    */
+    GreenFunction(uint num_cells, green_kernel kernel = green_kernel::plain, mass_assignment scheme = mass_assignment::NGP, double smoothing_cells = 0);
+
+    GreenFunction(const GreenFunction &) = delete;
+    GreenFunction & operator=(const GreenFunction &) = delete;
+
+    /**
+     * @brief: Returns the table for the grid size and kernel, building it on first use and reusing it afterwards.
+     * Arguments that the kernel ignores are not part of the key.
+    */
+    static std::shared_ptr<const GreenFunction> get_table(uint num_cells, green_kernel kernel = green_kernel::plain, mass_assignment scheme = mass_assignment::NGP, double smoothing_cells = 0);
+
+    /**
+     * @brief: Green's function of a single mode given by its signed frequencies, as stored in the table. Used to build tables for part of the spectrum.
+    */
+    static double mode_value(int frequency_i, int frequency_j, int frequency_k, uint num_cells, green_kernel kernel = green_kernel::plain, 
+                             mass_assignment scheme = mass_assignment::NGP, double smoothing_cells = 0);
+
+    /**
+     * @brief: Removes every table from the cache. Tables still held by a Simulation are destroyed once it is.
+    */
+    static void clear_cache();
+
+    /**
+     * @brief: Pointer to the table, laid out like the half spectrum. The zero mode entry is 0.
+    */
+    const double * data() const;
+
+    uint get_num_cells() const;
+    green_kernel get_kernel() const;
+    double get_smoothing_cells() const;
+
+    private:
+    uint number_of_cells;
+    green_kernel kernel_type;
+    double smoothing;
+    aligned_vector<double> table;
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * @brief: Scheme used to share the mass of a particle between the cells of the mesh. The same scheme is used to interpolate the force back onto the particle so that particles do not exert a force on themselves.
+ * NGP (nearest grid point) assigns all mass to the cell containing the particle, CIC (cloud in cell) shares it linearly between the 2 nearest cells in each dimension
+ * and TSC (triangular shaped cloud) shares it quadratically between the 3 nearest cells in each dimension.
+*/
+enum class mass_assignment { NGP, CIC, TSC };
+
+/**
+ * @brief: Number of cells per dimension that a particle contributes to for the given scheme.
+*/
+template <mass_assignment Scheme>
+constexpr uint stencil_width()
+{
+    return Scheme == mass_assignment::NGP ? 1 : (Scheme == mass_assignment::CIC ? 2 : 3);
+}
+
+/**
+ * @brief: Fourier transform of the assignment window of a scheme along one dimension, sinc(pi f / num_cells) to the power of its stencil width.
+ * Used to deconvolve the window from the Green's function and from measured power spectra.
+ * @param frequency: Signed frequency of the mode, in units of the fundamental frequency.
+*/
+inline double assignment_window(int frequency, uint num_cells, mass_assignment scheme)
+{
+    if (frequency == 0){
+        return 1;
+    }
+    double x = M_PI * frequency / num_cells;
+    double sinc = std::sin(x) / x;
+    int order = scheme == mass_assignment::NGP ? 1 : (scheme == mass_assignment::CIC ? 2 : 3);
+    return std::pow(sinc, order);
+}
+
+/**
+ * @brief: Evaluates the cells and weights of a particle along one dimension. Cell centres are at (i + 0.5)/num_cells and cell indices wrap periodically.
+ * @param scaled_position: Particle coordinate multiplied by the number of cells, in the range [0, num_cells).
+ * @param num_cells: Number of cells per length of the box.
+ * @param cells: Output indices of the cells the particle contributes to.
+ * @param weights: Output weights of each cell, summing to 1.
+ * Real is the type of the position and weights, so single precision particles get single precision kernels.
+*/
+template <mass_assignment Scheme, typename Real>
+inline void assignment_weights(Real scaled_position, uint num_cells, uint (&cells)[stencil_width<Scheme>()], Real (&weights)[stencil_width<Scheme>()])
+{
+    if constexpr (Scheme == mass_assignment::NGP){
+        uint cell = std::floor(scaled_position);
+        cells[0] = cell < num_cells ? cell : num_cells - 1; // guards against x * num_cells rounding up to num_cells
+        weights[0] = 1;
+    }
+    else if constexpr (Scheme == mass_assignment::CIC){
+        Real shifted = scaled_position - Real(0.5); // distance measured from the centre of the cell below
+        int low = std::floor(shifted);
+        Real d = shifted - low;
+        cells[0] = low < 0 ? low + num_cells : low;
+        cells[1] = low + 1 >= static_cast<int>(num_cells) ? low + 1 - num_cells : low + 1;
+        weights[0] = 1 - d;
+        weights[1] = d;
+    }
+    else{
+        int centre = std::floor(scaled_position);
+        centre = centre < static_cast<int>(num_cells) ? centre : num_cells - 1;
+        Real d = scaled_position - centre - Real(0.5); // offset from the centre of the nearest cell in [-0.5, 0.5)
+        cells[0] = centre == 0 ? num_cells - 1 : centre - 1;
+        cells[1] = centre;
+        cells[2] = centre + 1 == static_cast<int>(num_cells) ? 0 : centre + 1;
+        weights[0] = Real(0.5) * (Real(0.5) - d) * (Real(0.5) - d);
+        weights[1] = Real(0.75) - d * d;
+        weights[2] = Real(0.5) * (Real(0.5) + d) * (Real(0.5) + d);
+    }
+}
+
+/**
+ * @brief: Particle indices counting sorted by the x plane they lie in, kept between deposits so binning allocates nothing after the first step.
+*/
+struct PlaneBins
+{
+    std::vector<uint> particles; // particle indices ordered by plane
+    std::vector<size_t> offsets; // start of each plane in particles, with the total number of particles last
+    std::vector<size_t> counts; // per thread plane counts used by the counting sort
+};
+
+/**
+ * @brief: Stable parallel counting sort of particle indices by the x plane of the cell they lie in. Particles of every plane keep their original order,
+ * so the result does not depend on the number of threads.
+ * @param x: x coordinates in the unit interval.
+ * @param num_cells: Number of cells per length of the grid.
+ * @param first_plane, num_planes: Planes that are binned, the particles must lie in them. A slab of a distributed grid or the whole grid.
+*/
+template <typename Real>
+void bin_particles_by_plane(const Real * x, size_t num_particles, uint num_cells, uint first_plane, uint num_planes, PlaneBins &bins);
+
+/**
+ * @brief: Calls deposit_plane(plane) for planes 0 to num_planes - 1 so that concurrent calls never write to the same cell.
+ * A particle in plane p only writes to planes p - 1 to p + 1 (just p for NGP), so planes that are a stride apart never share a cell and are deposited
+ * concurrently. Planes beyond the last multiple of the stride could wrap onto the first planes of a periodic grid so they are deposited afterwards.
+*/
+template <mass_assignment Scheme, typename Function>
+void for_each_plane_coloured(uint num_planes, Function &&deposit_plane)
+{
+    constexpr uint stride = Scheme == mass_assignment::NGP ? 1 : 3;
+    uint coloured_planes = (num_planes / stride) * stride;
+    for (uint colour = 0; colour < stride; colour++){
+        #pragma omp parallel for schedule(dynamic)
+        for (uint plane = colour; plane < coloured_planes; plane += stride){
+            deposit_plane(plane);
+        }
+    }
+    for (uint plane = coloured_planes; plane < num_planes; plane++){
+        deposit_plane(plane);
+    }
+}
+
+/**
+ * @brief: Converts a scheme name ("NGP", "CIC" or "TSC", any case) to a mass_assignment value. Throws std::invalid_argument for other names.
+*/
+mass_assignment mass_assignment_from_string(const std::string &name);
+
+/**
+ * @brief: Returns the upper case name of a mass assignment scheme.
+*/
+std::string mass_assignment_to_string(mass_assignment scheme);
@@ -0,0 +1,108 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+/**
+ * @brief: Kind of output written by Simulation::run.
+ * projection: image of the density integrated along z (see SaveToFile).
+ * density: binary snapshot of the full 3D density (see save_density_snapshot).
+ * particles: binary snapshot of every particle position and velocity (see save_particle_snapshot).
+ * power_spectrum: CSV of the binned power spectrum of the density (see binPowerSpectrum), measured from the transform of the step without an extra FFT.
+*/
+enum class output_type { projection, density, particles, power_spectrum };
+
+/**
+ * @brief: Converts an output name ("projection", "density", "particles" or "power_spectrum", any case) to an output_type. Throws std::invalid_argument for other names.
+*/
+output_type output_type_from_string(const std::string &name);
+
+/**
+ * @brief: Returns the lower case name of an output type.
+*/
+std::string output_type_to_string(output_type type);
+
+/**
+ * @brief: Decides after which steps Simulation::run writes output and which outputs it writes, so runs only pay for the output they need.
+ * Triggers fire every N steps, at the first step reaching each requested time or cumulative expansion (box width over its initial width), or after the last step.
+ * When several triggers fire on the same step their outputs are combined and each output is written once.
+*/
+class OutputSchedule
+{
+public:
+    /**
+     * @brief: Creates a schedule without triggers, which writes nothing.
+    */
+    OutputSchedule() = default;
+
+    /**
+     * @brief: Returns a schedule that writes a projection image every interval_steps steps, the default of Simulation::run.
+    */
+    static OutputSchedule projection_every(uint interval_steps);
+
+    /**
+     * @brief: Writes the outputs after every interval_steps steps (counted from the start of the run, including steps before a restart).
+    */
+    void every_steps(uint interval_steps, std::vector<output_type> outputs);
+
+    /**
+     * @brief: Writes the outputs once at each requested simulation time, after the first step that reaches it.
+    */
+    void at_times(std::vector<double> times, std::vector<output_type> outputs);
+
+    /**
+     * @brief: Writes the outputs once when the cumulative expansion of the box first reaches each requested value.
+    */
+    void at_expansions(std::vector<double> expansions, std::vector<output_type> outputs);
+
+    /**
+     * @brief: Writes the outputs after the last step of the run.
+    */
+    void at_end(std::vector<output_type> outputs);
+
+    /**
+     * @brief: Adds a trigger described by "<trigger>:<values>:<outputs>", where outputs is a comma separated list of output names:
+     * "every:<steps>:<outputs>", "times:<t1>,<t2>,...:<outputs>", "expansions:<a1>,<a2>,...:<outputs>" or "end:<outputs>".
+     * Throws std::invalid_argument for malformed descriptions.
+    */
+    void add_trigger(const std::string &description);
+
+    /**
+     * @brief: Skips requested times and expansions that were already reached before the run starts, e.g. when continuing from a checkpoint.
+    */
+    void start(double time, double expansion);
+
+    /**
+     * @brief: Returns the outputs due after a step, in output_type order without repeats. Time and expansion triggers are consumed when they fire.
+     * @param step: Number of steps taken so far.
+     * @param time: Simulation time after the step.
+     * @param expansion: Cumulative expansion of the box after the step.
+     * @param last_step: True if this is the last step of the run.
+    */
+    std::vector<output_type> due(uint64_t step, double time, double expansion, bool last_step);
+
+    /**
+     * @brief: Returns the earliest requested time later than time that has not fired yet, or a negative value if there is none.
+    */
+    double next_time(double time) const;
+
+    /**
+     * @brief: Returns true if no trigger can ever fire.
+    */
+    bool empty() const;
+
+    private:
+    enum class trigger_kind { every_steps, at_times, at_expansions, at_end };
+
+    struct Trigger
+    {
+        trigger_kind kind;
+        uint interval_steps;
+        std::vector<double> values; // sorted requested times or expansions
+        size_t next_value; // first value that has not fired
+        std::vector<output_type> outputs;
+    };
+
+    std::vector<Trigger> triggers;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief: Background writer that runs output tasks (images, snapshots, checkpoints) on its own thread so the simulation keeps stepping while they are written.
+ * Tasks must own copies of the data they write. The queue is bounded: submit blocks while max_pending tasks are waiting,
+ * which limits the memory held by copies when the disk is slower than the simulation.
+ * The first exception thrown by a task is rethrown by the next submit or flush and later tasks are dropped.
+*/
+class OutputWriter
+{
+public:
+    /**
+     * @brief: Starts the writer thread.
+     * @param max_pending: Maximum number of tasks waiting to be written. 0 runs every task synchronously in submit without starting a thread.
+    */
+    explicit OutputWriter(size_t max_pending = 2);
+
+    /**
+     * @brief: Writes the remaining tasks and joins the writer thread. Exceptions of those tasks are discarded, call flush first to see them.
+    */
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter &) = delete;
+    OutputWriter & operator=(const OutputWriter &) = delete;
+
+    /**
+     * @brief: Queues a task, waiting for space if max_pending tasks are already queued.
+    */
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief: Waits until every submitted task has been written and rethrows the first exception thrown by a task.
+    */
+    void flush();
+
+    size_t get_max_pending() const;
+
+    private:
+    void write_tasks();
+    void rethrow_error();
+
+    size_t max_pending;
+    std::deque<std::function<void()>> tasks;
+    bool writing = false; // a task has been taken off the queue and is being written
+    bool stopping = false;
+    std::exception_ptr error;
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    std::thread writer_thread;
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include "particle.hpp"
+#include "MassAssignment.hpp"
+#include <fftw3.h>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/**
+ * @brief: Settings of the power spectrum estimator.
+ * num_bins: number of linear bins in |k| between 0 and the Nyquist wavenumber of the grid.
+ * subtract_shot_noise: subtracts the Poisson shot noise V / num_particles of discrete particles.
+ * deconvolve_window: divides by the squared window of the mass assignment scheme, which otherwise suppresses power towards the Nyquist wavenumber.
+*/
+struct PowerSpectrumOptions
+{
+    int num_bins = 32;
+    bool subtract_shot_noise = false;
+    bool deconvolve_window = false;
+};
+
+/**
+ * @brief: Binned matter power spectrum P(k) of the density contrast, in units of volume (box width cubed).
+ * k is the mean wavenumber of the modes in each bin (the bin centre for empty bins), power the mean power and num_modes the number of modes of the full spectrum in the bin.
+*/
+struct PowerSpectrum
+{
+    std::vector<double> k;
+    std::vector<double> power;
+    std::vector<uint64_t> num_modes;
+};
+
+/**
+ * @brief: Bins the power of a density spectrum, e.g. the forward transform that Simulation::fill_potential_buffer computes anyway, so P(k) costs no extra FFT.
+ * The mean density is taken from the zero mode. Bins are accumulated per thread and merged in thread order, so the result is deterministic for a given number of threads.
+ * @param density_spectrum: Half spectrum of num_cells * num_cells * (num_cells/2 + 1) modes from an r2c transform of the density.
+ * @param num_cells: Number of cells per length of the box.
+ * @param box_width: Width of the box, which sets the wavenumbers and the volume.
+ * @param num_particles: Number of particles, for the shot noise.
+ * @param scheme: Mass assignment scheme the density was made with, for the window.
+ * @param options: Number of bins and corrections.
+*/
+PowerSpectrum binPowerSpectrum(const fftw_complex * density_spectrum, uint num_cells, double box_width, size_t num_particles,
+                               mass_assignment scheme, const PowerSpectrumOptions &options = PowerSpectrumOptions());
+
+/**
+ * @brief: Bins the power of a single precision density spectrum. The power is accumulated in double precision.
+*/
+PowerSpectrum binPowerSpectrum(const fftwf_complex * density_spectrum, uint num_cells, double box_width, size_t num_particles,
+                               mass_assignment scheme, const PowerSpectrumOptions &options = PowerSpectrumOptions());
+
+/**
+ * @brief: Measures the power spectrum of particles on their own grid: deposits them with the scheme, transforms once and calls binPowerSpectrum.
+ * Use Simulation::request_power_spectrum instead to reuse the transform of a step.
+*/
+PowerSpectrum powerSpectrum(particle_view particles, uint num_cells, double box_width, mass_assignment scheme = mass_assignment::CIC,
+                            const PowerSpectrumOptions &options = PowerSpectrumOptions());
+
+/**
+ * @brief: Saves a power spectrum to a csv file with the columns k, power and modes, one row per bin.
+*/
+void Save_PowerSpectrum_csv(const PowerSpectrum &spectrum, const std::string &filename);
@@ -1,75 +1,375 @@
 #pragma once
 #include "particle.hpp"
+#include "FFTPlans.hpp"
+#include "GreenFunction.hpp"
+#include "MassAssignment.hpp"
+#include "Snapshot.hpp"
+#include "OutputSchedule.hpp"
+#include "PowerSpectrum.hpp"
+#include "SpatialSort.hpp"
+#include "Utils.hpp"
 #include <fftw3.h>
 #include <vector>
 #include <optional>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <type_traits>
+
+struct SimulationCheckpoint;
+
+/**
+ * @brief: Method used to accumulate particle contributions into the shared density buffer.
+ * atomic: every particle adds to its cells with an omp atomic, which serialises when many threads hit the same cells in clustered distributions.
+ * plane_binned: particles are counting sorted by the x plane they lie in and planes far enough apart to never share a cell are deposited concurrently without atomics.
+ * The result is deterministic for any number of threads.
+*/
+enum class deposit_method { atomic, plane_binned };
+
+/**
+ * @brief: Method used to evaluate the gradient of the potential.
+ * finite_difference: one inverse transform gives the potential and calculate_gradient takes a second order periodic central difference of it.
+ * spectral: the three gradient components are computed in Fourier space by multiplying the potential by ik and doing three inverse transforms.
+ * This costs two more transforms but differentiates every mode exactly, so forces are more accurate at a given number of cells.
+*/
+enum class force_method { finite_difference, spectral };
+
+/**
+ * @brief: Velocities stored for the particles.
+ * physical: box_expansion divides every velocity by the expansion factor each step, an O(N) pass over the velocities.
+ * comoving: the particles keep velocities multiplied by the cumulative expansion (see get_velocity_scale), which is tracked as a single scalar.
+ * The kick is multiplied and the drift divided by it, so box_expansion touches no particle memory. Physical velocities are the stored ones divided by the scale.
+ * Rounding differs from the physical frame in the last bits.
+*/
+enum class velocity_frame { physical, comoving };
+
+/**
+ * @brief: Time integration scheme of run.
+ * euler: every step kicks the velocities with the force at the current positions and then drifts the positions, with the fixed time step (first order).
+ * leapfrog_kdk: second order kick-drift-kick leapfrog. A half kick, a drift and the expansion of the box are followed by a second half kick with the force
+ * at the new positions, which is then reused by the first half kick of the next step, so a step still costs one force evaluation. The step is chosen
+ * every step from the largest acceleration and speed (see set_integrator).
+*/
+enum class integrator { euler, leapfrog_kdk };
+
+/**
+ * @brief: Floating point type of the particles and grids of a simulation.
+ * double_precision: Simulation, everything in double.
+ * single_precision: SimulationFloat, particles, grids and transforms (fftwf) in float. Half the memory traffic and twice the SIMD width, at about 1e-6 relative accuracy.
+ * mixed: SimulationMixed, float particles, potential, gradient and transforms, with the density accumulated in double and rounded once for the transform,
+ * so cells that receive many particles do not lose precision.
+ * Times, the box width and every other scalar stay double whatever the precision, and snapshots, images and checkpoints are written in double.
+*/
+enum class precision { double_precision, single_precision, mixed };
+
+/**
+ * @brief: Returns the precision named by "DOUBLE", "FLOAT" or "MIXED" (any case). Throws std::invalid_argument for other names.
+*/
+precision precision_from_string(const std::string &name);
 
 /**
  * @brief: Class that takes an initial distribution of particles and then uses the particle mesh method to simulate the trajectories of N bodies due to the resultant gravitational field.
  * Calculates the gravitational potential at each point in the cubic mesh and then evaluates the acceleration due to gravity for each cell. Updates particle positions based on this gravity.
+ * Real is the type of the particles, potential, gradient and transforms and DensityReal the type the density is accumulated in (see precision).
 */
-class Simulation
+template <typename Real, typename DensityReal = Real>
+class BasicSimulation
 {
 public:
+    using real_type = Real;
+    using complex = typename fftw_traits<Real>::complex;
+    static constexpr precision real_precision = std::is_same_v<Real, double> ? precision::double_precision 
+                                                : (std::is_same_v<DensityReal, double> ? precision::mixed : precision::single_precision);
+
     /**
-     * @brief Constructor for Simulation class. Allocates memory in heap for FFT plans for forward and backwards fast fourier transform and respective buffers. Initialises member variables of class.
+     * @brief Constructor for Simulation class. Allocates memory in heap for the buffers used by the forward and backwards fast fourier transform and obtains multithreaded FFT plans using omp_get_max_threads() threads.
+     * Plans are shared with every other Simulation using the same number of cells and threads so are only created once.
      * @param t_max: Time at which Simulation terminates.
      * @param t_step: Timestep which separates each moment that the Simulation evaluates particle positions for.
-     * @param collection: Particle_group instance that contains the initial distribution of particles to be passed to the Simulation.
+     * @param collection: Particle_group instance that contains the initial distribution of particles to be passed to the Simulation. Pass a temporary or std::move it in to avoid copying the particles.
      * @param num_cells: Number of cells per length of the cubic box the Simulation runs in.
      * @param e_factor: Expansion factor - Factor by which the simulation is scaled by every iteration.
+     * @param scheme: Mass assignment scheme (NGP, CIC or TSC) used to build the density and, with the matching kernel, to interpolate forces back to the particles.
+     * @param wisdom_folder: Optional folder of FFTW wisdom files keyed by grid size and thread count. Wisdom is imported before planning and exported after, removing the FFTW_MEASURE cost from later runs.
     */
-    Simulation(double t_max, double t_step, particle_group collection, double W, uint num_cells, double e_factor);  
+    BasicSimulation(double t_max, double t_step, basic_particle_group<Real> collection, double W, uint num_cells, double e_factor, 
+               mass_assignment scheme = mass_assignment::NGP, std::optional<std::string> wisdom_folder = std::nullopt);  
     
     /**
-     * @brief Run a particle mesh simulation from t=0 to t_max in slices separated by dt.
+     * @brief: Creates a Simulation that continues from a checkpoint, with the same state and modes as the one that wrote it. Throws std::invalid_argument if the checkpoint was written with another precision.
+     * The FFT plans must match too for the continuation to be bit-identical, so use the same thread count and a wisdom folder (FFTW_MEASURE may otherwise choose different algorithms).
+     * @param checkpoint: State to continue from, e.g. from load_checkpoint. time_max may be changed to extend the run. std::move it in to avoid copying the particles.
+     * @param wisdom_folder: Optional folder of FFTW wisdom files.
+    */
+    static std::unique_ptr<BasicSimulation> from_checkpoint(SimulationCheckpoint checkpoint, std::optional<std::string> wisdom_folder = std::nullopt);
+
+    /**
+     * @brief Run a particle mesh simulation from the current time (t=0 unless restored from a checkpoint) to t_max in slices separated by dt.
+     * Images, snapshots and checkpoints are copied and written on a background thread while the steps continue (see set_output_queue_length).
+     * The outputs and the steps they are written after are chosen by the output schedule (see set_output_schedule).
      * @param output_folder string containing the output folder that the simulation images will be saved to. Optional argument that defaults to a std::nullopt object and results in no saved plots.
      */
     void run(std::optional<std::string> output_folder = std::nullopt);
 
     /**
-     * @brief: Calculates the density of every cell in the cubic box. Stores in the density buffer array with type fftw_complex.
+     * @brief: Calculates the density of every cell in the cubic box using the mass assignment scheme. Stores in the real valued density buffer array.
     */
     void fill_density_buffer();
 
     /**
-     * @brief: Evaluates the gravitational potential of every cell in the cubic box. Stores in the density buffer array with type fftw_complex.
-     * Evaluates Fast Fourier Transform of density buffer, applies factors and performs back transformation.
+     * @brief: Evaluates the gravitational potential of every cell in the cubic box. Stores in the real valued potential buffer array.
+     * Evaluates real-to-complex Fast Fourier Transform of density buffer, multiplies the half spectrum by the precomputed Green's function table and the squared box width and performs complex-to-real back transformation.
+     * With force_method::spectral the gradient buffer is filled directly from the spectrum instead and the potential buffer is not updated (in mixed precision it holds the rounded density).
+     * If a power spectrum was requested, the density spectrum is binned before it is multiplied by the Green's function.
     */
     void fill_potential_buffer();
-    std::vector<std::vector<std::vector<std::array<double, 3>>>> calculate_gradient(const fftw_complex * potential);
+
+    /**
+     * @brief: Evaluates the gradient of a potential in every cell with a second order periodic finite difference.
+     * Stores the result in the persistent gradient buffer so no memory is allocated each step.
+     * @param potential: Real buffer of number_of_cells^3 values.
+     * @returns: Pointer to the gradient buffer. Component d of the cell with flat index k + N * (j + N * i) is at [d * get_gradient_stride() + index].
+    */
+    const Real * calculate_gradient(const Real * potential);
     
     /**
      * @brief: Given cell graviational potential calculates the acceleration due to gravity in every direction in each cell of the box.
-     * Applies acceleration to constant acceleration equations of motion to evaluate updated velocities and acceleration.
+     * Interpolates the acceleration to each particle with the mass assignment kernel and applies it to constant acceleration equations of motion to evaluate updated velocities and acceleration.
     */
     void update_particles();
     
     /**
-     * @brief: Applies expansion factor to width of box and velocity of every particle.
+     * @brief: Applies expansion factor to width of box and velocity of every particle. With velocity_frame::comoving only the velocity scale is updated.
     */
     void box_expansion();
 
     /**
-     * @brief: Destructor deallocates fftw_complex * c array memory in heap and deallocates memory used to store FFT plans.
+     * @brief: Does update_particles followed by box_expansion in a single pass over the particles, as run does every step.
+     * The velocities are divided by the expansion factor right after the drift instead of being read and written again, so each step streams
+     * the particle arrays once instead of streaming the velocities twice. The result is bit-identical to calling the two functions in turn.
+    */
+    void update_particles_and_expand();
+
+    /**
+     * @brief: Destructor deallocates the real, gradient and fftw_complex c array memory in heap. Shared FFT plans are released.
+    */
+    ~BasicSimulation();
+
+    BasicSimulation(const BasicSimulation &) = delete;
+    BasicSimulation & operator=(const BasicSimulation &) = delete;
+
+    const DensityReal * get_density_buffer() const;
+    const Real * get_potential_buffer() const;
+    const Real * get_gradient_buffer() const;
+    size_t get_gradient_stride() const;
+
+    /**
+     * @brief: Returns the particles as stored, so with velocity_frame::comoving the velocities are multiplied by get_velocity_scale().
+    */
+    const basic_particle_group<Real> & get_particle_collection() const;
+
+    /**
+     * @brief: Copies the particles with physical velocities, whatever the velocity frame.
+    */
+    basic_particle_group<Real> get_physical_particle_collection() const;
+
+    /**
+     * @brief: Moves the particles out of the simulation without copying them, leaving it with no particles. The velocities are converted to physical ones in place.
+     * The particle ids are cleared, so get them first if the particles have been sorted.
+    */
+    basic_particle_group<Real> release_particle_collection();
+
+    /**
+     * @brief: Returns the stable id of every particle, its index in the collection the simulation was created with, in the current particle order.
+     * Empty while the particles have never been sorted, in which case the ids are the indices.
+    */
+    const std::vector<uint64_t> & get_particle_ids() const;
+
+    /**
+     * @brief: Reorders the particles along the Morton curve of the cells (see sort_particles_by_cell) so the deposit and force interpolation access the grid
+     * almost sequentially. The ids follow the particles.
+    */
+    void sort_particles();
+
+    /**
+     * @brief: Makes run sort the particles before every interval_steps-th step, as clustering moves particles far from their neighbours in memory. 0 (the default) never sorts.
+     * Sorting changes the order the density is summed in, so results differ from an unsorted run by rounding.
+    */
+    void set_particle_sorting(uint interval_steps);
+    uint get_particle_sorting() const;
+    mass_assignment get_mass_assignment() const;
+
+    /**
+     * @brief: Selects how fill_density_buffer accumulates the density. Defaults to deposit_method::plane_binned.
+    */
+    void set_deposit_method(deposit_method method);
+    deposit_method get_deposit_method() const;
+
+    /**
+     * @brief: Selects how the gradient of the potential is evaluated. Defaults to force_method::finite_difference.
+     * The spectral method allocates an extra half spectrum buffer the first time it is selected.
+    */
+    void set_force_method(force_method method);
+    force_method get_force_method() const;
+
+    /**
+     * @brief: Selects the velocities the particles store. Defaults to velocity_frame::physical.
+     * Switching back to the physical frame converts the stored velocities once and resets the velocity scale to 1.
+    */
+    void set_velocity_frame(velocity_frame frame);
+    velocity_frame get_velocity_frame() const;
+
+    /**
+     * @brief: Returns the cumulative expansion of the velocities since the comoving frame was selected, 1 in the physical frame.
+    */
+    double get_velocity_scale() const;
+
+    /**
+     * @brief: Selects the integrator of run. Defaults to integrator::euler with the fixed time step.
+     * With integrator::leapfrog_kdk each step is the smallest of max_time_step, courant_factor * sqrt(cell width / largest acceleration) and
+     * courant_factor * cell width / largest physical speed, shortened to end exactly on the next requested output time and on t_max.
+     * The expansion factor then applies per time step given to the constructor of elapsed time, so a step of dt expands the box by e_factor^(dt / t_step)
+     * and expansion triggers see e_factor^(t / t_step).
+     * @param courant_factor: Fraction of a cell a particle may move or accelerate across in a step. Must be larger than 0.
+     * @param max_time_step: Largest leapfrog step. 0 uses the time step given to the constructor.
+    */
+    void set_integrator(integrator method, double courant_factor = 0.25, double max_time_step = 0);
+    integrator get_integrator() const;
+    double get_courant_factor() const;
+    double get_max_time_step() const;
+
+    /**
+     * @brief: Selects the kernel of the Green's function used by fill_potential_buffer. Defaults to green_kernel::plain.
+     * The deconvolved kernel removes the window of this simulation's mass assignment scheme.
+     * @param smoothing_cells: Width of the gaussian kernel in cells. Ignored by the other kernels.
+    */
+    void set_green_kernel(green_kernel kernel, double smoothing_cells = 1);
+    green_kernel get_green_kernel() const;
+
+    /**
+     * @brief: Selects the format of the images written by run. Defaults to image_format::binary (P6).
+    */
+    void set_image_format(image_format format);
+    image_format get_image_format() const;
+
+    /**
+     * @brief: Sets when run writes output and which outputs it writes. Defaults to a projection image every 10 steps.
+    */
+    void set_output_schedule(OutputSchedule schedule);
+    const OutputSchedule & get_output_schedule() const;
+
+    /**
+     * @brief: Makes the next fill_potential_buffer bin the power spectrum of the density from its forward transform, so the measurement costs no extra FFT.
+     * run requests it itself on steps with a power_spectrum output.
+    */
+    void request_power_spectrum();
+
+    /**
+     * @brief: Returns the power spectrum of the last requested step, or std::nullopt if none has been measured.
+    */
+    const std::optional<PowerSpectrum> & get_power_spectrum() const;
+
+    /**
+     * @brief: Sets the bins and corrections of the measured power spectra. Defaults to 32 bins without corrections.
+    */
+    void set_power_spectrum_options(PowerSpectrumOptions options);
+    const PowerSpectrumOptions & get_power_spectrum_options() const;
+
+    /**
+     * @brief: Selects the compression of the density and particle snapshots written by run. Defaults to snapshot_compression::none.
+    */
+    void set_snapshot_compression(snapshot_compression compression);
+
+    /**
+     * @brief: Sets how many outputs (images, snapshots and checkpoints) run may queue for its background writer thread. Each queued output holds a copy of the density
+     * (and of the particles for snapshots and checkpoints), and run waits for space when the queue is full. 0 writes every output synchronously in the step loop. Defaults to 2.
     */
-    ~Simulation();
+    void set_output_queue_length(size_t length);
+    size_t get_output_queue_length() const;
 
-    const fftw_complex * get_density_buffer() const;
-    const fftw_complex * get_potential_buffer() const;
-    const particle_group & get_particle_collection() const;
+    /**
+     * @brief: Makes run write a checkpoint to checkpoint_file every interval_steps steps. The file is replaced each time so holds the latest state.
+    */
+    void set_checkpointing(const std::string &checkpoint_file, uint interval_steps);
+
+    /**
+     * @brief: Copies the current state of the simulation, with the particles converted to double.
+    */
+    SimulationCheckpoint get_checkpoint() const;
+
+    double get_time() const;
+    uint64_t get_step() const;
 
     private:
+    /**
+     * @brief: Fills the gradient buffer from the potential spectrum in k_space_buffer, one complex-to-real transform per component.
+    */
+    void fill_spectral_gradient();
+    template <mass_assignment Scheme>
+    void deposit_particles();
+
+    /**
+     * @brief: Kicks the velocities by the force interpolated from the gradient buffer over kick_time, then drifts the positions over drift_time if Drift
+     * and divides the velocities by the expansion factor if Expand. Records the largest stored speed in max_speed.
+    */
+    template <mass_assignment Scheme, bool Drift, bool Expand>
+    void kick_drift_particles(double kick_time, double drift_time);
+    template <bool Drift, bool Expand>
+    void dispatch_kick_drift(double kick_time, double drift_time);
+
+    /**
+     * @brief: Fills the density, potential and gradient buffers for the current positions, binning the power spectrum if it was requested.
+    */
+    void compute_forces();
+
+    /**
+     * @brief: Chooses the next leapfrog step from the gradient buffer and max_speed, shortened to end on next_output_time (ignored if negative) or t_max.
+     * @param end_time: Set to the time the step ends at, exactly the target when the step was shortened to it.
+    */
+    double adaptive_time_step(double next_output_time, double &end_time) const;
+
     double time_max;
     double time_step;
-    particle_group particle_collection;
+    basic_particle_group<Real> particle_collection;
     double box_width;
     uint number_of_cells;
     double expansion_factor;
+    double current_time = 0;
+    uint64_t step_count = 0;
+    mass_assignment assignment_scheme;
+    deposit_method density_deposit = deposit_method::plane_binned;
+    force_method gradient_method = force_method::finite_difference;
+    velocity_frame particle_velocity_frame = velocity_frame::physical;
+    double velocity_scale = 1; // stored velocities are the physical ones multiplied by this
+    uint sort_interval = 0;
+    integrator time_integrator = integrator::euler;
+    double courant_factor = 0.25;
+    double max_time_step = 0; // 0 uses time_step
+    double max_speed = 0; // largest stored speed after the last kick
+    std::vector<uint64_t> particle_ids; // original index of every particle, empty until the first sort
+    SpatialSortBuffers sort_buffers;
+    std::optional<std::string> checkpoint_path;
+    uint checkpoint_interval = 0;
+    image_format image_output_format = image_format::binary;
+    size_t output_queue_length = 2;
+    snapshot_compression snapshot_format = snapshot_compression::none;
+    OutputSchedule output_schedule = OutputSchedule::projection_every(10);
+    PowerSpectrumOptions power_spectrum_options;
+    bool power_spectrum_requested = false;
+    std::optional<PowerSpectrum> measured_power_spectrum;
+
+    PlaneBins plane_bins; // particles binned by x plane for the plane binned deposit, reused every step
+
+    DensityReal * density_buffer; // buffers and plans
+    Real * potential_buffer;
+    complex * k_space_buffer; // half spectrum of size number_of_cells * number_of_cells * (number_of_cells/2 + 1)
+    Real * gradient_buffer; // x, y and z components of the potential gradient stored one after another
+    size_t gradient_stride; // distance between components, number_of_cells^3 rounded up to a whole cache line
+    complex * gradient_k_buffer = nullptr; // scratch half spectrum for the spectral gradient, as complex-to-real transforms overwrite their input
+    std::shared_ptr<const BasicFFTPlans<Real>> fft_plans;
+    std::shared_ptr<const GreenFunction> green_function; // shared between simulations with the same grid size and kernel
+};
 
-    fftw_complex * density_buffer; // buffers and plans
-    fftw_complex * potential_buffer;
-    fftw_complex * k_space_buffer;
-    fftw_plan forward_plan;
-    fftw_plan backward_plan;
-};
\ No newline at end of file
+using Simulation = BasicSimulation<double>;
+using SimulationFloat = BasicSimulation<float>;
+using SimulationMixed = BasicSimulation<float, double>;
@@ -0,0 +1,71 @@
+#pragma once
+#include "particle.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief: Compression of the chunks of a snapshot file. zlib is only available when the library was built with zlib (see snapshot_compression_available).
+*/
+enum class snapshot_compression { none, zlib };
+
+/**
+ * @brief: Named array of doubles stored in a snapshot, e.g. "density" or the particle coordinate "x".
+*/
+struct SnapshotField
+{
+    std::string name;
+    std::vector<double> values;
+};
+
+/**
+ * @brief: Contents of a snapshot file. Density snapshots hold one "density" field of num_cells^3 values (flat index k + N * (j + N * i)),
+ * particle snapshots hold the fields "x", "y", "z", "vx", "vy" and "vz" with one value per particle.
+*/
+struct Snapshot
+{
+    std::string kind; // "density" or "particles"
+    double time;
+    double box_width;
+    double particle_mass;
+    uint num_cells;
+    snapshot_compression compression;
+    std::vector<SnapshotField> fields;
+
+    /**
+     * @brief: Returns the field with the given name. Throws std::invalid_argument if there is none.
+    */
+    const SnapshotField & field(const std::string &name) const;
+};
+
+/**
+ * @brief: Writes the full 3D density to a self-describing binary file for offline analysis.
+ * The file is a header (magic "PMSNAPSH", version, kind, time, box width, particle mass, number of cells, compression) followed by named fields,
+ * each split into chunks of at most 2^20 values that are stored raw or zlib compressed. Values are written in native byte order.
+ * @param filename: Path of the file to write.
+ * @param density: num_cells^3 density values.
+ * @param num_cells: Number of cells per length of the box.
+ * @param time: Simulation time of the snapshot.
+ * @param box_width: Width of the box at that time.
+ * @param compression: Compression of the chunks. Throws std::invalid_argument if zlib is requested but not available.
+*/
+void save_density_snapshot(const std::string &filename, const double * density, uint num_cells, double time, double box_width,
+                           snapshot_compression compression = snapshot_compression::none);
+
+/**
+ * @brief: Writes the positions and velocities of every particle to a snapshot file with the same layout as save_density_snapshot.
+ * @param velocity_scale: The velocities are divided by it as they are written, which turns the comoving velocities of a Simulation into physical ones without copying the particles.
+ * @param ids: Optional stable id of every particle (see Simulation::get_particle_ids), written as an extra "id" field so sorted particles can be matched between snapshots.
+*/
+void save_particle_snapshot(const std::string &filename, particle_view particles, uint num_cells, double time, double box_width,
+                            snapshot_compression compression = snapshot_compression::none, double velocity_scale = 1, const uint64_t * ids = nullptr);
+
+/**
+ * @brief: Reads a file written by save_density_snapshot or save_particle_snapshot. Throws std::runtime_error if the file is missing, truncated or not a snapshot.
+*/
+Snapshot load_snapshot(const std::string &filename);
+
+/**
+ * @brief: Returns true if snapshots can be written and read with zlib compression.
+*/
+bool snapshot_compression_available();
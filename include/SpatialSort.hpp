@@ -0,0 +1,48 @@
+#pragma once
+#include "particle.hpp"
+#include "AlignedAllocator.hpp"
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+/**
+ * @brief: Scratch memory of sort_particles_by_cell, kept between sorts so periodic reordering allocates nothing after the first sort.
+*/
+struct SpatialSortBuffers
+{
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> sorted_keys;
+    std::vector<uint> order;
+    std::vector<uint> sorted_order;
+    std::vector<size_t> counts; // per thread digit counts of the radix sort
+    aligned_vector<double> gathered; // coordinates of double precision particles
+    aligned_vector<float> gathered_float; // coordinates of single precision particles
+    std::vector<uint64_t> gathered_ids;
+};
+
+/**
+ * @brief: Morton (Z-order) key of a cell, interleaving the bits of its x, y and z indices with x most significant. Cells close in space get close keys.
+ * @param i, j, k: Cell indices along x, y and z, below 2^21.
+*/
+uint64_t morton_key(uint i, uint j, uint k);
+
+/**
+ * @brief: Stable least significant digit radix sort of keys with 8 bit digits, carrying values along. Each pass counts digits per thread over a static
+ * schedule and scatters with the same schedule, so the result does not depend on the number of threads.
+ * @param keys: Keys to sort, sorted on return.
+ * @param values: Values of the keys, permuted with them.
+ * @param key_bits: Number of low bits that can be set in the keys. Only ceil(key_bits/8) passes are made.
+ * @param buffers: Scratch memory.
+*/
+void radix_sort_by_key(std::vector<uint64_t> &keys, std::vector<uint> &values, uint key_bits, SpatialSortBuffers &buffers);
+
+/**
+ * @brief: Reorders particles along the Morton curve of the cells of a num_cells^3 grid, so particles that share cells are next to each other in memory
+ * and the density deposit and force interpolation access the grid almost sequentially. Particles in the same cell keep their relative order.
+ * @param particles: Particles to reorder, with positions in the unit cube.
+ * @param ids: Stable ids of the particles, permuted with them. If empty it is first filled with the current indices, so ids are the original order.
+ * @param num_cells: Number of cells per length of the grid the keys are made from.
+ * @param buffers: Scratch memory.
+*/
+template <typename Real>
+void sort_particles_by_cell(basic_particle_group<Real> &particles, std::vector<uint64_t> &ids, uint num_cells, SpatialSortBuffers &buffers);
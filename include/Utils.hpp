@@ -6,38 +6,84 @@
 #include <fftw3.h>
 #include <random>
 #include <optional>
+#include <ostream>
 #include "particle.hpp"
 
 using std::vector;
 using std::array;
 
 /**
- * @brief Takes a buffer of fftw_complex values and outputs and image
- * Densities are integrated over the z axis to convert to 2D
- * @param density_map density values of type fftw_comlex. Imaginary component ignored.
+ * @brief Format of density images. ascii is a plain text P3 PPM, binary a raw P6 PPM with one byte per colour channel, which is much faster to write and about 4 times smaller.
+ */
+enum class image_format { ascii, binary };
+
+/**
+ * @brief Integrates a density along one axis, in parallel, over all planes or a slab of planes
+ * @param density_map real density values, element k + n_cells*(j + n_cells*i) for cell (i, j, k)
+ * @param n_cells size of buffer in each dimension; total size is n_cells*n_cells*n_cells
+ * @param projection output of n_cells*n_cells values, indexed by the two remaining axes in order: (i, j) for axis 2, (i, k) for axis 1 and (j, k) for axis 0
+ * @param axis axis that is integrated over: 0 (x, i), 1 (y, j) or 2 (z, k)
+ * @param first_plane first plane of the slab along the axis
+ * @param num_planes number of planes of the slab, 0 for every plane from first_plane on
+ */
+void ProjectDensity(const double* density_map, const size_t n_cells, double* projection, uint axis = 2, size_t first_plane = 0, size_t num_planes = 0);
+
+/**
+ * @brief Takes a buffer of real density values and outputs and image
+ * Densities are integrated over an axis (by default z) to convert to 2D
+ * @param density_map real density values.
  * @param n_cells size of buffer in each dimension; total size is n_cells*n_cells*n_cells
  * @param filename image output file path
+ * @param format P3 (ascii) or P6 (binary) PPM image
+ * @param axis axis the density is integrated over, see ProjectDensity
+ * @param first_plane first plane of the slab that is integrated
+ * @param num_planes number of planes that are integrated, 0 for every plane from first_plane on
  */
-void SaveToFile(fftw_complex* density_map, const size_t n_cells, const std::string &filename);
+void SaveToFile(const double* density_map, const size_t n_cells, const std::string &filename, image_format format = image_format::binary,
+                uint axis = 2, size_t first_plane = 0, size_t num_planes = 0);
 
 /**
- * @brief Calculates a log radial correlation for coordinates 0 <= r < 0.5
- * Calculates pair-wise distances and counts how many fall into radial bins
- * @param positions a list of 3D positions of particles within a unit cube
+ * @brief Writes an image of density values that are already integrated over the z axis
+ * @param density_xy_map projected density values, element i*n_cells + j for cell (i, j)
+ * @param n_cells size of the image in each dimension
+ * @param filename image output file path
+ * @param format P3 (ascii) or P6 (binary) PPM image
+ */
+void SaveProjectionToFile(const double* density_xy_map, const size_t n_cells, const std::string &filename, image_format format = image_format::binary);
+
+/**
+ * @brief Calculates a log radial correlation for coordinates 0 <= r < 0.5 from every particle
+ * Particles are counted on a periodic grid and the pair counts of every cell separation are the autocorrelation of the grid, found with one
+ * forward and one inverse FFT (O(M log M) in the number of cells M) rather than O(N^2) in the number of particles.
+ * Self pairs are removed and the pair counts are averaged over the cell separations in each radial bin in parallel with per-thread histograms.
+ * Separations are resolved to the cell width so the grid needs at least 2 cells per bin width, and the default of 4 keeps the small r bins from being
+ * dominated by the gridding (at the cost of (4 * n_bins)^3 cells of memory).
+ * @param particles read-only view of the particles, whose positions lie within a unit cube. A particle_group converts to a view without copying.
  * @param n_bins the resolution of the histogram
- * @return vector<double> log of radial correlation function evenly spaced from r = 0 to 0.5
+ * @param num_cells number of grid cells per side, at least 2 * n_bins. Defaults to 4 * n_bins.
+ * @return vector<double> log(1 + xi(r)) of the radial correlation function xi evenly spaced from r = 0 to 0.5, which is 0 for uniformly distributed particles.
+ * Earlier versions returned the log of the pair density sum(1/(4 pi r^2 N)) of the first 1000 particles instead.
  */
-vector<double> correlationFunction(particle_group particles, int n_bins);
+vector<double> correlationFunction(particle_view particles, int n_bins, uint num_cells = 0);
 
 /**
  * @brief: Saves log radial correlation for coordinates 0 <= r < 0.5 (output of correlationFunction)
- * Saves results to csv file.
+ * Saves results to csv file. Each value is log(1 + xi) of the correlation function xi, so 0 where particles are as clustered as a uniform distribution,
+ * and not the log pair density that earlier versions wrote.
  * @param data: 2D std::vector that contains the radial correlation function for each bin.
  * @param columnLabels: vector of strings that contain the expansion factor the correlation function was computed for.
  * @param filename: string of the file path and name that the csv will be saved to.
 */
 void Save_Correlations_csv(const std::vector<std::vector<double>>& data, const std::vector<std::string>& columnLabels, const std::string& filename);
 
+/**
+ * @brief: Appends one row to an open csv file and flushes it, so results can be streamed to the file as they are computed.
+ * @param file: Output stream of the csv file.
+ * @param labels: Leading columns of the row, e.g. the parameters the correlation function was computed for.
+ * @param values: Remaining columns of the row, e.g. the output of correlationFunction.
+*/
+void Append_csv_row(std::ostream& file, const std::vector<std::string>& labels, const std::vector<double>& values);
+
 /**
  * @brief: Function that saves two vectors of doubles to a txt file. This was used to plot the potential evalutated by the simulation to check that it had suitable shape.
  * @param filename: String that contains the path the txt file is saved to.
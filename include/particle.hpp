@@ -3,6 +3,7 @@
 #include <vector>
 #include <array>
 #include <random>
+#include "AlignedAllocator.hpp"
 
 /**
  * @brief: Class designed to hold position and velocity data for single particle.
@@ -20,19 +21,26 @@ public:
 };
 
 /**
- * @brief: Class designed to hold collection of particle objects.
+ * @brief: Class designed to hold a collection of particles in structure-of-arrays form.
+ * Each coordinate of the position and velocity is stored in its own contiguous, cache line aligned array so that the particle kernels in Simulation can be vectorised.
+ * Real is the type of the coordinates, double (particle_group) or float (particle_group_float), which halves the memory and doubles the SIMD width of the kernels.
 */
-class particle_group
+template <typename Real>
+class basic_particle_group
 {
     public:
 
     /**
      * @brief: Constructor for particle_group class allowing for uniform random initialisation of particle positions.
+     * Positions come from a counter-based generator (coordinate j of particle i is the (3i + j)th SplitMix64 output for the seed) and are filled in parallel,
+     * so they are the same for a given seed whatever the number of threads. Float positions are the double ones rounded.
+     * The sequential std::default_random_engine used before gave different particles for the same seed.
      * @param mass: Mass of each particle.
      * @param num_particles: Number of particles to be created in the group.
-     * @param random_seed: Random seed that will be applied to the STL standard library default random number generator following the uniform distribution.
+     * @param random_seed: Random seed of the counter-based generator.
+     * @param first_particle: Index in the sequence of the first particle generated, so that processes can each generate their own part of one large group.
     */
-    particle_group(double mass, uint num_particles, uint random_seed);
+    basic_particle_group(double mass, uint num_particles, uint random_seed, size_t first_particle = 0);
     
     /**
      * @brief: Constructor for particle_group class allowing for manual assignment of particle positions. Contains error handling to check if inputted number of particles value is correct
@@ -40,13 +48,73 @@ class particle_group
      * @param num_particles: Number of particles to be created in the group.
      * @param positions: Vector of length 3 arrays that contain the coordinates in the unit cube in all 3 directions of cartesian space.
     */
-    particle_group(double mass, uint num_particles, const std::vector<std::array<double,3>> &positions);
+    basic_particle_group(double mass, uint num_particles, const std::vector<std::array<double,3>> &positions);
 
-    size_t get_num_particles();
+    /**
+     * @brief: Copies a group with coordinates of another type. Positions that round up to 1 are wrapped to 0, so they stay in the unit cube.
+    */
+    template <typename OtherReal>
+    explicit basic_particle_group(const basic_particle_group<OtherReal> &other) : mass(other.mass)
+    {
+        for (uint j = 0; j < 3; j++){
+            position[j].resize(other.get_num_particles());
+            velocity[j].assign(other.velocity[j].begin(), other.velocity[j].end());
+            for (size_t i = 0; i < other.get_num_particles(); i++){
+                position[j][i] = to_unit_interval(other.position[j][i]);
+            }
+        }
+    }
+
+    size_t get_num_particles() const;
+
+    /**
+     * @brief: Appends a particle to the end of every coordinate array.
+    */
+    void add_particle(const particle &new_particle);
+
+    /**
+     * @brief: Gathers the position and velocity of a single particle from the coordinate arrays.
+    */
+    particle get_particle(size_t index) const;
+
+    std::array<double, 3> get_position(size_t index) const;
+    std::array<double, 3> get_velocity(size_t index) const;
+
+    /**
+     * @brief: Rounds a coordinate in [0, 1) to Real, wrapping it to 0 if it rounds up to 1.
+    */
+    static Real to_unit_interval(double coordinate)
+    {
+        Real rounded = static_cast<Real>(coordinate);
+        return rounded < 1 ? rounded : 0;
+    }
 
     double mass;
-    std::vector<particle> particles;
+    std::array<aligned_vector<Real>, 3> position; // position[0] holds every x coordinate, position[1] every y and position[2] every z
+    std::array<aligned_vector<Real>, 3> velocity;
+};
+
+using particle_group = basic_particle_group<double>;
+using particle_group_float = basic_particle_group<float>;
+
+/**
+ * @brief: Read-only view of the coordinate arrays of a particle_group, used by analysis code so that the particles are never copied.
+ * The view is only valid while the particle_group it was taken from is alive and not resized.
+*/
+template <typename Real>
+struct basic_particle_view
+{
+    /**
+     * @brief: Views every particle of the group. Implicit so functions taking a view can be passed a particle_group directly.
+    */
+    basic_particle_view(const basic_particle_group<Real> &group);
 
-    private:
-    uint num_particles;
+    size_t get_num_particles() const;
+
+    double mass;
+    size_t num_particles;
+    std::array<const Real *, 3> position; // position[0] points to every x coordinate, position[1] every y and position[2] every z
+    std::array<const Real *, 3> velocity;
 };
+
+using particle_view = basic_particle_view<double>;
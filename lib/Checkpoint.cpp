@@ -0,0 +1,120 @@
+#include "Checkpoint.hpp"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <filesystem>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+    const char checkpoint_magic[8] = {'P', 'M', 'S', 'I', 'M', 'C', 'K', 'P'};
+    const uint32_t checkpoint_version = 5;
+
+    template <typename T>
+    void write_value(std::ofstream &file, T value){
+        file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    T read_value(std::ifstream &file){
+        T value;
+        file.read(reinterpret_cast<char *>(&value), sizeof(T));
+        return value;
+    }
+}
+
+void save_checkpoint(const SimulationCheckpoint &checkpoint, const std::string &filename){
+    std::string temporary_file = filename + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporary_file, std::ios::binary);
+        if (!file){
+            throw std::runtime_error("Error - Could not open checkpoint file " + temporary_file + " for writing!");
+        }
+        const particle_group &particles = checkpoint.particles;
+        uint64_t num_particles = particles.get_num_particles();
+
+        file.write(checkpoint_magic, sizeof(checkpoint_magic));
+        write_value<uint32_t>(file, checkpoint_version);
+        write_value<uint32_t>(file, checkpoint.num_cells);
+        write_value<uint32_t>(file, static_cast<uint32_t>(checkpoint.scheme));
+        write_value<uint32_t>(file, static_cast<uint32_t>(checkpoint.density_deposit));
+        write_value<uint32_t>(file, static_cast<uint32_t>(checkpoint.gradient_method));
+        write_value<uint32_t>(file, static_cast<uint32_t>(checkpoint.kernel));
+        write_value<uint32_t>(file, static_cast<uint32_t>(checkpoint.frame));
+        write_value<uint32_t>(file, checkpoint.sort_interval);
+        write_value<uint32_t>(file, static_cast<uint32_t>(checkpoint.time_integrator));
+        write_value<uint32_t>(file, static_cast<uint32_t>(checkpoint.real_precision));
+        write_value<uint64_t>(file, checkpoint.step);
+        write_value<uint64_t>(file, num_particles);
+        for (double value : {checkpoint.time, checkpoint.time_max, checkpoint.time_step, checkpoint.box_width,
+                             checkpoint.expansion_factor, checkpoint.smoothing_cells, checkpoint.velocity_scale, checkpoint.courant_factor, checkpoint.max_time_step, particles.mass}){
+            write_value<double>(file, value);
+        }
+        for (const auto &coordinates : {std::cref(particles.position), std::cref(particles.velocity)}){
+            for (uint dim = 0; dim < 3; dim++){
+                file.write(reinterpret_cast<const char *>(coordinates.get()[dim].data()), sizeof(double) * num_particles);
+            }
+        }
+        write_value<uint64_t>(file, checkpoint.particle_ids.size());
+        file.write(reinterpret_cast<const char *>(checkpoint.particle_ids.data()), sizeof(uint64_t) * checkpoint.particle_ids.size());
+        if (!file){
+            throw std::runtime_error("Error - Failed to write checkpoint file " + temporary_file + "!");
+        }
+    }
+    std::filesystem::rename(temporary_file, filename);
+}
+
+SimulationCheckpoint load_checkpoint(const std::string &filename){
+    std::ifstream file(filename, std::ios::binary);
+    if (!file){
+        throw std::runtime_error("Error - Could not open checkpoint file " + filename + "!");
+    }
+    char magic[sizeof(checkpoint_magic)];
+    file.read(magic, sizeof(magic));
+    if (!file || !std::equal(magic, magic + sizeof(magic), checkpoint_magic)){
+        throw std::runtime_error("Error - " + filename + " is not a simulation checkpoint!");
+    }
+    uint32_t version = read_value<uint32_t>(file);
+    if (version != checkpoint_version){
+        throw std::runtime_error("Error - Checkpoint " + filename + " has version " + std::to_string(version) + 
+                                 " but version " + std::to_string(checkpoint_version) + " is supported!");
+    }
+    uint num_cells = read_value<uint32_t>(file);
+    mass_assignment scheme = static_cast<mass_assignment>(read_value<uint32_t>(file));
+    deposit_method density_deposit = static_cast<deposit_method>(read_value<uint32_t>(file));
+    force_method gradient_method = static_cast<force_method>(read_value<uint32_t>(file));
+    green_kernel kernel = static_cast<green_kernel>(read_value<uint32_t>(file));
+    velocity_frame frame = static_cast<velocity_frame>(read_value<uint32_t>(file));
+    uint sort_interval = read_value<uint32_t>(file);
+    integrator time_integrator = static_cast<integrator>(read_value<uint32_t>(file));
+    precision real_precision = static_cast<precision>(read_value<uint32_t>(file));
+    uint64_t step = read_value<uint64_t>(file);
+    uint64_t num_particles = read_value<uint64_t>(file);
+    double values[10];
+    for (double &value : values){
+        value = read_value<double>(file);
+    }
+    if (!file){
+        throw std::runtime_error("Error - Checkpoint " + filename + " is truncated!");
+    }
+
+    particle_group particles(values[9], 0, {});
+    for (auto *coordinates : {&particles.position, &particles.velocity}){
+        for (uint dim = 0; dim < 3; dim++){
+            (*coordinates)[dim].resize(num_particles);
+            file.read(reinterpret_cast<char *>((*coordinates)[dim].data()), sizeof(double) * num_particles);
+        }
+    }
+    uint64_t num_ids = read_value<uint64_t>(file);
+    if (!file || (num_ids != 0 && num_ids != num_particles)){
+        throw std::runtime_error("Error - Checkpoint " + filename + " is truncated!");
+    }
+    std::vector<uint64_t> particle_ids(num_ids);
+    file.read(reinterpret_cast<char *>(particle_ids.data()), sizeof(uint64_t) * num_ids);
+    if (!file){
+        throw std::runtime_error("Error - Checkpoint " + filename + " is truncated!");
+    }
+    return SimulationCheckpoint{values[0], step, values[1], values[2], values[3], values[4], num_cells, 
+                                scheme, density_deposit, gradient_method, kernel, values[5], frame, values[6], sort_interval, time_integrator, values[7], values[8],
+                                real_precision, std::move(particles), std::move(particle_ids)};
+}
@@ -0,0 +1,629 @@
+#include "DistributedSimulation.hpp"
+#include "FFTPlans.hpp"
+#include "GreenFunction.hpp"
+#include "Utils.hpp"
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+#include <utility>
+#include <omp.h>
+
+DistributedSimulation::DistributedSimulation(double t_max, double t_step, particle_group local_particles, double W, uint num_cells, double e_factor,
+                                             mass_assignment scheme, MPI_Comm communicator) :
+                                time_max(t_max), time_step(t_step), particle_collection(std::move(local_particles)), box_width(W), number_of_cells(num_cells),
+                                expansion_factor(e_factor), assignment_scheme(scheme), comm(communicator)
+{
+    if (t_max <= 0){
+        throw std::invalid_argument("Error - t_max (maximum time reached) must not be less than or equal to 0!");
+    }
+    if (t_step <= 0){
+        throw std::invalid_argument("Error - t_step (time step) must not be less than or equal to 0!");
+    }
+    if (W <= 0){
+        throw std::invalid_argument("Error - W (Box Width) must not be less than or equal to 0!");
+    }
+    if (e_factor <= 0){
+        throw std::invalid_argument("Error - e_factor (expansion factor) must be larger than 0!");
+    }
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &num_processes);
+    if (num_cells < 2 * static_cast<uint>(num_processes)){
+        throw std::invalid_argument("Error - num_cells (Grid Length) must be at least twice the number of processes so every slab has 2 planes!");
+    }
+
+    // split the planes as evenly as possible, the first num_cells % num_processes processes get one extra
+    first_plane.resize(num_processes);
+    num_planes.resize(num_processes);
+    plane_owner.resize(number_of_cells);
+    uint plane = 0;
+    for (int process = 0; process < num_processes; process++){
+        first_plane[process] = plane;
+        num_planes[process] = number_of_cells / num_processes + (static_cast<uint>(process) < number_of_cells % num_processes ? 1 : 0);
+        for (uint p = 0; p < num_planes[process]; p++){
+            plane_owner[plane++] = process;
+        }
+    }
+    local_first_plane = first_plane[rank];
+    local_num_planes = num_planes[rank];
+
+    uint half_cells = number_of_cells/2 + 1;
+    plane_size = static_cast<size_t>(number_of_cells) * number_of_cells;
+    half_plane_size = static_cast<size_t>(number_of_cells) * half_cells;
+    size_t spectrum_length = local_num_planes * half_plane_size; // the same for the x planes and the transposed y rows
+
+    density_buffer = (double *) fftw_malloc(sizeof(double) * (local_num_planes + 2) * plane_size);
+    potential_buffer = (double *) fftw_malloc(sizeof(double) * (local_num_planes + 4) * plane_size);
+    gradient_stride = ((local_num_planes + 2) * plane_size + 7) / 8 * 8; // keep every component 64 byte aligned
+    gradient_buffer = (double *) fftw_malloc(sizeof(double) * 3 * gradient_stride);
+    plane_spectra = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * spectrum_length);
+    column_spectra = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * spectrum_length);
+    transpose_buffer.resize(2 * spectrum_length);
+    receive_buffer.resize(2 * spectrum_length);
+
+    // 2D transforms of every local plane and 1D transforms along x of every transposed column, planned with the multithreaded planner
+    FFTPlans::initialise_threads();
+    std::unique_lock<std::mutex> planner_lock = FFTPlans::lock_planner(); // other threads may be planning Simulation transforms
+    fftw_plan_with_nthreads(omp_get_max_threads());
+    int plane_dims[2] = {static_cast<int>(number_of_cells), static_cast<int>(number_of_cells)};
+    int column_dims[1] = {static_cast<int>(number_of_cells)};
+    int num_columns = local_num_planes * half_cells;
+    plane_forward_plan = fftw_plan_many_dft_r2c(2, plane_dims, local_num_planes, density_buffer + plane_size, nullptr, 1, plane_size,
+                                                plane_spectra, nullptr, 1, half_plane_size, FFTW_MEASURE);
+    plane_backward_plan = fftw_plan_many_dft_c2r(2, plane_dims, local_num_planes, plane_spectra, nullptr, 1, half_plane_size,
+                                                 potential_buffer + 2 * plane_size, nullptr, 1, plane_size, FFTW_MEASURE);
+    column_forward_plan = fftw_plan_many_dft(1, column_dims, num_columns, column_spectra, nullptr, 1, number_of_cells,
+                                             column_spectra, nullptr, 1, number_of_cells, FFTW_FORWARD, FFTW_MEASURE);
+    column_backward_plan = fftw_plan_many_dft(1, column_dims, num_columns, column_spectra, nullptr, 1, number_of_cells,
+                                              column_spectra, nullptr, 1, number_of_cells, FFTW_BACKWARD, FFTW_MEASURE);
+    planner_lock.unlock();
+
+    // Green's function of the local modes, laid out like column_spectra (y row, z frequency, x frequency)
+    green_table.resize(spectrum_length);
+    int n = number_of_cells;
+    #pragma omp parallel for collapse(2)
+    for (int row = 0; row < static_cast<int>(local_num_planes); row++){
+        for (int k = 0; k < static_cast<int>(half_cells); k++){
+            int j = local_first_plane + row;
+            int frequency_j = j <= n/2 ? j : j - n;
+            for (int i = 0; i < n; i++){
+                int frequency_i = i <= n/2 ? i : i - n;
+                green_table[(row * static_cast<size_t>(half_cells) + k) * n + i] = GreenFunction::mode_value(frequency_i, frequency_j, k, number_of_cells);
+            }
+        }
+    }
+
+    // zero after planning, as FFTW_MEASURE overwrites the buffers
+    std::memset(density_buffer, 0, sizeof(double) * (local_num_planes + 2) * plane_size);
+    std::memset(potential_buffer, 0, sizeof(double) * (local_num_planes + 4) * plane_size);
+    std::memset(gradient_buffer, 0, sizeof(double) * 3 * gradient_stride);
+
+    exchange_particles(); // particles may have been generated on any process
+}
+
+DistributedSimulation::~DistributedSimulation(){
+    {
+        std::unique_lock<std::mutex> planner_lock = FFTPlans::lock_planner();
+        fftw_destroy_plan(plane_forward_plan);
+        fftw_destroy_plan(plane_backward_plan);
+        fftw_destroy_plan(column_forward_plan);
+        fftw_destroy_plan(column_backward_plan);
+    }
+    fftw_free(density_buffer);
+    fftw_free(potential_buffer);
+    fftw_free(gradient_buffer);
+    fftw_free(plane_spectra);
+    fftw_free(column_spectra);
+}
+
+void DistributedSimulation::run(std::optional<std::string> output_folder)
+{
+    unsigned long long local_particles = particle_collection.get_num_particles(), total_particles = 0;
+    MPI_Allreduce(&local_particles, &total_particles, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+    std::string ppc = findsigfig(static_cast<double>(total_particles)/static_cast<double>(number_of_cells * number_of_cells * number_of_cells));
+
+    double t = 0.0;
+    uint counter = 0;
+    std::vector<double> local_projection(local_num_planes * number_of_cells);
+    std::vector<double> projection(rank == 0 ? plane_size : 0);
+    std::vector<int> counts(num_processes), displacements(num_processes);
+    for (int process = 0; process < num_processes; process++){
+        counts[process] = num_planes[process] * number_of_cells;
+        displacements[process] = first_plane[process] * number_of_cells;
+    }
+    while (t < time_max){
+        fill_density_buffer();
+        fill_potential_buffer();
+        update_particles_and_expand();
+        t += time_step;
+
+        if (output_folder){
+            counter++;
+            if (counter >= 10){
+                counter = 0;
+                // integrate the local planes over z and collect the rows of the image on the first process
+                #pragma omp parallel for
+                for (size_t row = 0; row < local_projection.size(); row++){
+                    const double * cells = density_buffer + plane_size + row * number_of_cells;
+                    double sum = 0;
+                    for (uint k = 0; k < number_of_cells; k++){
+                        sum += cells[k];
+                    }
+                    local_projection[row] = sum;
+                }
+                MPI_Gatherv(local_projection.data(), local_projection.size(), MPI_DOUBLE, projection.data(), counts.data(), displacements.data(), MPI_DOUBLE, 0, comm);
+                if (rank == 0){
+                    std::string partial_path = *output_folder + "/" + findsigfig(expansion_factor) + "/"; // directories to be stored
+                    std::filesystem::create_directories(partial_path);
+                    std::string full_path = partial_path + "UniverseSim_dt_" + findsigfig(time_step) + "_time_" +
+                    findsigfig(t) + "_num_cells_" + std::to_string(number_of_cells) + "_ppc_" + ppc + ".ppm";
+                    SaveProjectionToFile(projection.data(), number_of_cells, full_path);
+                }
+            }
+        }
+    }
+}
+
+uint DistributedSimulation::padded_plane(uint global_plane) const {
+    int offset = static_cast<int>(global_plane) - static_cast<int>(local_first_plane);
+    int n = number_of_cells;
+    if (offset < -1){
+        offset += n;
+    }
+    else if (offset > static_cast<int>(local_num_planes)){
+        offset -= n;
+    }
+    return offset + 1;
+}
+
+void DistributedSimulation::fill_density_buffer(){
+    std::memset(density_buffer, 0, sizeof(double) * (local_num_planes + 2) * plane_size);
+    switch (assignment_scheme){
+        case mass_assignment::NGP:
+            deposit_particles<mass_assignment::NGP>();
+            break;
+        case mass_assignment::CIC:
+            deposit_particles<mass_assignment::CIC>();
+            break;
+        case mass_assignment::TSC:
+            deposit_particles<mass_assignment::TSC>();
+            break;
+    }
+
+    // the ghost planes belong to the neighbouring slabs, so add them to the edge planes of the neighbours
+    int left = (rank + num_processes - 1) % num_processes;
+    int right = (rank + 1) % num_processes;
+    std::vector<double> received(plane_size);
+    double * lower_ghost = density_buffer;
+    double * first_local = density_buffer + plane_size;
+    double * last_local = density_buffer + local_num_planes * plane_size;
+    double * upper_ghost = density_buffer + (local_num_planes + 1) * plane_size;
+    MPI_Sendrecv(lower_ghost, plane_size, MPI_DOUBLE, left, 0, received.data(), plane_size, MPI_DOUBLE, right, 0, comm, MPI_STATUS_IGNORE);
+    #pragma omp parallel for simd
+    for (size_t index = 0; index < plane_size; index++){
+        last_local[index] += received[index];
+    }
+    MPI_Sendrecv(upper_ghost, plane_size, MPI_DOUBLE, right, 1, received.data(), plane_size, MPI_DOUBLE, left, 1, comm, MPI_STATUS_IGNORE);
+    #pragma omp parallel for simd
+    for (size_t index = 0; index < plane_size; index++){
+        first_local[index] += received[index];
+    }
+}
+
+template <mass_assignment Scheme>
+void DistributedSimulation::deposit_particles(){
+    constexpr uint width = stencil_width<Scheme>();
+    const double * x = particle_collection.position[0].data();
+    const double * y = particle_collection.position[1].data();
+    const double * z = particle_collection.position[2].data();
+    double cell_width = (box_width/number_of_cells);
+    double single_density = particle_collection.mass / (cell_width * cell_width * cell_width);
+
+    // the plane binned deposit of Simulation over the local planes. The particles all lie in the slab, so a plane only writes to its neighbours
+    // in the padded slab and the colouring keeps concurrent planes apart, including the single process case where the slab wraps onto itself
+    bin_particles_by_plane(x, particle_collection.get_num_particles(), number_of_cells, local_first_plane, local_num_planes, plane_bins);
+    auto deposit_plane = [&](uint plane){
+        for (size_t n = plane_bins.offsets[plane]; n < plane_bins.offsets[plane + 1]; n++){
+            size_t particle_index = plane_bins.particles[n];
+            uint i[width], j[width], k[width];
+            double w_i[width], w_j[width], w_k[width];
+            assignment_weights<Scheme>(x[particle_index] * number_of_cells, number_of_cells, i, w_i);
+            assignment_weights<Scheme>(y[particle_index] * number_of_cells, number_of_cells, j, w_j);
+            assignment_weights<Scheme>(z[particle_index] * number_of_cells, number_of_cells, k, w_k);
+
+            for (uint a = 0; a < width; a++){
+                size_t plane_start = padded_plane(i[a]) * plane_size;
+                for (uint b = 0; b < width; b++){
+                    for (uint c = 0; c < width; c++){
+                        density_buffer[plane_start + k[c] + number_of_cells * j[b]] += single_density * w_i[a] * w_j[b] * w_k[c];
+                    }
+                }
+            }
+        }
+    };
+    for_each_plane_coloured<Scheme>(local_num_planes, deposit_plane);
+}
+
+void DistributedSimulation::forward_transform(){
+    uint half_cells = number_of_cells/2 + 1;
+    size_t row_length = 2 * half_cells; // doubles per y row of a plane spectrum
+    fftw_execute(plane_forward_plan);
+
+    // send every process the y rows it owns from each local plane
+    std::vector<int> counts(num_processes), displacements(num_processes);
+    int offset = 0;
+    for (int process = 0; process < num_processes; process++){
+        counts[process] = local_num_planes * num_planes[process] * row_length;
+        displacements[process] = offset;
+        offset += counts[process];
+    }
+    #pragma omp parallel for collapse(2)
+    for (int process = 0; process < num_processes; process++){
+        for (uint plane = 0; plane < local_num_planes; plane++){
+            size_t block_length = num_planes[process] * row_length;
+            const double * source = reinterpret_cast<const double *>(plane_spectra + plane * half_plane_size + first_plane[process] * half_cells);
+            std::memcpy(transpose_buffer.data() + displacements[process] + plane * block_length, source, sizeof(double) * block_length);
+        }
+    }
+    std::vector<int> receive_counts(num_processes), receive_displacements(num_processes);
+    offset = 0;
+    for (int process = 0; process < num_processes; process++){
+        receive_counts[process] = num_planes[process] * local_num_planes * row_length;
+        receive_displacements[process] = offset;
+        offset += receive_counts[process];
+    }
+    MPI_Alltoallv(transpose_buffer.data(), counts.data(), displacements.data(), MPI_DOUBLE,
+                  receive_buffer.data(), receive_counts.data(), receive_displacements.data(), MPI_DOUBLE, comm);
+
+    // each received block holds (x plane, y row, z frequency) of the sender's planes, stored with x contiguous for the 1D transforms
+    int n = number_of_cells;
+    #pragma omp parallel for collapse(2)
+    for (uint row = 0; row < local_num_planes; row++){
+        for (uint k = 0; k < half_cells; k++){
+            fftw_complex * column = column_spectra + (row * static_cast<size_t>(half_cells) + k) * n;
+            for (int process = 0; process < num_processes; process++){
+                const double * block = receive_buffer.data() + receive_displacements[process];
+                for (uint plane = 0; plane < num_planes[process]; plane++){
+                    const double * value = block + ((plane * local_num_planes + row) * half_cells + k) * 2;
+                    column[first_plane[process] + plane][0] = value[0];
+                    column[first_plane[process] + plane][1] = value[1];
+                }
+            }
+        }
+    }
+    fftw_execute(column_forward_plan);
+}
+
+void DistributedSimulation::backward_transform(){
+    uint half_cells = number_of_cells/2 + 1;
+    size_t row_length = 2 * half_cells;
+    fftw_execute(column_backward_plan);
+
+    // reverse of the forward transpose: every process gets back its x planes of each local y row
+    std::vector<int> counts(num_processes), displacements(num_processes);
+    int offset = 0;
+    for (int process = 0; process < num_processes; process++){
+        counts[process] = num_planes[process] * local_num_planes * row_length;
+        displacements[process] = offset;
+        offset += counts[process];
+    }
+    int n = number_of_cells;
+    #pragma omp parallel for collapse(2)
+    for (uint row = 0; row < local_num_planes; row++){
+        for (uint k = 0; k < half_cells; k++){
+            const fftw_complex * column = column_spectra + (row * static_cast<size_t>(half_cells) + k) * n;
+            for (int process = 0; process < num_processes; process++){
+                double * block = transpose_buffer.data() + displacements[process];
+                for (uint plane = 0; plane < num_planes[process]; plane++){
+                    double * value = block + ((plane * local_num_planes + row) * half_cells + k) * 2;
+                    value[0] = column[first_plane[process] + plane][0];
+                    value[1] = column[first_plane[process] + plane][1];
+                }
+            }
+        }
+    }
+    std::vector<int> receive_counts(num_processes), receive_displacements(num_processes);
+    offset = 0;
+    for (int process = 0; process < num_processes; process++){
+        receive_counts[process] = local_num_planes * num_planes[process] * row_length;
+        receive_displacements[process] = offset;
+        offset += receive_counts[process];
+    }
+    MPI_Alltoallv(transpose_buffer.data(), counts.data(), displacements.data(), MPI_DOUBLE,
+                  receive_buffer.data(), receive_counts.data(), receive_displacements.data(), MPI_DOUBLE, comm);
+
+    #pragma omp parallel for collapse(2)
+    for (int process = 0; process < num_processes; process++){
+        for (uint plane = 0; plane < local_num_planes; plane++){
+            size_t block_length = num_planes[process] * row_length;
+            double * destination = reinterpret_cast<double *>(plane_spectra + plane * half_plane_size + first_plane[process] * half_cells);
+            std::memcpy(destination, receive_buffer.data() + receive_displacements[process] + plane * block_length, sizeof(double) * block_length);
+        }
+    }
+    fftw_execute(plane_backward_plan);
+}
+
+void DistributedSimulation::fill_potential_buffer(){
+    forward_transform();
+
+    double width_squared = box_width * box_width;
+    size_t spectrum_length = green_table.size();
+    #pragma omp parallel for simd
+    for (size_t index = 0; index < spectrum_length; index++){
+        double factor = width_squared * green_table[index];
+        column_spectra[index][0] *= factor;
+        column_spectra[index][1] *= factor;
+    }
+
+    backward_transform();
+
+    // the gradient of the ghost planes needs two planes of the neighbouring slabs on either side
+    int left = (rank + num_processes - 1) % num_processes;
+    int right = (rank + 1) % num_processes;
+    size_t ghost_size = 2 * plane_size;
+    MPI_Sendrecv(potential_buffer + 2 * plane_size, ghost_size, MPI_DOUBLE, left, 2,
+                 potential_buffer + (local_num_planes + 2) * plane_size, ghost_size, MPI_DOUBLE, right, 2, comm, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(potential_buffer + local_num_planes * plane_size, ghost_size, MPI_DOUBLE, right, 3,
+                 potential_buffer, ghost_size, MPI_DOUBLE, left, 3, comm, MPI_STATUS_IGNORE);
+}
+
+void DistributedSimulation::calculate_gradient(){
+    double cell_width = box_width/number_of_cells;
+    double * gradient_x = gradient_buffer;
+    double * gradient_y = gradient_buffer + gradient_stride;
+    double * gradient_z = gradient_buffer + 2 * gradient_stride;
+    int n = number_of_cells;
+    int padded_planes = local_num_planes + 2;
+
+    #pragma omp parallel for collapse(2)
+    for (int p = 0; p < padded_planes; p++){
+        for (int j = 0; j < n; j++){
+            int j_high = j + 1 < n ? j + 1 : 0; // periodic neighbours within the plane
+            int j_low = j > 0 ? j - 1 : n - 1;
+
+            const double * plane = potential_buffer + (p + 1) * plane_size; // gradient plane p is potential plane p + 1
+            const double * row = plane + n * j;
+            const double * row_i_high = row + plane_size;
+            const double * row_i_low = row - plane_size;
+            const double * row_j_high = plane + n * j_high;
+            const double * row_j_low = plane + n * j_low;
+            size_t row_start = p * plane_size + n * j;
+
+            #pragma omp simd
+            for (int k = 0; k < n; k++){
+                gradient_x[row_start + k] = (row_i_high[k] - row_i_low[k])/(2 * cell_width);
+                gradient_y[row_start + k] = (row_j_high[k] - row_j_low[k])/(2 * cell_width);
+            }
+            for (int k = 0; k < n; k++){
+                int k_high = k + 1 < n ? k + 1 : 0;
+                int k_low = k > 0 ? k - 1 : n - 1;
+                gradient_z[row_start + k] = (row[k_high] - row[k_low])/(2 * cell_width);
+            }
+        }
+    }
+}
+
+void DistributedSimulation::update_particles(){
+    calculate_gradient();
+    switch (assignment_scheme){
+        case mass_assignment::NGP:
+            kick_drift_particles<mass_assignment::NGP, false>();
+            break;
+        case mass_assignment::CIC:
+            kick_drift_particles<mass_assignment::CIC, false>();
+            break;
+        case mass_assignment::TSC:
+            kick_drift_particles<mass_assignment::TSC, false>();
+            break;
+    }
+    exchange_particles();
+}
+
+void DistributedSimulation::update_particles_and_expand(){
+    calculate_gradient();
+    switch (assignment_scheme){
+        case mass_assignment::NGP:
+            kick_drift_particles<mass_assignment::NGP, true>();
+            break;
+        case mass_assignment::CIC:
+            kick_drift_particles<mass_assignment::CIC, true>();
+            break;
+        case mass_assignment::TSC:
+            kick_drift_particles<mass_assignment::TSC, true>();
+            break;
+    }
+    box_width *= expansion_factor;
+    exchange_particles(); // the velocities move with the particles, so dividing them before the exchange changes nothing
+}
+
+template <mass_assignment Scheme, bool Expand>
+void DistributedSimulation::kick_drift_particles(){
+    constexpr uint width = stencil_width<Scheme>();
+    const double * gradient_x = gradient_buffer;
+    const double * gradient_y = gradient_buffer + gradient_stride;
+    const double * gradient_z = gradient_buffer + 2 * gradient_stride;
+    double * x = particle_collection.position[0].data();
+    double * y = particle_collection.position[1].data();
+    double * z = particle_collection.position[2].data();
+    double * vx = particle_collection.velocity[0].data();
+    double * vy = particle_collection.velocity[1].data();
+    double * vz = particle_collection.velocity[2].data();
+    int escaped = 0; // set if a particle moved more than a box width in one step
+
+    #pragma omp parallel for simd reduction(|:escaped)
+    for (size_t index = 0; index < particle_collection.get_num_particles(); index++){
+        uint i[width], j[width], k[width];
+        double w_i[width], w_j[width], w_k[width];
+        assignment_weights<Scheme>(x[index] * number_of_cells, number_of_cells, i, w_i);
+        assignment_weights<Scheme>(y[index] * number_of_cells, number_of_cells, j, w_j);
+        assignment_weights<Scheme>(z[index] * number_of_cells, number_of_cells, k, w_k);
+
+        double grad_x = 0, grad_y = 0, grad_z = 0;
+        for (uint a = 0; a < width; a++){
+            size_t plane_start = padded_plane(i[a]) * plane_size;
+            for (uint b = 0; b < width; b++){
+                for (uint c = 0; c < width; c++){
+                    double weight = w_i[a] * w_j[b] * w_k[c];
+                    size_t cell_index = plane_start + k[c] + number_of_cells * j[b];
+                    grad_x += weight * gradient_x[cell_index];
+                    grad_y += weight * gradient_y[cell_index];
+                    grad_z += weight * gradient_z[cell_index];
+                }
+            }
+        }
+
+        vx[index] += -1 * grad_x * time_step;
+        vy[index] += -1 * grad_y * time_step;
+        vz[index] += -1 * grad_z * time_step;
+
+        x[index] += vx[index] * time_step;
+        y[index] += vy[index] * time_step;
+        z[index] += vz[index] * time_step;
+
+        if constexpr (Expand){
+            vx[index] /= expansion_factor;
+            vy[index] /= expansion_factor;
+            vz[index] /= expansion_factor;
+        }
+
+        // apply boundary conditions. Branch free selects give the same result as repeatedly adding or subtracting 1 for positions in [-1, 2)
+        x[index] = x[index] < 0 ? x[index] + 1 : x[index];
+        x[index] = x[index] >= 1 ? x[index] - 1 : x[index];
+        y[index] = y[index] < 0 ? y[index] + 1 : y[index];
+        y[index] = y[index] >= 1 ? y[index] - 1 : y[index];
+        z[index] = z[index] < 0 ? z[index] + 1 : z[index];
+        z[index] = z[index] >= 1 ? z[index] - 1 : z[index];
+        escaped |= (x[index] < 0) | (x[index] >= 1) | (y[index] < 0) | (y[index] >= 1) | (z[index] < 0) | (z[index] >= 1);
+    }
+
+    if (escaped){ // rare fall back for particles that crossed more than one box width
+        for (uint dim = 0; dim < 3; dim++){
+            double * coordinate = particle_collection.position[dim].data();
+            #pragma omp parallel for
+            for (size_t index = 0; index < particle_collection.get_num_particles(); index++){
+                while (coordinate[index] < 0){coordinate[index] += 1;}
+                while (coordinate[index] >= 1){coordinate[index] -= 1;}
+            }
+        }
+    }
+}
+
+void DistributedSimulation::exchange_particles(){
+    size_t num_particles = particle_collection.get_num_particles();
+    std::array<aligned_vector<double>, 3> &position = particle_collection.position;
+    std::array<aligned_vector<double>, 3> &velocity = particle_collection.velocity;
+
+    // particles are owned by the process of the x plane they lie in. Staying particles are compacted in place and the
+    // others packed by destination as (x, y, z, vx, vy, vz) records
+    std::vector<int> destination(num_particles);
+    std::vector<int> send_counts(num_processes, 0);
+    for (size_t index = 0; index < num_particles; index++){
+        uint plane = std::floor(position[0][index] * number_of_cells);
+        destination[index] = plane_owner[plane < number_of_cells ? plane : number_of_cells - 1];
+        if (destination[index] != rank){
+            send_counts[destination[index]] += 6;
+        }
+    }
+    std::vector<int> send_displacements(num_processes, 0);
+    for (int process = 1; process < num_processes; process++){
+        send_displacements[process] = send_displacements[process - 1] + send_counts[process - 1];
+    }
+    std::vector<double> send_buffer(send_displacements[num_processes - 1] + send_counts[num_processes - 1]);
+    std::vector<int> fill = send_displacements;
+    size_t kept = 0;
+    for (size_t index = 0; index < num_particles; index++){
+        if (destination[index] == rank){
+            for (uint dim = 0; dim < 3; dim++){
+                position[dim][kept] = position[dim][index];
+                velocity[dim][kept] = velocity[dim][index];
+            }
+            kept++;
+        }
+        else{
+            double * record = send_buffer.data() + fill[destination[index]];
+            for (uint dim = 0; dim < 3; dim++){
+                record[dim] = position[dim][index];
+                record[3 + dim] = velocity[dim][index];
+            }
+            fill[destination[index]] += 6;
+        }
+    }
+
+    std::vector<int> receive_counts(num_processes);
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, receive_counts.data(), 1, MPI_INT, comm);
+    std::vector<int> receive_displacements(num_processes, 0);
+    for (int process = 1; process < num_processes; process++){
+        receive_displacements[process] = receive_displacements[process - 1] + receive_counts[process - 1];
+    }
+    size_t received_values = receive_displacements[num_processes - 1] + receive_counts[num_processes - 1];
+    std::vector<double> received(received_values);
+    MPI_Alltoallv(send_buffer.data(), send_counts.data(), send_displacements.data(), MPI_DOUBLE,
+                  received.data(), receive_counts.data(), receive_displacements.data(), MPI_DOUBLE, comm);
+
+    size_t total = kept + received_values / 6;
+    for (uint dim = 0; dim < 3; dim++){
+        position[dim].resize(total);
+        velocity[dim].resize(total);
+    }
+    for (size_t n = 0; n < received_values / 6; n++){
+        for (uint dim = 0; dim < 3; dim++){
+            position[dim][kept + n] = received[6 * n + dim];
+            velocity[dim][kept + n] = received[6 * n + 3 + dim];
+        }
+    }
+}
+
+void DistributedSimulation::box_expansion(){
+    box_width *= expansion_factor;
+
+    double * vx = particle_collection.velocity[0].data();
+    double * vy = particle_collection.velocity[1].data();
+    double * vz = particle_collection.velocity[2].data();
+
+    #pragma omp parallel for simd
+    for (size_t i = 0; i < particle_collection.get_num_particles(); i++){
+        vx[i] /= expansion_factor;
+        vy[i] /= expansion_factor;
+        vz[i] /= expansion_factor;
+    }
+}
+
+std::vector<double> DistributedSimulation::gather_density(int root) const {
+    std::vector<double> density(rank == root ? plane_size * number_of_cells : 0);
+    std::vector<int> counts(num_processes), displacements(num_processes);
+    for (int process = 0; process < num_processes; process++){
+        counts[process] = num_planes[process] * plane_size;
+        displacements[process] = first_plane[process] * plane_size;
+    }
+    MPI_Gatherv(density_buffer + plane_size, local_num_planes * plane_size, MPI_DOUBLE, density.data(), counts.data(), displacements.data(), MPI_DOUBLE, root, comm);
+    return density;
+}
+
+const double * DistributedSimulation::get_density_slab() const {
+    return density_buffer + plane_size;
+}
+
+const double * DistributedSimulation::get_potential_slab() const {
+    return potential_buffer + 2 * plane_size;
+}
+
+const particle_group & DistributedSimulation::get_local_particles() const {
+    return particle_collection;
+}
+
+uint DistributedSimulation::get_local_first_plane() const {
+    return local_first_plane;
+}
+
+uint DistributedSimulation::get_local_num_planes() const {
+    return local_num_planes;
+}
+
+int DistributedSimulation::get_rank() const {
+    return rank;
+}
+
+int DistributedSimulation::get_num_processes() const {
+    return num_processes;
+}
@@ -0,0 +1,123 @@
+#include "FFTPlans.hpp"
+#include <map>
+#include <mutex>
+#include <utility>
+#include <filesystem>
+#include <iostream>
+#include <unistd.h>
+
+namespace {
+    std::mutex planner_mutex; // FFTW planner calls must not run concurrently
+
+    template <typename Real>
+    std::map<std::pair<uint, int>, std::shared_ptr<const BasicFFTPlans<Real>>> plan_cache;
+}
+
+template <typename Real>
+BasicFFTPlans<Real>::BasicFFTPlans(uint num_cells, int num_threads, std::optional<std::string> wisdom_folder) : 
+                    number_of_cells(num_cells), number_of_threads(num_threads)
+{
+    using fftw = fftw_traits<Real>;
+    initialise_threads();
+    fftw::plan_with_nthreads(number_of_threads);
+
+    std::string wisdom_file;
+    if (wisdom_folder){
+        wisdom_file = wisdom_filename(*wisdom_folder, number_of_cells, number_of_threads);
+        wisdom_imported = fftw::import_wisdom(wisdom_file.c_str()); // a missing file just means there is nothing to import
+    }
+
+    uint buffer_length = number_of_cells * number_of_cells * number_of_cells;
+    uint k_space_length = number_of_cells * number_of_cells * (number_of_cells/2 + 1);
+    Real * real_buffer = (Real *) fftw::malloc(sizeof(Real) * buffer_length);
+    complex * k_space_buffer = (complex *) fftw::malloc(sizeof(complex) * k_space_length);
+
+    forward_plan = fftw::plan_r2c(number_of_cells, real_buffer, k_space_buffer, FFTW_MEASURE);
+    backward_plan = fftw::plan_c2r(number_of_cells, k_space_buffer, real_buffer, FFTW_MEASURE);
+
+    fftw::free(real_buffer); // planning buffers are not needed once the plans exist
+    fftw::free(k_space_buffer);
+
+    if (wisdom_folder){
+        // write to a temporary file and rename so processes sharing the folder (e.g. MPI ranks) never read a partial file
+        std::filesystem::create_directories(*wisdom_folder);
+        std::string temporary_file = wisdom_file + ".tmp" + std::to_string(getpid());
+        if (fftw::export_wisdom(temporary_file.c_str())){
+            std::filesystem::rename(temporary_file, wisdom_file);
+        }
+        else{
+            std::cerr << "Warning - FFTW wisdom could not be saved to " << wisdom_file << std::endl;
+        }
+    }
+}
+
+template <typename Real>
+BasicFFTPlans<Real>::~BasicFFTPlans(){
+    std::unique_lock<std::mutex> lock = lock_planner();
+    fftw_traits<Real>::destroy_plan(forward_plan);
+    fftw_traits<Real>::destroy_plan(backward_plan);
+}
+
+template <typename Real>
+std::shared_ptr<const BasicFFTPlans<Real>> BasicFFTPlans<Real>::get_plans(uint num_cells, int num_threads, std::optional<std::string> wisdom_folder){
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    std::shared_ptr<const BasicFFTPlans> & plans = plan_cache<Real>[{num_cells, num_threads}];
+    if (!plans){
+        plans = std::make_shared<const BasicFFTPlans>(num_cells, num_threads, wisdom_folder);
+    }
+    return plans;
+}
+
+template <typename Real>
+void BasicFFTPlans<Real>::initialise_threads(){
+    static std::once_flag threads_initialised;
+    std::call_once(threads_initialised, [](){ fftw_traits<Real>::init_threads(); });
+}
+
+template <typename Real>
+std::unique_lock<std::mutex> BasicFFTPlans<Real>::lock_planner(){
+    return std::unique_lock<std::mutex>(planner_mutex);
+}
+
+template <typename Real>
+std::string BasicFFTPlans<Real>::wisdom_filename(const std::string & wisdom_folder, uint num_cells, int num_threads){
+    return wisdom_folder + "/" + fftw_traits<Real>::prefix + "_wisdom_num_cells_" + std::to_string(num_cells) + "_threads_" + std::to_string(num_threads) + ".wisdom";
+}
+
+template <typename Real>
+void BasicFFTPlans<Real>::clear_cache(){
+    std::map<std::pair<uint, int>, std::shared_ptr<const BasicFFTPlans<Real>>> cleared;
+    {
+        std::lock_guard<std::mutex> lock(planner_mutex);
+        cleared.swap(plan_cache<Real>);
+    } // the plans are destroyed after the lock is released, as their destructors take it
+
+}
+
+template <typename Real>
+void BasicFFTPlans<Real>::forward(Real * real_buffer, complex * k_space_buffer) const {
+    fftw_traits<Real>::execute_r2c(forward_plan, real_buffer, k_space_buffer);
+}
+
+template <typename Real>
+void BasicFFTPlans<Real>::backward(complex * k_space_buffer, Real * real_buffer) const {
+    fftw_traits<Real>::execute_c2r(backward_plan, k_space_buffer, real_buffer);
+}
+
+template <typename Real>
+uint BasicFFTPlans<Real>::get_num_cells() const {
+    return number_of_cells;
+}
+
+template <typename Real>
+int BasicFFTPlans<Real>::get_num_threads() const {
+    return number_of_threads;
+}
+
+template <typename Real>
+bool BasicFFTPlans<Real>::get_wisdom_imported() const {
+    return wisdom_imported;
+}
+
+template class BasicFFTPlans<double>;
+template class BasicFFTPlans<float>;
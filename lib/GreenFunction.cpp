@@ -0,0 +1,100 @@
+#include "GreenFunction.hpp"
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <stdexcept>
+
+namespace {
+    std::mutex table_mutex;
+    std::map<std::tuple<uint, green_kernel, mass_assignment, double>, std::shared_ptr<const GreenFunction>> table_cache;
+}
+
+GreenFunction::GreenFunction(uint num_cells, green_kernel kernel, mass_assignment scheme, double smoothing_cells) : 
+                                number_of_cells(num_cells), kernel_type(kernel), smoothing(smoothing_cells)
+{
+    if (kernel == green_kernel::gaussian && smoothing_cells <= 0){
+        throw std::invalid_argument("Error - smoothing_cells (gaussian kernel width) must be larger than 0!");
+    }
+    int n = number_of_cells;
+    int half_cells = n/2 + 1;
+    table.resize(static_cast<size_t>(n) * n * half_cells);
+
+    #pragma omp parallel for collapse(2)
+    for (int i = 0; i < n; i++){
+        for (int j = 0; j < n; j++){
+            int frequency_i = i <= n/2 ? i : i - n;
+            int frequency_j = j <= n/2 ? j : j - n;
+            size_t row_start = half_cells * (j + static_cast<size_t>(n) * i);
+            for (int k = 0; k < half_cells; k++){
+                table[row_start + k] = mode_value(frequency_i, frequency_j, k, number_of_cells, kernel, scheme, smoothing_cells);
+            }
+        }
+    }
+}
+
+double GreenFunction::mode_value(int frequency_i, int frequency_j, int frequency_k, uint num_cells, green_kernel kernel, mass_assignment scheme, double smoothing_cells){
+    int frequency_squared = frequency_i * frequency_i + frequency_j * frequency_j + frequency_k * frequency_k;
+    if (frequency_squared == 0){
+        return 0; // the mean density does not source a potential
+    }
+    double cell_num = num_cells; // cast to double
+    int n = num_cells;
+    // the solver scales by -4*pi/(i^2 + j^2 + k^2) of the transform indices i, j, k in [0, num_cells) and the normalisation factor 1/(8 num_cells^3).
+    // The complex-to-real transform assumes a Hermitian spectrum, so the factor of the mode is averaged with the one of its mirror (the indices
+    // of the negated frequencies), which reproduces the real part of the full complex-to-complex transform exactly
+    auto index_squared = [n](int i, int j, int k){
+        i = (i + n) % n;
+        j = (j + n) % n;
+        k = (k + n) % n;
+        return static_cast<double>(i) * i + static_cast<double>(j) * j + static_cast<double>(k) * k;
+    };
+    double factor = 0.5 * (1 / index_squared(frequency_i, frequency_j, frequency_k) + 1 / index_squared(-frequency_i, -frequency_j, -frequency_k))
+                    * -4 * M_PI * (1/(8 * cell_num * cell_num * cell_num)); // without the W^2
+    if (kernel == green_kernel::deconvolved){
+        double window = assignment_window(frequency_i, num_cells, scheme) * assignment_window(frequency_j, num_cells, scheme) * assignment_window(frequency_k, num_cells, scheme);
+        factor /= window * window;
+    }
+    else if (kernel == green_kernel::gaussian){
+        double smoothing_factor = 2 * M_PI * smoothing_cells / cell_num; // k s for a unit frequency
+        factor *= std::exp(-frequency_squared * smoothing_factor * smoothing_factor);
+    }
+    return factor;
+}
+
+std::shared_ptr<const GreenFunction> GreenFunction::get_table(uint num_cells, green_kernel kernel, mass_assignment scheme, double smoothing_cells){
+    // normalise arguments the kernel ignores so equivalent tables share one cache entry
+    if (kernel != green_kernel::deconvolved){
+        scheme = mass_assignment::NGP;
+    }
+    if (kernel != green_kernel::gaussian){
+        smoothing_cells = 0;
+    }
+    std::lock_guard<std::mutex> lock(table_mutex);
+    std::shared_ptr<const GreenFunction> & table = table_cache[{num_cells, kernel, scheme, smoothing_cells}];
+    if (!table){
+        table = std::make_shared<const GreenFunction>(num_cells, kernel, scheme, smoothing_cells);
+    }
+    return table;
+}
+
+void GreenFunction::clear_cache(){
+    std::lock_guard<std::mutex> lock(table_mutex);
+    table_cache.clear();
+}
+
+const double * GreenFunction::data() const {
+    return table.data();
+}
+
+uint GreenFunction::get_num_cells() const {
+    return number_of_cells;
+}
+
+green_kernel GreenFunction::get_kernel() const {
+    return kernel_type;
+}
+
+double GreenFunction::get_smoothing_cells() const {
+    return smoothing;
+}
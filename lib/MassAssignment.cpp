@@ -0,0 +1,76 @@
+#include "MassAssignment.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <omp.h>
+
+mass_assignment mass_assignment_from_string(const std::string &name){
+    std::string upper_name = name;
+    std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), ::toupper);
+    if (upper_name == "NGP"){
+        return mass_assignment::NGP;
+    }
+    if (upper_name == "CIC"){
+        return mass_assignment::CIC;
+    }
+    if (upper_name == "TSC"){
+        return mass_assignment::TSC;
+    }
+    throw std::invalid_argument("Error - Unknown mass assignment scheme " + name + "! Use NGP, CIC or TSC.");
+}
+
+std::string mass_assignment_to_string(mass_assignment scheme){
+    switch (scheme){
+        case mass_assignment::NGP:
+            return "NGP";
+        case mass_assignment::CIC:
+            return "CIC";
+        default:
+            return "TSC";
+    }
+}
+
+template <typename Real>
+void bin_particles_by_plane(const Real * x, size_t num_particles, uint num_cells, uint first_plane, uint num_planes, PlaneBins &bins){
+    int max_threads = omp_get_max_threads();
+    bins.particles.resize(num_particles);
+    bins.offsets.resize(num_planes + 1);
+    bins.counts.assign(max_threads * num_planes, 0);
+    auto local_plane = [&](size_t index) -> uint {
+        uint plane = std::floor(x[index] * num_cells);
+        plane = (plane < num_cells ? plane : num_cells - 1) - first_plane;
+        return plane < num_planes ? plane : num_planes - 1;
+    };
+
+    #pragma omp parallel num_threads(max_threads)
+    {
+        size_t * counts = bins.counts.data() + omp_get_thread_num() * num_planes;
+        // both loops use the same static schedule so each thread sees the same contiguous chunk of particles
+        #pragma omp for schedule(static)
+        for (size_t index = 0; index < num_particles; index++){
+            counts[local_plane(index)]++;
+        }
+
+        #pragma omp single
+        { // exclusive prefix sum over planes then threads keeps the particles of every plane in their original order
+            size_t offset = 0;
+            for (uint plane = 0; plane < num_planes; plane++){
+                bins.offsets[plane] = offset;
+                for (int thread = 0; thread < max_threads; thread++){
+                    size_t count = bins.counts[thread * num_planes + plane];
+                    bins.counts[thread * num_planes + plane] = offset;
+                    offset += count;
+                }
+            }
+            bins.offsets[num_planes] = offset;
+        }
+
+        #pragma omp for schedule(static)
+        for (size_t index = 0; index < num_particles; index++){
+            bins.particles[counts[local_plane(index)]++] = index;
+        }
+    }
+}
+
+template void bin_particles_by_plane(const double * x, size_t num_particles, uint num_cells, uint first_plane, uint num_planes, PlaneBins &bins);
+template void bin_particles_by_plane(const float * x, size_t num_particles, uint num_cells, uint first_plane, uint num_planes, PlaneBins &bins);
@@ -0,0 +1,218 @@
+#include "OutputSchedule.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    /**
+     * @brief: True if value has been reached, allowing for the rounding of a time accumulated over many steps.
+    */
+    bool reached(double value, double requested){
+        return value >= requested - 1e-9 * std::max(1.0, std::abs(requested));
+    }
+
+    std::vector<std::string> split(const std::string &text, char separator){
+        std::vector<std::string> parts;
+        std::stringstream stream(text);
+        std::string part;
+        while (std::getline(stream, part, separator)){
+            parts.push_back(part);
+        }
+        return parts;
+    }
+
+    std::vector<double> parse_values(const std::string &text){
+        std::vector<double> values;
+        for (const std::string &part : split(text, ',')){
+            size_t parsed = 0;
+            double value = std::stod(part, &parsed);
+            if (parsed != part.size()){
+                throw std::invalid_argument("Error - Invalid output trigger value " + part + "!");
+            }
+            values.push_back(value);
+        }
+        return values;
+    }
+
+    std::vector<double> sorted(std::vector<double> values){
+        std::sort(values.begin(), values.end());
+        return values;
+    }
+}
+
+output_type output_type_from_string(const std::string &name){
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c){ return std::tolower(c); });
+    if (lower == "projection"){
+        return output_type::projection;
+    }
+    if (lower == "density"){
+        return output_type::density;
+    }
+    if (lower == "particles"){
+        return output_type::particles;
+    }
+    if (lower == "power_spectrum"){
+        return output_type::power_spectrum;
+    }
+    throw std::invalid_argument("Error - Output type must be projection, density, particles or power_spectrum, not " + name + "!");
+}
+
+std::string output_type_to_string(output_type type){
+    switch (type){
+        case output_type::projection:
+            return "projection";
+        case output_type::density:
+            return "density";
+        case output_type::particles:
+            return "particles";
+        case output_type::power_spectrum:
+            return "power_spectrum";
+    }
+    return "";
+}
+
+OutputSchedule OutputSchedule::projection_every(uint interval_steps){
+    OutputSchedule schedule;
+    schedule.every_steps(interval_steps, {output_type::projection});
+    return schedule;
+}
+
+void OutputSchedule::every_steps(uint interval_steps, std::vector<output_type> outputs){
+    if (interval_steps == 0){
+        throw std::invalid_argument("Error - interval_steps (output interval) must be larger than 0!");
+    }
+    triggers.push_back({trigger_kind::every_steps, interval_steps, {}, 0, std::move(outputs)});
+}
+
+void OutputSchedule::at_times(std::vector<double> times, std::vector<output_type> outputs){
+    triggers.push_back({trigger_kind::at_times, 0, sorted(std::move(times)), 0, std::move(outputs)});
+}
+
+void OutputSchedule::at_expansions(std::vector<double> expansions, std::vector<output_type> outputs){
+    for (double expansion : expansions){
+        if (expansion <= 0){
+            throw std::invalid_argument("Error - Output expansions must be larger than 0!");
+        }
+    }
+    triggers.push_back({trigger_kind::at_expansions, 0, sorted(std::move(expansions)), 0, std::move(outputs)});
+}
+
+void OutputSchedule::at_end(std::vector<output_type> outputs){
+    triggers.push_back({trigger_kind::at_end, 0, {}, 0, std::move(outputs)});
+}
+
+void OutputSchedule::add_trigger(const std::string &description){
+    std::vector<std::string> parts = split(description, ':');
+    bool has_values = !parts.empty() && parts[0] != "end";
+    if (parts.size() != (has_values ? 3u : 2u)){
+        throw std::invalid_argument("Error - Output trigger " + description + " must be every:<steps>:<outputs>, times:<times>:<outputs>, expansions:<expansions>:<outputs> or end:<outputs>!");
+    }
+    std::vector<output_type> outputs;
+    for (const std::string &name : split(parts.back(), ',')){
+        outputs.push_back(output_type_from_string(name));
+    }
+    try{
+        if (parts[0] == "every"){
+            size_t parsed = 0;
+            int interval = std::stoi(parts[1], &parsed);
+            if (parsed != parts[1].size() || interval <= 0){
+                throw std::invalid_argument("Error - Output interval must be a positive number of steps!");
+            }
+            every_steps(interval, std::move(outputs));
+        }
+        else if (parts[0] == "times"){
+            at_times(parse_values(parts[1]), std::move(outputs));
+        }
+        else if (parts[0] == "expansions"){
+            at_expansions(parse_values(parts[1]), std::move(outputs));
+        }
+        else if (parts[0] == "end"){
+            at_end(std::move(outputs));
+        }
+        else{
+            throw std::invalid_argument("Error - Unknown output trigger " + parts[0] + "!");
+        }
+    }
+    catch (const std::out_of_range &e){
+        throw std::invalid_argument("Error - Output trigger " + description + " has a value out of range!");
+    }
+}
+
+void OutputSchedule::start(double time, double expansion){
+    for (Trigger &trigger : triggers){
+        double current = trigger.kind == trigger_kind::at_times ? time : expansion;
+        if (trigger.kind == trigger_kind::at_times || trigger.kind == trigger_kind::at_expansions){
+            trigger.next_value = 0;
+            while (trigger.next_value < trigger.values.size() && reached(current, trigger.values[trigger.next_value])){
+                trigger.next_value++;
+            }
+        }
+    }
+}
+
+std::vector<output_type> OutputSchedule::due(uint64_t step, double time, double expansion, bool last_step){
+    bool fired[4] = {false, false, false, false};
+    for (Trigger &trigger : triggers){
+        bool fires = false;
+        switch (trigger.kind){
+            case trigger_kind::every_steps:
+                fires = step % trigger.interval_steps == 0;
+                break;
+            case trigger_kind::at_times:
+            case trigger_kind::at_expansions: {
+                double current = trigger.kind == trigger_kind::at_times ? time : expansion;
+                while (trigger.next_value < trigger.values.size() && reached(current, trigger.values[trigger.next_value])){
+                    fires = true; // values passed in one step fire once
+                    trigger.next_value++;
+                }
+                break;
+            }
+            case trigger_kind::at_end:
+                fires = last_step;
+                break;
+        }
+        if (fires){
+            for (output_type output : trigger.outputs){
+                fired[static_cast<int>(output)] = true;
+            }
+        }
+    }
+    std::vector<output_type> outputs;
+    for (output_type output : {output_type::projection, output_type::density, output_type::particles, output_type::power_spectrum}){
+        if (fired[static_cast<int>(output)]){
+            outputs.push_back(output);
+        }
+    }
+    return outputs;
+}
+
+double OutputSchedule::next_time(double time) const {
+    double next = -1;
+    for (const Trigger &trigger : triggers){
+        if (trigger.kind != trigger_kind::at_times){
+            continue;
+        }
+        for (size_t index = trigger.next_value; index < trigger.values.size(); index++){
+            if (trigger.values[index] > time && !reached(time, trigger.values[index])){
+                next = next < 0 ? trigger.values[index] : std::min(next, trigger.values[index]);
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+bool OutputSchedule::empty() const {
+    for (const Trigger &trigger : triggers){
+        if (trigger.kind == trigger_kind::every_steps || trigger.kind == trigger_kind::at_end || trigger.next_value < trigger.values.size()){
+            if (!trigger.outputs.empty()){
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,95 @@
+#include "OutputWriter.hpp"
+#include <utility>
+
+OutputWriter::OutputWriter(size_t max_pending) : max_pending(max_pending)
+{
+    if (max_pending > 0){
+        writer_thread = std::thread(&OutputWriter::write_tasks, this);
+    }
+}
+
+OutputWriter::~OutputWriter(){
+    if (writer_thread.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_changed.notify_all();
+        writer_thread.join();
+    }
+}
+
+void OutputWriter::submit(std::function<void()> task){
+    if (max_pending == 0){
+        rethrow_error();
+        try{
+            task();
+        }
+        catch (...){ // reported by the next submit or flush, as for the writer thread
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            error = std::current_exception();
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    queue_changed.wait(lock, [this](){ return tasks.size() < max_pending || error; });
+    if (error){
+        std::exception_ptr task_error = std::exchange(error, nullptr);
+        tasks.clear();
+        std::rethrow_exception(task_error);
+    }
+    tasks.push_back(std::move(task));
+    lock.unlock();
+    queue_changed.notify_all();
+}
+
+void OutputWriter::flush(){
+    if (max_pending > 0){
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        queue_changed.wait(lock, [this](){ return (tasks.empty() && !writing) || error; });
+        tasks.clear();
+    }
+    rethrow_error();
+}
+
+size_t OutputWriter::get_max_pending() const {
+    return max_pending;
+}
+
+void OutputWriter::rethrow_error(){
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if (error){
+        std::rethrow_exception(std::exchange(error, nullptr));
+    }
+}
+
+void OutputWriter::write_tasks(){
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true){
+        queue_changed.wait(lock, [this](){ return !tasks.empty() || stopping; });
+        if (tasks.empty()){ // only reached when stopping with nothing left to write
+            return;
+        }
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        writing = true;
+        lock.unlock();
+        queue_changed.notify_all(); // there is space in the queue again
+
+        std::exception_ptr task_error;
+        try{
+            task();
+        }
+        catch (...){
+            task_error = std::current_exception();
+        }
+
+        lock.lock();
+        writing = false;
+        if (task_error && !error){
+            error = task_error;
+            tasks.clear(); // later output would be inconsistent with the failed one
+        }
+        queue_changed.notify_all();
+    }
+}
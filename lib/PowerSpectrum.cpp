@@ -0,0 +1,177 @@
+#include "PowerSpectrum.hpp"
+#include "FFTPlans.hpp"
+#include "Utils.hpp"
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <omp.h>
+
+namespace {
+    template <typename Real>
+    PowerSpectrum bin_power_spectrum(const Real (*density_spectrum)[2], uint num_cells, double box_width, size_t num_particles,
+                                     mass_assignment scheme, const PowerSpectrumOptions &options)
+    {
+        if (options.num_bins <= 0){
+            throw std::invalid_argument("Error - The power spectrum requires a positive number of bins!");
+        }
+        int n = num_cells;
+        int half_cells = n/2 + 1;
+        int num_bins = options.num_bins;
+        double bin_width = 0.5 * n / num_bins; // in units of the fundamental frequency, up to the Nyquist frequency
+        double volume = box_width * box_width * box_width;
+        double mean_mode = density_spectrum[0][0]; // sum of the density, N^3 times its mean
+        if (mean_mode <= 0){
+            throw std::invalid_argument("Error - The power spectrum requires a positive mean density!");
+        }
+        double normalisation = volume / (mean_mode * mean_mode); // P = V |delta_k|^2 / N_cells^2 with delta_k = F_k / mean density
+        double shot_noise = options.subtract_shot_noise && num_particles > 0 ? volume / num_particles : 0;
+
+        int max_threads = omp_get_max_threads();
+        std::vector<double> thread_frequency(max_threads * num_bins, 0.0), thread_power(max_threads * num_bins, 0.0);
+        std::vector<uint64_t> thread_modes(max_threads * num_bins, 0);
+
+        #pragma omp parallel num_threads(max_threads)
+        {
+            size_t offset = omp_get_thread_num() * static_cast<size_t>(num_bins);
+            double * frequency_sum = thread_frequency.data() + offset;
+            double * power_sum = thread_power.data() + offset;
+            uint64_t * modes = thread_modes.data() + offset;
+
+            #pragma omp for schedule(static)
+            for (int i = 0; i < n; i++){
+                int frequency_i = i <= n/2 ? i : i - n;
+                double window_i = assignment_window(frequency_i, num_cells, scheme);
+                for (int j = 0; j < n; j++){
+                    int frequency_j = j <= n/2 ? j : j - n;
+                    double window_ij = window_i * assignment_window(frequency_j, num_cells, scheme);
+                    const Real (*row)[2] = density_spectrum + half_cells * (j + static_cast<size_t>(n) * i);
+                    for (int k = 0; k < half_cells; k++){
+                        double frequency = std::sqrt(static_cast<double>(frequency_i * frequency_i + frequency_j * frequency_j + k * k));
+                        int bin = frequency / bin_width;
+                        if (frequency == 0 || bin >= num_bins){
+                            continue;
+                        }
+                        double real = row[k][0], imaginary = row[k][1]; // squared in double precision for float spectra too
+                        double power = normalisation * (real * real + imaginary * imaginary);
+                        if (options.deconvolve_window){
+                            double window_ijk = window_ij * assignment_window(k, num_cells, scheme);
+                            power /= window_ijk * window_ijk;
+                        }
+                        // the half spectrum stores each conjugate pair once, except on the k = 0 and Nyquist planes that hold both
+                        uint multiplicity = (k == 0 || 2 * k == n) ? 1 : 2;
+                        frequency_sum[bin] += multiplicity * frequency;
+                        power_sum[bin] += multiplicity * power;
+                        modes[bin] += multiplicity;
+                    }
+                }
+            }
+        }
+
+        PowerSpectrum spectrum;
+        spectrum.k.assign(num_bins, 0.0);
+        spectrum.power.assign(num_bins, 0.0);
+        spectrum.num_modes.assign(num_bins, 0);
+        std::vector<double> frequency_sum(num_bins, 0.0);
+        for (int thread = 0; thread < max_threads; thread++){
+            for (int bin = 0; bin < num_bins; bin++){
+                frequency_sum[bin] += thread_frequency[thread * num_bins + bin];
+                spectrum.power[bin] += thread_power[thread * num_bins + bin];
+                spectrum.num_modes[bin] += thread_modes[thread * num_bins + bin];
+            }
+        }
+        double fundamental_wavenumber = 2 * M_PI / box_width;
+        for (int bin = 0; bin < num_bins; bin++){
+            if (spectrum.num_modes[bin] == 0){
+                spectrum.k[bin] = fundamental_wavenumber * (bin + 0.5) * bin_width;
+                continue;
+            }
+            spectrum.k[bin] = fundamental_wavenumber * frequency_sum[bin] / spectrum.num_modes[bin];
+            spectrum.power[bin] = spectrum.power[bin] / spectrum.num_modes[bin] - shot_noise;
+        }
+        return spectrum;
+    }
+}
+
+PowerSpectrum binPowerSpectrum(const fftw_complex * density_spectrum, uint num_cells, double box_width, size_t num_particles,
+                               mass_assignment scheme, const PowerSpectrumOptions &options)
+{
+    return bin_power_spectrum(density_spectrum, num_cells, box_width, num_particles, scheme, options);
+}
+
+PowerSpectrum binPowerSpectrum(const fftwf_complex * density_spectrum, uint num_cells, double box_width, size_t num_particles,
+                               mass_assignment scheme, const PowerSpectrumOptions &options)
+{
+    return bin_power_spectrum(density_spectrum, num_cells, box_width, num_particles, scheme, options);
+}
+
+PowerSpectrum powerSpectrum(particle_view particles, uint num_cells, double box_width, mass_assignment scheme, const PowerSpectrumOptions &options)
+{
+    if (num_cells == 0){
+        throw std::invalid_argument("Error - The power spectrum requires a positive number of cells!");
+    }
+    size_t buffer_length = static_cast<size_t>(num_cells) * num_cells * num_cells;
+    size_t k_space_length = static_cast<size_t>(num_cells) * num_cells * (num_cells/2 + 1);
+    double * density = (double *) fftw_malloc(sizeof(double) * buffer_length);
+    fftw_complex * spectrum = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * k_space_length);
+    std::memset(density, 0, sizeof(double) * buffer_length);
+
+    // the normalisation only depends on the density relative to its mean, so the weights are deposited without the particle mass
+    auto deposit = [&](auto scheme_constant){
+        constexpr mass_assignment Scheme = decltype(scheme_constant)::value;
+        constexpr uint width = stencil_width<Scheme>();
+        #pragma omp parallel for
+        for (size_t index = 0; index < particles.num_particles; index++){
+            uint i[width], j[width], k[width];
+            double w_i[width], w_j[width], w_k[width];
+            assignment_weights<Scheme>(particles.position[0][index] * num_cells, num_cells, i, w_i);
+            assignment_weights<Scheme>(particles.position[1][index] * num_cells, num_cells, j, w_j);
+            assignment_weights<Scheme>(particles.position[2][index] * num_cells, num_cells, k, w_k);
+            for (uint a = 0; a < width; a++){
+                for (uint b = 0; b < width; b++){
+                    for (uint c = 0; c < width; c++){
+                        #pragma omp atomic
+                        density[k[c] + num_cells * (j[b] + static_cast<size_t>(num_cells) * i[a])] += w_i[a] * w_j[b] * w_k[c];
+                    }
+                }
+            }
+        }
+    };
+    switch (scheme){
+        case mass_assignment::NGP:
+            deposit(std::integral_constant<mass_assignment, mass_assignment::NGP>());
+            break;
+        case mass_assignment::CIC:
+            deposit(std::integral_constant<mass_assignment, mass_assignment::CIC>());
+            break;
+        case mass_assignment::TSC:
+            deposit(std::integral_constant<mass_assignment, mass_assignment::TSC>());
+            break;
+    }
+
+    FFTPlans::get_plans(num_cells, omp_get_max_threads())->forward(density, spectrum);
+    PowerSpectrum result;
+    try{
+        result = binPowerSpectrum(spectrum, num_cells, box_width, particles.num_particles, scheme, options);
+    }
+    catch (...){
+        fftw_free(density);
+        fftw_free(spectrum);
+        throw;
+    }
+    fftw_free(density);
+    fftw_free(spectrum);
+    return result;
+}
+
+void Save_PowerSpectrum_csv(const PowerSpectrum &spectrum, const std::string &filename){
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open the file.");
+    }
+    Append_csv_row(file, {"k", "power", "modes"}, {});
+    for (size_t bin = 0; bin < spectrum.k.size(); bin++){
+        Append_csv_row(file, {}, {spectrum.k[bin], spectrum.power[bin], static_cast<double>(spectrum.num_modes[bin])});
+    }
+}
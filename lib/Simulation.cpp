@@ -1,15 +1,24 @@
 #include "Simulation.hpp"
+#include "FFTPlans.hpp"
+#include "GreenFunction.hpp"
+#include "Checkpoint.hpp"
+#include "OutputWriter.hpp"
 #include "Utils.hpp"
 #include "particle.hpp"
 #include <cstring>
+#include <cctype>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <omp.h>
 #include <filesystem>
+#include <utility>
 
-Simulation::Simulation(double t_max, double t_step, particle_group collection, double W, uint num_cells, double e_factor) : 
-                        time_max(t_max), time_step(t_step), particle_collection(collection), box_width(W), number_of_cells(num_cells),
-                         expansion_factor(e_factor)
+template <typename Real, typename DensityReal>
+BasicSimulation<Real, DensityReal>::BasicSimulation(double t_max, double t_step, basic_particle_group<Real> collection, double W, uint num_cells, double e_factor, 
+                       mass_assignment scheme, std::optional<std::string> wisdom_folder) : 
+                        time_max(t_max), time_step(t_step), particle_collection(std::move(collection)), box_width(W), number_of_cells(num_cells),
+                         expansion_factor(e_factor), assignment_scheme(scheme)
 {
     if (t_max <= 0){
         throw std::invalid_argument("Error - t_max (maximum time reached) must not be less than or equal to 0!");
@@ -32,188 +41,849 @@ Simulation::Simulation(double t_max, double t_step, particle_group collection, d
     if (num_cells > 400){
         std::cerr << "Warning - num_cells (Grid Length) has been set to more than 400 units! This may have adverse effects on performance." << std::endl;
     }
-    // allocate and instantiate density buffer
+    // allocate and instantiate density buffer. The density and potential are purely real so only the non-negative half of the
+    // last k-space dimension needs to be stored (real-to-complex transform).
     uint buffer_length = number_of_cells * number_of_cells * number_of_cells;
-    density_buffer = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * buffer_length);
-    potential_buffer = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * buffer_length);
-    k_space_buffer = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * buffer_length);
+    uint k_space_length = number_of_cells * number_of_cells * (number_of_cells/2 + 1);
+    using fftw = fftw_traits<Real>;
+    density_buffer = (DensityReal *) fftw_traits<DensityReal>::malloc(sizeof(DensityReal) * buffer_length);
+    potential_buffer = (Real *) fftw::malloc(sizeof(Real) * buffer_length);
+    k_space_buffer = (complex *) fftw::malloc(sizeof(complex) * k_space_length);
+    constexpr size_t line_length = 64 / sizeof(Real);
+    gradient_stride = (static_cast<size_t>(buffer_length) + line_length - 1) / line_length * line_length; // keep every component 64 byte aligned
+    gradient_buffer = (Real *) fftw::malloc(sizeof(Real) * 3 * gradient_stride);
 
-    // Efficiently zero-initialize the buffers
-    std::memset(density_buffer, 0, sizeof(fftw_complex) * buffer_length);
-    std::memset(potential_buffer, 0, sizeof(fftw_complex) * buffer_length);
-    std::memset(k_space_buffer, 0, sizeof(fftw_complex) * buffer_length);
+    // assign plans. Multithreaded plans for this grid size, thread count and precision are shared between Simulation instances.
+    fft_plans = BasicFFTPlans<Real>::get_plans(number_of_cells, omp_get_max_threads(), wisdom_folder);
+    green_function = GreenFunction::get_table(number_of_cells);
 
-    // assign plans
-    forward_plan = fftw_plan_dft_3d(number_of_cells, number_of_cells, number_of_cells, density_buffer, k_space_buffer, FFTW_FORWARD, FFTW_MEASURE);
-    backward_plan = fftw_plan_dft_3d(number_of_cells, number_of_cells, number_of_cells, k_space_buffer, potential_buffer, FFTW_BACKWARD, FFTW_MEASURE);
+    // Efficiently zero-initialize the buffers
+    std::memset(density_buffer, 0, sizeof(DensityReal) * buffer_length);
+    std::memset(potential_buffer, 0, sizeof(Real) * buffer_length);
+    std::memset(k_space_buffer, 0, sizeof(complex) * k_space_length);
+    std::memset(gradient_buffer, 0, sizeof(Real) * 3 * gradient_stride);
 }
 
 
-Simulation::~Simulation(){
-    fftw_free(density_buffer); // deallocate manually allocated memory in heap to prevent memory leak
-    fftw_free(potential_buffer);
-    fftw_free(k_space_buffer);
-
-    fftw_destroy_plan(forward_plan);
-    fftw_destroy_plan(backward_plan);
+template <typename Real, typename DensityReal>
+BasicSimulation<Real, DensityReal>::~BasicSimulation(){
+    fftw_traits<DensityReal>::free(density_buffer); // deallocate manually allocated memory in heap to prevent memory leak
+    fftw_traits<Real>::free(potential_buffer);
+    fftw_traits<Real>::free(k_space_buffer);
+    fftw_traits<Real>::free(gradient_buffer);
+    fftw_traits<Real>::free(gradient_k_buffer);
 }
 
-void Simulation::run(std::optional<std::string> output_folder)
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::run(std::optional<std::string> output_folder)
 {
-    std::string ppc = findsigfig(static_cast<double>(particle_collection.get_num_particles())/static_cast<double>(number_of_cells * number_of_cells * number_of_cells));
+    bool leapfrog = time_integrator == integrator::leapfrog_kdk;
+    // the leapfrog expands the box per time step of elapsed time, as its steps vary
+    auto cumulative_expansion = [&](uint64_t step, double time){
+        return leapfrog ? std::pow(expansion_factor, time / time_step) : std::pow(expansion_factor, static_cast<double>(step));
+    };
+    output_schedule.start(current_time, cumulative_expansion(step_count, current_time));
+    // names only differ by time, so everything else is formatted once per run, and not at all when nothing is scheduled
+    std::string partial_path, name_prefix, name_suffix;
+    if (output_folder && !output_schedule.empty()){
+        std::string ppc = findsigfig(static_cast<double>(particle_collection.get_num_particles())/static_cast<double>(number_of_cells * number_of_cells * number_of_cells));
+        partial_path = *output_folder + "/" + findsigfig(expansion_factor) + "/"; // directories to be stored
+        name_prefix = partial_path + "UniverseSim_dt_" + findsigfig(time_step) + "_time_";
+        name_suffix = "_num_cells_" + std::to_string(number_of_cells) + "_ppc_" + ppc;
+    }
+    bool directories_created = false;
+    bool forces_current = false; // set while the gradient buffer holds the force at the current positions
     
-    double t = 0.0;
-    uint counter = 0;
-    while (t < time_max){
-        fill_density_buffer();
-        fill_potential_buffer();
-        update_particles();
-        box_expansion();
-        t += time_step;
+    // images, snapshots and checkpoints are written in submission order on the writer thread while the steps continue
+    OutputWriter writer(output_queue_length);
+    while (current_time < time_max){
+        if (leapfrog && !forces_current){
+            // only the first step of a run, later steps reuse the force of the closing half kick. It is evaluated before sorting, in the order
+            // the particles had when that force would have been evaluated, so a run continued from a checkpoint stays bit-identical
+            compute_forces();
+            Real max_speed_squared = 0;
+            const Real * vx = particle_collection.velocity[0].data();
+            const Real * vy = particle_collection.velocity[1].data();
+            const Real * vz = particle_collection.velocity[2].data();
+            #pragma omp parallel for simd reduction(max:max_speed_squared)
+            for (size_t index = 0; index < particle_collection.get_num_particles(); index++){
+                max_speed_squared = std::max(max_speed_squared, vx[index] * vx[index] + vy[index] * vy[index] + vz[index] * vz[index]);
+            }
+            max_speed = std::sqrt(max_speed_squared);
+            forces_current = true;
+        }
+        if (sort_interval > 0 && step_count % sort_interval == 0){
+            sort_particles(); // the gradient is stored per cell, so it stays valid for the reordered particles
+        }
+        double step_time = time_step;
+        double next_time = current_time + time_step;
+        if (leapfrog){
+            step_time = adaptive_time_step(output_schedule.next_time(current_time), next_time);
+        }
+        // the schedule is asked before the step, with the values the step will end at, so a power spectrum due after it can be binned from its transform
+        // a schedule whose triggers are used up, or which has none, is not asked at all
+        std::vector<output_type> outputs;
+        if (!output_schedule.empty()){
+            outputs = output_schedule.due(step_count + 1, next_time, cumulative_expansion(step_count + 1, next_time), next_time >= time_max);
+        }
+        bool needs_power_spectrum = std::find(outputs.begin(), outputs.end(), output_type::power_spectrum) != outputs.end();
+        if (needs_power_spectrum){
+            request_power_spectrum();
+        }
+
+        if (leapfrog){
+            dispatch_kick_drift<true, false>(0.5 * step_time, step_time); // opening half kick and drift
+            double expansion = std::pow(expansion_factor, step_time / time_step);
+            box_width *= expansion;
+            if (particle_velocity_frame == velocity_frame::comoving){
+                velocity_scale *= expansion;
+            }
+            else{
+                Real velocity_expansion = expansion;
+                Real * vx = particle_collection.velocity[0].data();
+                Real * vy = particle_collection.velocity[1].data();
+                Real * vz = particle_collection.velocity[2].data();
+                #pragma omp parallel for simd
+                for (size_t index = 0; index < particle_collection.get_num_particles(); index++){
+                    vx[index] /= velocity_expansion;
+                    vy[index] /= velocity_expansion;
+                    vz[index] /= velocity_expansion;
+                }
+            }
+            compute_forces(); // at the drifted positions in the expanded box
+            dispatch_kick_drift<false, false>(0.5 * step_time, 0); // closing half kick, which also measures the speed for the next step
+        }
+        else{
+            fill_density_buffer();
+            fill_potential_buffer();
+            update_particles_and_expand();
+        }
+        current_time = next_time;
+        step_count++;
         
-        if (output_folder){
-            counter++;
-            if (counter >= 10){
-                counter = 0;
-                std::string partial_path = *output_folder + "/" + findsigfig(expansion_factor) + "/"; // directories to be stored
+        if (output_folder && !outputs.empty()){
+            if (!directories_created){
                 std::filesystem::create_directories(partial_path);
-                std::string full_path = partial_path + "UniverseSim_dt_" + findsigfig(time_step) + "_time_" + 
-                findsigfig(t) + "_num_cells_" + std::to_string(number_of_cells) + "_ppc_" + ppc + ".pbm";
-                SaveToFile(density_buffer, number_of_cells, full_path);
+                directories_created = true;
+            }
+            std::string full_path = name_prefix + findsigfig(current_time) + name_suffix;
+            PowerSpectrum spectrum = needs_power_spectrum ? *measured_power_spectrum : PowerSpectrum();
+            bool needs_particles = std::find(outputs.begin(), outputs.end(), output_type::particles) != outputs.end();
+            auto write_output = [outputs, full_path, num_cells = number_of_cells, time = current_time, width = box_width, spectrum = std::move(spectrum),
+                                 format = image_output_format, compression = snapshot_format, scale = velocity_scale,
+                                 ids = needs_particles ? particle_ids : std::vector<uint64_t>()](const double * density, const particle_group & particles){
+                for (output_type output : outputs){
+                    switch (output){
+                        case output_type::projection:
+                            SaveToFile(density, num_cells, full_path + ".ppm", format);
+                            break;
+                        case output_type::density:
+                            // with the Euler integrator the density is of the positions before this step's update, with the leapfrog it is of the updated ones
+                            save_density_snapshot(full_path + "_density.pmsnap", density, num_cells, time, width, compression);
+                            break;
+                        case output_type::particles:
+                            save_particle_snapshot(full_path + "_particles.pmsnap", particles, num_cells, time, width, compression, scale, // physical velocities
+                                                   ids.empty() ? nullptr : ids.data());
+                            break;
+                        case output_type::power_spectrum:
+                            // measured from the same density as the density snapshot
+                            Save_PowerSpectrum_csv(spectrum, full_path + "_power_spectrum.csv");
+                            break;
+                    }
+                }
+            };
+            bool written = false;
+            if constexpr (std::is_same_v<Real, double> && std::is_same_v<DensityReal, double>){
+                if (output_queue_length == 0){
+                    write_output(density_buffer, particle_collection);
+                    written = true;
+                }
             }
+            if (!written){
+                // the writer gets its own copies of what it writes so the buffers and particles can be overwritten by the next steps.
+                // Outputs are written in double, so single and mixed precision simulations convert into the copies even when writing synchronously
+                bool needs_density = std::find(outputs.begin(), outputs.end(), output_type::projection) != outputs.end() 
+                                     || std::find(outputs.begin(), outputs.end(), output_type::density) != outputs.end();
+                std::vector<double> density;
+                if (needs_density){
+                    density.assign(density_buffer, density_buffer + static_cast<size_t>(number_of_cells) * number_of_cells * number_of_cells);
+                }
+                particle_group particles = needs_particles ? particle_group(particle_collection) : particle_group(particle_collection.mass, 0, {});
+                auto write_copies = [write_output, density = std::move(density), particles = std::move(particles)](){
+                    write_output(density.data(), particles);
+                };
+                if (output_queue_length == 0){
+                    write_copies();
+                }
+                else{
+                    writer.submit(std::move(write_copies));
+                }
+            }
+        }
+        if (checkpoint_path && step_count % checkpoint_interval == 0){
+            // the copy is taken now so the particles can keep moving while it is written
+            writer.submit([checkpoint = get_checkpoint(), path = *checkpoint_path](){
+                save_checkpoint(checkpoint, path);
+            });
         }
     }
+    writer.flush(); // rethrows if any output failed
 }
 
-void Simulation::fill_density_buffer(){
-    std::memset(density_buffer, 0, sizeof(fftw_complex) * number_of_cells * number_of_cells * number_of_cells); // initialise density buffer to 0
-    
-    #pragma omp parallel for
-    for (size_t particle_index = 0; particle_index < particle_collection.get_num_particles(); particle_index++){ // iterate through every particle and evaluate position
-        particle& current_particle = particle_collection.particles[particle_index];
-        uint i = std::floor(current_particle.position[0] * number_of_cells);
-        uint j = std::floor(current_particle.position[1] * number_of_cells);
-        uint k = std::floor(current_particle.position[2] * number_of_cells);
-        
-        uint index = k + number_of_cells * (j + number_of_cells * i);
-        double cell_width = (box_width/number_of_cells);
-        double single_density = particle_collection.mass / (cell_width * cell_width * cell_width);
-        // use of atomic to prevent race condition when updating density buffer
-        //#pragma omp critical
-        #pragma omp atomic
-        density_buffer[index][0] += single_density;
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::fill_density_buffer(){
+    std::memset(density_buffer, 0, sizeof(DensityReal) * number_of_cells * number_of_cells * number_of_cells); // initialise density buffer to 0
+    switch (assignment_scheme){
+        case mass_assignment::NGP:
+            deposit_particles<mass_assignment::NGP>();
+            break;
+        case mass_assignment::CIC:
+            deposit_particles<mass_assignment::CIC>();
+            break;
+        case mass_assignment::TSC:
+            deposit_particles<mass_assignment::TSC>();
+            break;
     }
 }
 
-void Simulation::fill_potential_buffer(){
-    uint total_size = number_of_cells * number_of_cells * number_of_cells;
-    fftw_execute(forward_plan);
-    k_space_buffer[0][0] = 0; //set first element of the buffer to 0.
-    k_space_buffer[0][1] = 0;
-    
-    #pragma omp parallel for //parallelise
-    for (uint index = 1; index < total_size; index++){
-        uint i = index / (number_of_cells * number_of_cells);
-        uint j = (index / number_of_cells) % number_of_cells;
-        uint k = index % number_of_cells;
-        
-        double cell_num = number_of_cells; //cast to double
-        double norm_factor = -4 * M_PI * box_width * box_width/(i * i + j * j + k * k) * 
-            (1/(8 * cell_num * cell_num * cell_num)); //scale by -4*pi/k^2 and normalisation factor
-    
-        k_space_buffer[index][0] *= norm_factor;
-        k_space_buffer[index][1] *= norm_factor;
+template <typename Real, typename DensityReal>
+template <mass_assignment Scheme>
+void BasicSimulation<Real, DensityReal>::deposit_particles(){
+    constexpr uint width = stencil_width<Scheme>();
+    const Real * x = particle_collection.position[0].data(); // coordinate arrays are contiguous so are streamed through
+    const Real * y = particle_collection.position[1].data();
+    const Real * z = particle_collection.position[2].data();
+    double cell_width = (box_width/number_of_cells);
+    DensityReal single_density = particle_collection.mass / (cell_width * cell_width * cell_width);
+
+    if (density_deposit == deposit_method::atomic){
+        #pragma omp parallel for
+        for (size_t particle_index = 0; particle_index < particle_collection.get_num_particles(); particle_index++){ // iterate through every particle and evaluate position
+            uint i[width], j[width], k[width];
+            Real w_i[width], w_j[width], w_k[width];
+            assignment_weights<Scheme>(x[particle_index] * number_of_cells, number_of_cells, i, w_i);
+            assignment_weights<Scheme>(y[particle_index] * number_of_cells, number_of_cells, j, w_j);
+            assignment_weights<Scheme>(z[particle_index] * number_of_cells, number_of_cells, k, w_k);
+            
+            for (uint a = 0; a < width; a++){
+                for (uint b = 0; b < width; b++){
+                    for (uint c = 0; c < width; c++){
+                        uint index = k[c] + number_of_cells * (j[b] + number_of_cells * i[a]);
+                        // use of atomic to prevent race condition when updating density buffer
+                        #pragma omp atomic
+                        density_buffer[index] += single_density * w_i[a] * w_j[b] * w_k[c];
+                    }
+                }
+            }
+        }
+        return;
     }
-    fftw_execute(backward_plan);
+
+    bin_particles_by_plane(x, particle_collection.get_num_particles(), number_of_cells, 0, number_of_cells, plane_bins);
+    auto deposit_plane = [&](uint plane){
+        for (size_t n = plane_bins.offsets[plane]; n < plane_bins.offsets[plane + 1]; n++){
+            size_t particle_index = plane_bins.particles[n];
+            uint i[width], j[width], k[width];
+            Real w_i[width], w_j[width], w_k[width];
+            assignment_weights<Scheme>(x[particle_index] * number_of_cells, number_of_cells, i, w_i);
+            assignment_weights<Scheme>(y[particle_index] * number_of_cells, number_of_cells, j, w_j);
+            assignment_weights<Scheme>(z[particle_index] * number_of_cells, number_of_cells, k, w_k);
+
+            for (uint a = 0; a < width; a++){
+                for (uint b = 0; b < width; b++){
+                    for (uint c = 0; c < width; c++){
+                        density_buffer[k[c] + number_of_cells * (j[b] + number_of_cells * i[a])] += single_density * w_i[a] * w_j[b] * w_k[c];
+                    }
+                }
+            }
+        }
+    };
+
+    for_each_plane_coloured<Scheme>(number_of_cells, deposit_plane);
 }
 
-std::vector<std::vector<std::vector<std::array<double, 3>>>> Simulation::calculate_gradient(const fftw_complex * potential){
-    double cell_width = box_width/number_of_cells;
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::fill_potential_buffer(){
+    size_t k_space_size = static_cast<size_t>(number_of_cells) * number_of_cells * (number_of_cells/2 + 1);
+    if constexpr (std::is_same_v<DensityReal, Real>){
+        fft_plans->forward(density_buffer, k_space_buffer);
+    }
+    else{
+        // the density is rounded once to the precision of the transform, into the potential buffer that the backward transform overwrites anyway
+        size_t buffer_length = static_cast<size_t>(number_of_cells) * number_of_cells * number_of_cells;
+        #pragma omp parallel for simd
+        for (size_t index = 0; index < buffer_length; index++){
+            potential_buffer[index] = static_cast<Real>(density_buffer[index]);
+        }
+        fft_plans->forward(potential_buffer, k_space_buffer);
+    }
+    if (power_spectrum_requested){ // binned before the spectrum is turned into the potential
+        measured_power_spectrum = binPowerSpectrum(k_space_buffer, number_of_cells, box_width, particle_collection.get_num_particles(), 
+                                                   assignment_scheme, power_spectrum_options);
+        power_spectrum_requested = false;
+    }
 
-    std::vector<std::vector<std::vector<std::array<double, 3>>>> gradient(number_of_cells, std::vector<std::vector<std::array<double, 3>>>(
-        number_of_cells, std::vector<std::array<double, 3>>(number_of_cells, std::array<double, 3>{0, 0, 0}))); // Initialize each std::array<double, 3> with zeros
-    
-    //#pragma omp parallel for
-    #pragma omp parallel for collapse(3) // Parallelize all nested loops
-    for (int i = 0; i < number_of_cells; i++){
-        for (int j = 0; j < number_of_cells; j++){
-            for (int k = 0; k < number_of_cells; k++){
-                int i_high = i + 1;
-                int i_low = i - 1;
-                int j_high = j + 1;
-                int j_low = j - 1;
-                int k_high = k + 1;
-                int k_low = k - 1;
-
-                while (i_high >= number_of_cells){i_high -= number_of_cells;}
-                while (i_low < 0){i_low += number_of_cells;}
-                while (j_high >= number_of_cells){j_high -= number_of_cells;}
-                while (j_low < 0){j_low += number_of_cells;}
-                while (k_high >= number_of_cells){k_high -= number_of_cells;}
-                while (k_low < 0){k_low += number_of_cells;}
-
-                gradient[i][j][k][0] = (potential[k + number_of_cells * (j + number_of_cells * i_high)][0] 
-                - potential[k + number_of_cells * (j + number_of_cells * i_low)][0])/(2 * cell_width);
-
-                gradient[i][j][k][1] = (potential[k + number_of_cells * (j_high + number_of_cells * (i))][0] 
-                - potential[k + number_of_cells * (j_low + number_of_cells * i)][0])/(2 * cell_width);
-                
-                gradient[i][j][k][2] = (potential[k_high + number_of_cells * (j + number_of_cells * (i))][0] 
-                - potential[k_low + number_of_cells * (j + number_of_cells * i)][0])/(2 * cell_width);
+    // the table is independent of the box width, which only scales the potential by box_width^2
+    const double * green_table = green_function->data();
+    double width_squared = box_width * box_width;
+    #pragma omp parallel for simd
+    for (size_t index = 0; index < k_space_size; index++){
+        Real factor = width_squared * green_table[index];
+        k_space_buffer[index][0] *= factor;
+        k_space_buffer[index][1] *= factor;
+    }
+    if (gradient_method == force_method::spectral){
+        fill_spectral_gradient();
+    }
+    else{
+        fft_plans->backward(k_space_buffer, potential_buffer);
+    }
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::fill_spectral_gradient(){
+    int n = number_of_cells;
+    int half_cells = n/2 + 1;
+    double fundamental_wavenumber = 2 * M_PI / box_width;
+
+    for (int dim = 0; dim < 3; dim++){
+        #pragma omp parallel for collapse(2)
+        for (int i = 0; i < n; i++){
+            for (int j = 0; j < n; j++){
+                int frequency_i = i <= n/2 ? i : i - n; // signed frequencies of the full transform
+                int frequency_j = j <= n/2 ? j : j - n;
+                size_t row_start = half_cells * (j + static_cast<size_t>(n) * i);
+                for (int k = 0; k < half_cells; k++){
+                    int frequency = dim == 0 ? frequency_i : (dim == 1 ? frequency_j : k);
+                    // the Nyquist mode of an even grid has no well defined sign so its derivative is dropped
+                    Real wavenumber = 2 * frequency == n ? 0 : fundamental_wavenumber * frequency;
+                    const Real * potential_mode = k_space_buffer[row_start + k];
+                    gradient_k_buffer[row_start + k][0] = -wavenumber * potential_mode[1]; // multiply by i * wavenumber
+                    gradient_k_buffer[row_start + k][1] = wavenumber * potential_mode[0];
+                }
             }
         }
+        fft_plans->backward(gradient_k_buffer, gradient_buffer + dim * gradient_stride);
     }
-    return gradient;
 }
 
-void Simulation::update_particles(){
-    std::vector<std::vector<std::vector<std::array<double, 3>>>> gradient = calculate_gradient(potential_buffer);
+template <typename Real, typename DensityReal>
+const Real * BasicSimulation<Real, DensityReal>::calculate_gradient(const Real * potential){
+    double cell_width = box_width/number_of_cells;
+    Real two_cell_widths = 2 * cell_width;
+    Real * gradient_x = gradient_buffer;
+    Real * gradient_y = gradient_buffer + gradient_stride;
+    Real * gradient_z = gradient_buffer + 2 * gradient_stride;
+    int n = number_of_cells;
     
-    #pragma omp parallel for
+    #pragma omp parallel for collapse(2) // Parallelise the outer loops, the inner loop is contiguous and vectorised
+    for (int i = 0; i < n; i++){
+        for (int j = 0; j < n; j++){
+            int i_high = i + 1 < n ? i + 1 : 0; // periodic neighbours
+            int i_low = i > 0 ? i - 1 : n - 1;
+            int j_high = j + 1 < n ? j + 1 : 0;
+            int j_low = j > 0 ? j - 1 : n - 1;
+
+            const Real * row = potential + n * (j + n * i);
+            const Real * row_i_high = potential + n * (j + n * i_high);
+            const Real * row_i_low = potential + n * (j + n * i_low);
+            const Real * row_j_high = potential + n * (j_high + n * i);
+            const Real * row_j_low = potential + n * (j_low + n * i);
+            size_t row_start = n * (j + n * i);
+
+            #pragma omp simd
+            for (int k = 0; k < n; k++){
+                gradient_x[row_start + k] = (row_i_high[k] - row_i_low[k])/two_cell_widths;
+                gradient_y[row_start + k] = (row_j_high[k] - row_j_low[k])/two_cell_widths;
+            }
+            for (int k = 0; k < n; k++){
+                int k_high = k + 1 < n ? k + 1 : 0;
+                int k_low = k > 0 ? k - 1 : n - 1;
+                gradient_z[row_start + k] = (row[k_high] - row[k_low])/two_cell_widths;
+            }
+        }
+    }
+    return gradient_buffer;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::update_particles(){
+    if (gradient_method == force_method::finite_difference){ // the spectral gradient is filled by fill_potential_buffer
+        calculate_gradient(potential_buffer);
+    }
+    dispatch_kick_drift<true, false>(time_step, time_step);
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::update_particles_and_expand(){
+    if (particle_velocity_frame == velocity_frame::comoving){ // the expansion is a scalar update, so there is nothing to fuse
+        update_particles();
+        box_expansion();
+        return;
+    }
+    if (gradient_method == force_method::finite_difference){
+        calculate_gradient(potential_buffer);
+    }
+    dispatch_kick_drift<true, true>(time_step, time_step);
+    box_width *= expansion_factor;
+}
+
+template <typename Real, typename DensityReal>
+template <bool Drift, bool Expand>
+void BasicSimulation<Real, DensityReal>::dispatch_kick_drift(double kick_time, double drift_time){
+    switch (assignment_scheme){
+        case mass_assignment::NGP:
+            kick_drift_particles<mass_assignment::NGP, Drift, Expand>(kick_time, drift_time);
+            break;
+        case mass_assignment::CIC:
+            kick_drift_particles<mass_assignment::CIC, Drift, Expand>(kick_time, drift_time);
+            break;
+        case mass_assignment::TSC:
+            kick_drift_particles<mass_assignment::TSC, Drift, Expand>(kick_time, drift_time);
+            break;
+    }
+}
+
+template <typename Real, typename DensityReal>
+template <mass_assignment Scheme, bool Drift, bool Expand>
+void BasicSimulation<Real, DensityReal>::kick_drift_particles(double kick_time, double drift_time){
+    constexpr uint width = stencil_width<Scheme>();
+    const Real * gradient_x = gradient_buffer;
+    const Real * gradient_y = gradient_buffer + gradient_stride;
+    const Real * gradient_z = gradient_buffer + 2 * gradient_stride;
+    Real * x = particle_collection.position[0].data();
+    Real * y = particle_collection.position[1].data();
+    Real * z = particle_collection.position[2].data();
+    Real * vx = particle_collection.velocity[0].data();
+    Real * vy = particle_collection.velocity[1].data();
+    Real * vz = particle_collection.velocity[2].data();
+    // comoving velocities u = a v get a kick of a g dt and drift by u dt / a. Both are exactly the times given in the physical frame, where the scale is 1
+    Real kick_step = kick_time * velocity_scale;
+    Real drift_step = drift_time / velocity_scale;
+    Real expansion = expansion_factor;
+    int escaped = 0; // set if a particle moved more than a box width in one step
+    Real max_speed_squared = 0;
+
+    #pragma omp parallel for simd reduction(|:escaped) reduction(max:max_speed_squared)
     for (size_t index = 0; index < particle_collection.get_num_particles(); index++){
-        particle& current_particle = particle_collection.particles[index];
-        uint i = std::floor(current_particle.position[0] * number_of_cells);
-        uint j = std::floor(current_particle.position[1] * number_of_cells);
-        uint k = std::floor(current_particle.position[2] * number_of_cells);
+        uint i[width], j[width], k[width];
+        Real w_i[width], w_j[width], w_k[width];
+        assignment_weights<Scheme>(x[index] * number_of_cells, number_of_cells, i, w_i);
+        assignment_weights<Scheme>(y[index] * number_of_cells, number_of_cells, j, w_j);
+        assignment_weights<Scheme>(z[index] * number_of_cells, number_of_cells, k, w_k);
+
+        // interpolate the gradient with the same kernel used for the density so there is no self force
+        Real grad_x = 0, grad_y = 0, grad_z = 0;
+        for (uint a = 0; a < width; a++){
+            for (uint b = 0; b < width; b++){
+                for (uint c = 0; c < width; c++){
+                    Real weight = w_i[a] * w_j[b] * w_k[c];
+                    size_t cell_index = k[c] + number_of_cells * (j[b] + number_of_cells * i[a]);
+                    grad_x += weight * gradient_x[cell_index];
+                    grad_y += weight * gradient_y[cell_index];
+                    grad_z += weight * gradient_z[cell_index];
+                }
+            }
+        }
 
-        current_particle.velocity[0] += -1 * gradient[i][j][k][0] * time_step;
-        current_particle.velocity[1] += -1 * gradient[i][j][k][1] * time_step;
-        current_particle.velocity[2] += -1 * gradient[i][j][k][2] * time_step;
+        vx[index] += -1 * grad_x * kick_step;
+        vy[index] += -1 * grad_y * kick_step;
+        vz[index] += -1 * grad_z * kick_step;
 
-        current_particle.position[0] += current_particle.velocity[0] * time_step;
-        current_particle.position[1] += current_particle.velocity[1] * time_step;
-        current_particle.position[2] += current_particle.velocity[2] * time_step;
+        if constexpr (Drift){
+            x[index] += vx[index] * drift_step;
+            y[index] += vy[index] * drift_step;
+            z[index] += vz[index] * drift_step;
+        }
 
-        // apply boundary conditions
-        while (current_particle.position[0] < 0){current_particle.position[0] +=1;}
-        while (current_particle.position[0] >= 1){current_particle.position[0] -= 1;}
-        while (current_particle.position[1] < 0){current_particle.position[1] += 1;}
-        while (current_particle.position[1] >= 1){current_particle.position[1] -= 1;}
-        while (current_particle.position[2] < 0){current_particle.position[2] += 1;}
-        while (current_particle.position[2] >= 1){current_particle.position[2] -= 1;}
+        if constexpr (Expand){ // the same division box_expansion does, while the velocities are still in registers
+            vx[index] /= expansion;
+            vy[index] /= expansion;
+            vz[index] /= expansion;
+        }
+        max_speed_squared = std::max(max_speed_squared, vx[index] * vx[index] + vy[index] * vy[index] + vz[index] * vz[index]);
+
+        if constexpr (Drift){
+            // apply boundary conditions. Branch free selects give the same result as repeatedly adding or subtracting 1 for positions in [-1, 2)
+            x[index] = x[index] < 0 ? x[index] + 1 : x[index];
+            x[index] = x[index] >= 1 ? x[index] - 1 : x[index];
+            y[index] = y[index] < 0 ? y[index] + 1 : y[index];
+            y[index] = y[index] >= 1 ? y[index] - 1 : y[index];
+            z[index] = z[index] < 0 ? z[index] + 1 : z[index];
+            z[index] = z[index] >= 1 ? z[index] - 1 : z[index];
+            escaped |= (x[index] < 0) | (x[index] >= 1) | (y[index] < 0) | (y[index] >= 1) | (z[index] < 0) | (z[index] >= 1);
+        }
+    }
+    max_speed = std::sqrt(max_speed_squared);
+
+    if (escaped){ // rare fall back for particles that crossed more than one box width
+        for (uint dim = 0; dim < 3; dim++){
+            Real * coordinate = particle_collection.position[dim].data();
+            #pragma omp parallel for
+            for (size_t index = 0; index < particle_collection.get_num_particles(); index++){
+                while (coordinate[index] < 0){coordinate[index] += 1;}
+                while (coordinate[index] >= 1){coordinate[index] -= 1;}
+            }
+        }
+    }
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::compute_forces(){
+    fill_density_buffer();
+    fill_potential_buffer();
+    if (gradient_method == force_method::finite_difference){
+        calculate_gradient(potential_buffer);
     }
 }
 
-void Simulation::box_expansion(){
+template <typename Real, typename DensityReal>
+double BasicSimulation<Real, DensityReal>::adaptive_time_step(double next_output_time, double &end_time) const {
+    const Real * gradient_x = gradient_buffer;
+    const Real * gradient_y = gradient_buffer + gradient_stride;
+    const Real * gradient_z = gradient_buffer + 2 * gradient_stride;
+    size_t num_cells = static_cast<size_t>(number_of_cells) * number_of_cells * number_of_cells;
+    Real max_acceleration_squared = 0;
+    // the interpolated force is a weighted mean of cell values, so no particle feels more than the largest cell
+    #pragma omp parallel for simd reduction(max:max_acceleration_squared)
+    for (size_t cell = 0; cell < num_cells; cell++){
+        max_acceleration_squared = std::max(max_acceleration_squared, gradient_x[cell] * gradient_x[cell] + gradient_y[cell] * gradient_y[cell] 
+                                                                      + gradient_z[cell] * gradient_z[cell]);
+    }
+    double cell_width = 1.0 / number_of_cells; // positions are in units of the box
+    double step = get_max_time_step();
+    if (max_acceleration_squared > 0){
+        step = std::min(step, courant_factor * std::sqrt(cell_width / std::sqrt(max_acceleration_squared)));
+    }
+    double speed = max_speed / velocity_scale; // the drift divides by the scale
+    if (speed > 0){
+        step = std::min(step, courant_factor * cell_width / speed);
+    }
+    step = std::max(step, 1e-6 * time_step); // a singular force must not stall the run
+
+    end_time = current_time + step;
+    for (double target : {next_output_time, time_max}){
+        if (target <= current_time || target > current_time + 2 * step){
+            continue;
+        }
+        // a target within two steps is reached in equal steps, so it is never followed by a sliver of a step
+        if (target <= end_time){
+            step = target - current_time;
+            end_time = target;
+        }
+        else{
+            step = 0.5 * (target - current_time);
+            end_time = current_time + step;
+        }
+    }
+    return step;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::box_expansion(){
     box_width *= expansion_factor;
+    if (particle_velocity_frame == velocity_frame::comoving){
+        velocity_scale *= expansion_factor;
+        return;
+    }
 
-    #pragma omp parallel for
+    Real expansion = expansion_factor;
+    Real * vx = particle_collection.velocity[0].data();
+    Real * vy = particle_collection.velocity[1].data();
+    Real * vz = particle_collection.velocity[2].data();
+
+    #pragma omp parallel for simd
     for (size_t i = 0; i < particle_collection.get_num_particles(); i++){
-        particle_collection.particles[i].velocity[0] /= expansion_factor;
-        particle_collection.particles[i].velocity[1] /= expansion_factor;
-        particle_collection.particles[i].velocity[2] /= expansion_factor;
+        vx[i] /= expansion;
+        vy[i] /= expansion;
+        vz[i] /= expansion;
     }
 }
 
 
-const fftw_complex* Simulation::get_density_buffer() const {
+template <typename Real, typename DensityReal>
+const DensityReal* BasicSimulation<Real, DensityReal>::get_density_buffer() const {
     return density_buffer;
 }
 
-const fftw_complex* Simulation::get_potential_buffer() const{
+template <typename Real, typename DensityReal>
+const Real* BasicSimulation<Real, DensityReal>::get_potential_buffer() const{
     return potential_buffer;
 }
 
-const particle_group & Simulation::get_particle_collection() const {
+template <typename Real, typename DensityReal>
+const Real* BasicSimulation<Real, DensityReal>::get_gradient_buffer() const{
+    return gradient_buffer;
+}
+
+template <typename Real, typename DensityReal>
+size_t BasicSimulation<Real, DensityReal>::get_gradient_stride() const{
+    return gradient_stride;
+}
+
+template <typename Real, typename DensityReal>
+basic_particle_group<Real> BasicSimulation<Real, DensityReal>::release_particle_collection(){
+    set_velocity_frame(velocity_frame::physical); // converts the velocities in place
+    particle_ids.clear();
+    basic_particle_group<Real> released = std::move(particle_collection);
+    particle_collection = basic_particle_group<Real>(released.mass, 0, {});
+    return released;
+}
+
+template <typename Real, typename DensityReal>
+const basic_particle_group<Real> & BasicSimulation<Real, DensityReal>::get_particle_collection() const {
     return particle_collection;
-}
\ No newline at end of file
+}
+
+template <typename Real, typename DensityReal>
+const std::vector<uint64_t> & BasicSimulation<Real, DensityReal>::get_particle_ids() const {
+    return particle_ids;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::sort_particles(){
+    sort_particles_by_cell(particle_collection, particle_ids, number_of_cells, sort_buffers);
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_integrator(integrator method, double courant, double max_step){
+    if (courant <= 0){
+        throw std::invalid_argument("Error - courant_factor must be larger than 0!");
+    }
+    if (max_step < 0){
+        throw std::invalid_argument("Error - max_time_step must not be negative!");
+    }
+    time_integrator = method;
+    courant_factor = courant;
+    max_time_step = max_step;
+}
+
+template <typename Real, typename DensityReal>
+integrator BasicSimulation<Real, DensityReal>::get_integrator() const {
+    return time_integrator;
+}
+
+template <typename Real, typename DensityReal>
+double BasicSimulation<Real, DensityReal>::get_courant_factor() const {
+    return courant_factor;
+}
+
+template <typename Real, typename DensityReal>
+double BasicSimulation<Real, DensityReal>::get_max_time_step() const {
+    return max_time_step > 0 ? max_time_step : time_step;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_particle_sorting(uint interval_steps){
+    sort_interval = interval_steps;
+}
+
+template <typename Real, typename DensityReal>
+uint BasicSimulation<Real, DensityReal>::get_particle_sorting() const {
+    return sort_interval;
+}
+
+template <typename Real, typename DensityReal>
+basic_particle_group<Real> BasicSimulation<Real, DensityReal>::get_physical_particle_collection() const {
+    basic_particle_group<Real> particles = particle_collection;
+    if (velocity_scale != 1){
+        for (uint dim = 0; dim < 3; dim++){
+            Real * velocity = particles.velocity[dim].data();
+            #pragma omp parallel for simd
+            for (size_t index = 0; index < particles.get_num_particles(); index++){
+                velocity[index] /= velocity_scale;
+            }
+        }
+    }
+    return particles;
+}
+
+template <typename Real, typename DensityReal>
+mass_assignment BasicSimulation<Real, DensityReal>::get_mass_assignment() const {
+    return assignment_scheme;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_deposit_method(deposit_method method){
+    density_deposit = method;
+}
+
+template <typename Real, typename DensityReal>
+deposit_method BasicSimulation<Real, DensityReal>::get_deposit_method() const {
+    return density_deposit;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_force_method(force_method method){
+    gradient_method = method;
+    if (gradient_method == force_method::spectral && !gradient_k_buffer){
+        gradient_k_buffer = (complex *) fftw_traits<Real>::malloc(sizeof(complex) * number_of_cells * number_of_cells * (number_of_cells/2 + 1));
+    }
+}
+
+template <typename Real, typename DensityReal>
+force_method BasicSimulation<Real, DensityReal>::get_force_method() const {
+    return gradient_method;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_velocity_frame(velocity_frame frame){
+    if (frame == velocity_frame::physical && velocity_scale != 1){
+        for (uint dim = 0; dim < 3; dim++){
+            Real * velocity = particle_collection.velocity[dim].data();
+            #pragma omp parallel for simd
+            for (size_t index = 0; index < particle_collection.get_num_particles(); index++){
+                velocity[index] /= velocity_scale;
+            }
+        }
+        velocity_scale = 1;
+    }
+    particle_velocity_frame = frame;
+}
+
+template <typename Real, typename DensityReal>
+velocity_frame BasicSimulation<Real, DensityReal>::get_velocity_frame() const {
+    return particle_velocity_frame;
+}
+
+template <typename Real, typename DensityReal>
+double BasicSimulation<Real, DensityReal>::get_velocity_scale() const {
+    return velocity_scale;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_green_kernel(green_kernel kernel, double smoothing_cells){
+    green_function = GreenFunction::get_table(number_of_cells, kernel, assignment_scheme, smoothing_cells);
+}
+
+template <typename Real, typename DensityReal>
+green_kernel BasicSimulation<Real, DensityReal>::get_green_kernel() const {
+    return green_function->get_kernel();
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_image_format(image_format format){
+    image_output_format = format;
+}
+
+template <typename Real, typename DensityReal>
+image_format BasicSimulation<Real, DensityReal>::get_image_format() const {
+    return image_output_format;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_snapshot_compression(snapshot_compression compression){
+    if (compression == snapshot_compression::zlib && !snapshot_compression_available()){
+        throw std::invalid_argument("Error - zlib compressed snapshots need the library to be built with zlib!");
+    }
+    snapshot_format = compression;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::request_power_spectrum(){
+    power_spectrum_requested = true;
+}
+
+template <typename Real, typename DensityReal>
+const std::optional<PowerSpectrum> & BasicSimulation<Real, DensityReal>::get_power_spectrum() const {
+    return measured_power_spectrum;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_power_spectrum_options(PowerSpectrumOptions options){
+    if (options.num_bins <= 0){
+        throw std::invalid_argument("Error - The power spectrum requires a positive number of bins!");
+    }
+    power_spectrum_options = options;
+}
+
+template <typename Real, typename DensityReal>
+const PowerSpectrumOptions & BasicSimulation<Real, DensityReal>::get_power_spectrum_options() const {
+    return power_spectrum_options;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_output_schedule(OutputSchedule schedule){
+    output_schedule = std::move(schedule);
+}
+
+template <typename Real, typename DensityReal>
+const OutputSchedule & BasicSimulation<Real, DensityReal>::get_output_schedule() const {
+    return output_schedule;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_output_queue_length(size_t length){
+    output_queue_length = length;
+}
+
+template <typename Real, typename DensityReal>
+size_t BasicSimulation<Real, DensityReal>::get_output_queue_length() const {
+    return output_queue_length;
+}
+
+template <typename Real, typename DensityReal>
+void BasicSimulation<Real, DensityReal>::set_checkpointing(const std::string &checkpoint_file, uint interval_steps){
+    if (interval_steps == 0){
+        throw std::invalid_argument("Error - interval_steps (checkpoint interval) must be larger than 0!");
+    }
+    checkpoint_path = checkpoint_file;
+    checkpoint_interval = interval_steps;
+}
+
+template <typename Real, typename DensityReal>
+SimulationCheckpoint BasicSimulation<Real, DensityReal>::get_checkpoint() const {
+    return SimulationCheckpoint{current_time, step_count, time_max, time_step, box_width, expansion_factor, number_of_cells, assignment_scheme, 
+                                density_deposit, gradient_method, green_function->get_kernel(), green_function->get_smoothing_cells(), particle_velocity_frame, 
+                                velocity_scale, sort_interval, time_integrator, courant_factor, max_time_step, real_precision, 
+                                particle_group(particle_collection), particle_ids};
+}
+
+template <typename Real, typename DensityReal>
+std::unique_ptr<BasicSimulation<Real, DensityReal>> BasicSimulation<Real, DensityReal>::from_checkpoint(SimulationCheckpoint checkpoint, std::optional<std::string> wisdom_folder){
+    if (checkpoint.real_precision != real_precision){
+        throw std::invalid_argument("Error - The checkpoint was written by a simulation of another precision!");
+    }
+    auto sim = std::make_unique<BasicSimulation>(checkpoint.time_max, checkpoint.time_step, basic_particle_group<Real>(std::move(checkpoint.particles)), checkpoint.box_width, 
+                                            checkpoint.num_cells, checkpoint.expansion_factor, checkpoint.scheme, wisdom_folder);
+    sim->current_time = checkpoint.time;
+    sim->step_count = checkpoint.step;
+    sim->set_deposit_method(checkpoint.density_deposit);
+    sim->set_force_method(checkpoint.gradient_method);
+    sim->set_green_kernel(checkpoint.kernel, checkpoint.smoothing_cells);
+    sim->particle_velocity_frame = checkpoint.frame;
+    sim->velocity_scale = checkpoint.velocity_scale; // the velocities are restored as stored
+    sim->sort_interval = checkpoint.sort_interval;
+    sim->set_integrator(checkpoint.time_integrator, checkpoint.courant_factor, checkpoint.max_time_step);
+    sim->particle_ids = std::move(checkpoint.particle_ids);
+    return sim;
+}
+
+template <typename Real, typename DensityReal>
+double BasicSimulation<Real, DensityReal>::get_time() const {
+    return current_time;
+}
+
+template <typename Real, typename DensityReal>
+uint64_t BasicSimulation<Real, DensityReal>::get_step() const {
+    return step_count;
+}
+
+precision precision_from_string(const std::string &name){
+    std::string upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char character){ return std::toupper(character); });
+    if (upper == "DOUBLE"){
+        return precision::double_precision;
+    }
+    if (upper == "FLOAT"){
+        return precision::single_precision;
+    }
+    if (upper == "MIXED"){
+        return precision::mixed;
+    }
+    throw std::invalid_argument("Error - Unknown precision " + name + ", expected DOUBLE, FLOAT or MIXED!");
+}
+
+template class BasicSimulation<double>;
+template class BasicSimulation<float>;
+template class BasicSimulation<float, double>;
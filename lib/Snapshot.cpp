@@ -0,0 +1,234 @@
+#include "Snapshot.hpp"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+#ifdef PM_SIMULATION_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+    const char snapshot_magic[8] = {'P', 'M', 'S', 'N', 'A', 'P', 'S', 'H'};
+    const uint32_t snapshot_version = 1;
+    const uint64_t chunk_values = 1 << 20; // 8 MiB of doubles per chunk bounds the memory needed to compress
+
+    template <typename T>
+    void write_value(std::ofstream &file, T value){
+        file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    T read_value(std::ifstream &file){
+        T value;
+        file.read(reinterpret_cast<char *>(&value), sizeof(T));
+        return value;
+    }
+
+    void write_string(std::ofstream &file, const std::string &text){
+        write_value<uint32_t>(file, text.size());
+        file.write(text.data(), text.size());
+    }
+
+    std::string read_string(std::ifstream &file){
+        uint32_t length = read_value<uint32_t>(file);
+        if (!file || length > 256){
+            throw std::runtime_error("Error - Snapshot has an invalid name!");
+        }
+        std::string text(length, ' ');
+        file.read(text.data(), length);
+        return text;
+    }
+
+    /**
+     * @brief: Field to write, whose values are divided by divisor as they are written.
+    */
+    struct FieldSource
+    {
+        std::string name;
+        const double * values;
+        double divisor = 1;
+    };
+
+    /**
+     * @brief: Writes a field as its name, number of values and chunks, each prefixed by its stored size in bytes.
+    */
+    void write_field(std::ofstream &file, const FieldSource &field, uint64_t num_values, snapshot_compression compression){
+        write_string(file, field.name);
+        write_value<uint64_t>(file, num_values);
+        std::vector<unsigned char> compressed;
+        std::vector<double> divided; // one chunk of divided values, only used if the divisor is not 1
+        for (uint64_t start = 0; start < num_values; start += chunk_values){
+            uint64_t chunk_length = std::min(chunk_values, num_values - start);
+            uint64_t chunk_bytes = sizeof(double) * chunk_length;
+            const char * chunk = reinterpret_cast<const char *>(field.values + start);
+            if (field.divisor != 1){
+                divided.resize(chunk_length);
+                for (uint64_t index = 0; index < chunk_length; index++){
+                    divided[index] = field.values[start + index] / field.divisor;
+                }
+                chunk = reinterpret_cast<const char *>(divided.data());
+            }
+            if (compression == snapshot_compression::none){
+                write_value<uint64_t>(file, chunk_bytes);
+                file.write(chunk, chunk_bytes);
+            }
+            else{
+#ifdef PM_SIMULATION_WITH_ZLIB
+                uLongf compressed_bytes = compressBound(chunk_bytes);
+                compressed.resize(compressed_bytes);
+                if (compress2(compressed.data(), &compressed_bytes, reinterpret_cast<const Bytef *>(chunk), chunk_bytes, Z_BEST_SPEED) != Z_OK){
+                    throw std::runtime_error("Error - Failed to compress snapshot " + field.name + "!");
+                }
+                write_value<uint64_t>(file, compressed_bytes);
+                file.write(reinterpret_cast<const char *>(compressed.data()), compressed_bytes);
+#endif
+            }
+        }
+    }
+
+    SnapshotField read_field(std::ifstream &file, snapshot_compression compression, const std::string &filename){
+        SnapshotField field;
+        field.name = read_string(file);
+        uint64_t num_values = read_value<uint64_t>(file);
+        if (!file){
+            throw std::runtime_error("Error - Snapshot " + filename + " is truncated!");
+        }
+        field.values.resize(num_values);
+        std::vector<unsigned char> compressed;
+        for (uint64_t start = 0; start < num_values; start += chunk_values){
+            uint64_t chunk_bytes = sizeof(double) * std::min(chunk_values, num_values - start);
+            uint64_t stored_bytes = read_value<uint64_t>(file);
+            char * chunk = reinterpret_cast<char *>(field.values.data() + start);
+            if (compression == snapshot_compression::none){
+                if (stored_bytes != chunk_bytes){
+                    throw std::runtime_error("Error - Snapshot " + filename + " has an invalid chunk!");
+                }
+                file.read(chunk, chunk_bytes);
+            }
+            else{
+#ifdef PM_SIMULATION_WITH_ZLIB
+                if (stored_bytes > compressBound(chunk_bytes)){
+                    throw std::runtime_error("Error - Snapshot " + filename + " has an invalid chunk!");
+                }
+                compressed.resize(stored_bytes);
+                file.read(reinterpret_cast<char *>(compressed.data()), stored_bytes);
+                uLongf uncompressed_bytes = chunk_bytes;
+                if (!file || uncompress(reinterpret_cast<Bytef *>(chunk), &uncompressed_bytes, compressed.data(), stored_bytes) != Z_OK
+                    || uncompressed_bytes != chunk_bytes){
+                    throw std::runtime_error("Error - Snapshot " + filename + " has an invalid chunk!");
+                }
+#endif
+            }
+            if (!file){
+                throw std::runtime_error("Error - Snapshot " + filename + " is truncated!");
+            }
+        }
+        return field;
+    }
+
+    /**
+     * @brief: Writes the header and fields of a snapshot.
+    */
+    void write_snapshot(const std::string &filename, const std::string &kind, double time, double box_width, double particle_mass, uint num_cells,
+                        snapshot_compression compression, const std::vector<FieldSource> &fields, uint64_t num_values){
+        if (compression == snapshot_compression::zlib && !snapshot_compression_available()){
+            throw std::invalid_argument("Error - zlib compressed snapshots need the library to be built with zlib!");
+        }
+        std::ofstream file(filename, std::ios::binary);
+        if (!file){
+            throw std::runtime_error("Error - Could not open snapshot file " + filename + " for writing!");
+        }
+        file.write(snapshot_magic, sizeof(snapshot_magic));
+        write_value<uint32_t>(file, snapshot_version);
+        write_string(file, kind);
+        write_value<double>(file, time);
+        write_value<double>(file, box_width);
+        write_value<double>(file, particle_mass);
+        write_value<uint32_t>(file, num_cells);
+        write_value<uint32_t>(file, static_cast<uint32_t>(compression));
+        write_value<uint32_t>(file, fields.size());
+        for (const FieldSource &field : fields){
+            write_field(file, field, num_values, compression);
+        }
+        if (!file){
+            throw std::runtime_error("Error - Failed to write snapshot file " + filename + "!");
+        }
+    }
+}
+
+const SnapshotField & Snapshot::field(const std::string &name) const {
+    for (const SnapshotField &snapshot_field : fields){
+        if (snapshot_field.name == name){
+            return snapshot_field;
+        }
+    }
+    throw std::invalid_argument("Error - Snapshot has no field " + name + "!");
+}
+
+void save_density_snapshot(const std::string &filename, const double * density, uint num_cells, double time, double box_width,
+                           snapshot_compression compression){
+    uint64_t num_values = static_cast<uint64_t>(num_cells) * num_cells * num_cells;
+    write_snapshot(filename, "density", time, box_width, 0, num_cells, compression, {{"density", density}}, num_values);
+}
+
+void save_particle_snapshot(const std::string &filename, particle_view particles, uint num_cells, double time, double box_width,
+                            snapshot_compression compression, double velocity_scale, const uint64_t * ids){
+    if (!(velocity_scale > 0)){
+        throw std::invalid_argument("Error - The velocity scale of a particle snapshot must be positive!");
+    }
+    std::vector<FieldSource> fields = {{"x", particles.position[0]}, {"y", particles.position[1]}, {"z", particles.position[2]},
+                                       {"vx", particles.velocity[0], velocity_scale}, {"vy", particles.velocity[1], velocity_scale}, {"vz", particles.velocity[2], velocity_scale}};
+    std::vector<double> id_values; // fields hold doubles, which represent ids exactly up to 2^53
+    if (ids){
+        id_values.assign(ids, ids + particles.num_particles);
+        fields.push_back({"id", id_values.data()});
+    }
+    write_snapshot(filename, "particles", time, box_width, particles.mass, num_cells, compression, fields, particles.num_particles);
+}
+
+Snapshot load_snapshot(const std::string &filename){
+    std::ifstream file(filename, std::ios::binary);
+    if (!file){
+        throw std::runtime_error("Error - Could not open snapshot file " + filename + "!");
+    }
+    char magic[sizeof(snapshot_magic)];
+    file.read(magic, sizeof(magic));
+    if (!file || !std::equal(magic, magic + sizeof(magic), snapshot_magic)){
+        throw std::runtime_error("Error - " + filename + " is not a simulation snapshot!");
+    }
+    uint32_t version = read_value<uint32_t>(file);
+    if (version != snapshot_version){
+        throw std::runtime_error("Error - Snapshot " + filename + " has version " + std::to_string(version) +
+                                 " but version " + std::to_string(snapshot_version) + " is supported!");
+    }
+    Snapshot snapshot;
+    snapshot.kind = read_string(file);
+    snapshot.time = read_value<double>(file);
+    snapshot.box_width = read_value<double>(file);
+    snapshot.particle_mass = read_value<double>(file);
+    snapshot.num_cells = read_value<uint32_t>(file);
+    uint32_t compression = read_value<uint32_t>(file);
+    uint32_t num_fields = read_value<uint32_t>(file);
+    if (!file){
+        throw std::runtime_error("Error - Snapshot " + filename + " is truncated!");
+    }
+    if (compression > static_cast<uint32_t>(snapshot_compression::zlib)){
+        throw std::runtime_error("Error - Snapshot " + filename + " has an unknown compression!");
+    }
+    snapshot.compression = static_cast<snapshot_compression>(compression);
+    if (snapshot.compression == snapshot_compression::zlib && !snapshot_compression_available()){
+        throw std::runtime_error("Error - Snapshot " + filename + " is zlib compressed but the library was built without zlib!");
+    }
+    for (uint32_t field = 0; field < num_fields; field++){
+        snapshot.fields.push_back(read_field(file, snapshot.compression, filename));
+    }
+    return snapshot;
+}
+
+bool snapshot_compression_available(){
+#ifdef PM_SIMULATION_WITH_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,148 @@
+#include "SpatialSort.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <omp.h>
+
+namespace {
+    /**
+     * @brief: Spreads the low 21 bits of value so there are two zero bits between each of them.
+    */
+    uint64_t spread_bits(uint64_t value){
+        value &= 0x1fffff;
+        value = (value | value << 32) & 0x1f00000000ffff;
+        value = (value | value << 16) & 0x1f0000ff0000ff;
+        value = (value | value << 8) & 0x100f00f00f00f00f;
+        value = (value | value << 4) & 0x10c30c30c30c30c3;
+        value = (value | value << 2) & 0x1249249249249249;
+        return value;
+    }
+
+    /**
+     * @brief: Cell index of a coordinate in the unit interval, clamped as the deposit does for coordinates that round up to num_cells.
+    */
+    template <typename Real>
+    uint cell_of(Real coordinate, uint num_cells){
+        uint cell = std::floor(coordinate * num_cells);
+        return cell < num_cells ? cell : num_cells - 1;
+    }
+
+    /**
+     * @brief: Gathers values[order[index]] into gathered and swaps it with values, so gathered holds the old array afterwards.
+    */
+    template <typename Vector>
+    void permute(Vector &values, Vector &gathered, const std::vector<uint> &order){
+        size_t n = order.size();
+        gathered.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (size_t index = 0; index < n; index++){
+            gathered[index] = values[order[index]];
+        }
+        std::swap(values, gathered);
+    }
+}
+
+uint64_t morton_key(uint i, uint j, uint k){
+    return spread_bits(i) << 2 | spread_bits(j) << 1 | spread_bits(k);
+}
+
+void radix_sort_by_key(std::vector<uint64_t> &keys, std::vector<uint> &values, uint key_bits, SpatialSortBuffers &buffers){
+    const uint digit_bits = 8;
+    const uint num_digits = 1 << digit_bits;
+    size_t n = keys.size();
+    int max_threads = omp_get_max_threads();
+    buffers.sorted_keys.resize(n);
+    buffers.sorted_order.resize(n);
+    buffers.counts.resize(max_threads * num_digits);
+
+    for (uint shift = 0; shift < key_bits; shift += digit_bits){
+        std::fill(buffers.counts.begin(), buffers.counts.end(), 0);
+        const uint64_t * in_keys = keys.data();
+        const uint * in_values = values.data();
+        uint64_t * out_keys = buffers.sorted_keys.data();
+        uint * out_values = buffers.sorted_order.data();
+
+        #pragma omp parallel num_threads(max_threads)
+        {
+            size_t * counts = buffers.counts.data() + omp_get_thread_num() * num_digits;
+            // both loops use the same static schedule so each thread scatters the chunk it counted, which keeps the sort stable
+            #pragma omp for schedule(static)
+            for (size_t index = 0; index < n; index++){
+                counts[(in_keys[index] >> shift) & (num_digits - 1)]++;
+            }
+
+            #pragma omp single
+            { // exclusive prefix sum over digits then threads
+                size_t offset = 0;
+                for (uint digit = 0; digit < num_digits; digit++){
+                    for (int thread = 0; thread < max_threads; thread++){
+                        size_t count = buffers.counts[thread * num_digits + digit];
+                        buffers.counts[thread * num_digits + digit] = offset;
+                        offset += count;
+                    }
+                }
+            }
+
+            #pragma omp for schedule(static)
+            for (size_t index = 0; index < n; index++){
+                size_t destination = counts[(in_keys[index] >> shift) & (num_digits - 1)]++;
+                out_keys[destination] = in_keys[index];
+                out_values[destination] = in_values[index];
+            }
+        }
+        std::swap(keys, buffers.sorted_keys);
+        std::swap(values, buffers.sorted_order);
+    }
+}
+
+template <typename Real>
+void sort_particles_by_cell(basic_particle_group<Real> &particles, std::vector<uint64_t> &ids, uint num_cells, SpatialSortBuffers &buffers){
+    if (num_cells == 0 || num_cells > (1u << 21)){
+        throw std::invalid_argument("Error - Particles can only be sorted on grids of 1 to 2^21 cells per length!");
+    }
+    size_t n = particles.get_num_particles();
+    if (!ids.empty() && ids.size() != n){
+        throw std::invalid_argument("Error - There must be one id per particle!");
+    }
+    if (ids.empty()){
+        ids.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (size_t index = 0; index < n; index++){
+            ids[index] = index;
+        }
+    }
+
+    const Real * x = particles.position[0].data();
+    const Real * y = particles.position[1].data();
+    const Real * z = particles.position[2].data();
+    buffers.keys.resize(n);
+    buffers.order.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (size_t index = 0; index < n; index++){
+        buffers.keys[index] = morton_key(cell_of(x[index], num_cells), cell_of(y[index], num_cells), cell_of(z[index], num_cells));
+        buffers.order[index] = index;
+    }
+    uint bits_per_dimension = 0;
+    while ((1u << bits_per_dimension) < num_cells){
+        bits_per_dimension++;
+    }
+    radix_sort_by_key(buffers.keys, buffers.order, 3 * bits_per_dimension, buffers);
+
+    aligned_vector<Real> &gathered = [&]() -> aligned_vector<Real> & {
+        if constexpr (std::is_same_v<Real, float>){
+            return buffers.gathered_float;
+        }
+        else{
+            return buffers.gathered;
+        }
+    }();
+    for (uint dim = 0; dim < 3; dim++){
+        permute(particles.position[dim], gathered, buffers.order);
+        permute(particles.velocity[dim], gathered, buffers.order);
+    }
+    permute(ids, buffers.gathered_ids, buffers.order);
+}
+
+template void sort_particles_by_cell(particle_group &particles, std::vector<uint64_t> &ids, uint num_cells, SpatialSortBuffers &buffers);
+template void sort_particles_by_cell(particle_group_float &particles, std::vector<uint64_t> &ids, uint num_cells, SpatialSortBuffers &buffers);
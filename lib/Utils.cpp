@@ -9,99 +9,219 @@
 #include <fstream>
 #include <fftw3.h>
 #include <iomanip>
+#include <memory>
+#include <omp.h>
+#include "FFTPlans.hpp"
 
 using std::fstream;
 using std::vector;
 using std::string;
 
-void SaveToFile(fftw_complex* density_map, const size_t n_cells, const string &filename)
+void ProjectDensity(const double* density_map, const size_t n_cells, double* projection, uint axis, size_t first_plane, size_t num_planes)
 {
-    //Write the file header
-    fstream image_file;
-    image_file.open(filename, fstream::out);
-    if(!image_file)
+    if (axis > 2)
     {
-        throw std::runtime_error("File failed to open");
+        throw std::invalid_argument("Error - The projection axis must be 0, 1 or 2!");
     }
-    image_file << "P3\n" << n_cells << " " << n_cells << "\n255\n";
-
-    vector<double> density_xy(n_cells*n_cells);
+    if (num_planes == 0 && first_plane < n_cells)
+    {
+        num_planes = n_cells - first_plane;
+    }
+    if (first_plane + num_planes > n_cells || num_planes == 0)
+    {
+        throw std::invalid_argument("Error - The projected slab must lie inside the box!");
+    }
+    size_t last_plane = first_plane + num_planes;
+    size_t plane_size = n_cells*n_cells;
 
-    for(size_t i = 0; i < n_cells*n_cells; i++)
+    // every thread owns whole rows of the projection so no reduction between threads is needed, and the innermost loops run along contiguous k
+    if (axis == 2)
     {
-        density_xy[i] = 0;
+        #pragma omp parallel for
+        for (size_t row = 0; row < plane_size; row++)
+        {
+            const double* cells = density_map + row*n_cells;
+            double sum = 0;
+            #pragma omp simd reduction(+:sum)
+            for (size_t k = first_plane; k < last_plane; k++)
+            {
+                sum += cells[k];
+            }
+            projection[row] = sum;
+        }
     }
-    for(size_t i = 0; i < n_cells; i++)
+    else
     {
-        for(size_t j = 0; j < n_cells; j++)
+        // axis 1 sums the rows j of plane i into projection row i, axis 0 sums the rows j of every plane i into projection row j
+        #pragma omp parallel for
+        for (size_t row = 0; row < n_cells; row++)
         {
-            for(size_t k = 0; k < n_cells; k++)
+            double* projection_row = projection + row*n_cells;
+            std::fill(projection_row, projection_row + n_cells, 0.0);
+            for (size_t plane = first_plane; plane < last_plane; plane++)
             {
-                density_xy[i*n_cells + j] += density_map[k + n_cells*(j + n_cells*i)][0];
+                const double* cells = axis == 1 ? density_map + (row*n_cells + plane)*n_cells : density_map + (plane*n_cells + row)*n_cells;
+                #pragma omp simd
+                for (size_t k = 0; k < n_cells; k++)
+                {
+                    projection_row[k] += cells[k];
+                }
             }
         }
     }
-    auto max = std::max_element(density_xy.begin(), density_xy.end());
-    double mean = std::accumulate(density_xy.begin(), density_xy.end(), 0.0) / (n_cells*n_cells);
-    double norm = 255/mean;
-    for(size_t i = 0; i < n_cells*n_cells; i++)
+}
+
+void SaveToFile(const double* density_map, const size_t n_cells, const string &filename, image_format format, uint axis, size_t first_plane, size_t num_planes)
+{
+    vector<double> density_xy(n_cells*n_cells);
+    ProjectDensity(density_map, n_cells, density_xy.data(), axis, first_plane, num_planes);
+    SaveProjectionToFile(density_xy.data(), n_cells, filename, format);
+}
+
+void SaveProjectionToFile(const double* density_xy_map, const size_t n_cells, const string &filename, image_format format)
+{
+    //Write the file header
+    fstream image_file;
+    image_file.open(filename, fstream::out | fstream::binary);
+    if(!image_file)
+    {
+        throw std::runtime_error("File failed to open");
+    }
+    image_file << (format == image_format::binary ? "P6\n" : "P3\n") << n_cells << " " << n_cells << "\n255\n";
+
+    size_t num_pixels = n_cells*n_cells;
+    double total = 0;
+    #pragma omp parallel for simd reduction(+:total)
+    for(size_t i = 0; i < num_pixels; i++)
+    {
+        total += density_xy_map[i];
+    }
+    double norm = 255/(total/num_pixels);
+
+    // red saturates first, then green and blue, so dense regions fade to white
+    vector<unsigned char> pixels(3*num_pixels);
+    #pragma omp parallel for
+    for(size_t i = 0; i < num_pixels; i++)
     {
-        density_xy[i] *= norm;
+        int value = static_cast<int>(density_xy_map[i] * norm);
+        pixels[3*i] = std::min(value, 255);
+        pixels[3*i + 1] = std::min(std::max(value - 255, 0), 255);
+        pixels[3*i + 2] = std::min(std::max(value - 550, 0), 255);
     }
 
-    for (size_t i = 0; i < n_cells; i++)
+    if (format == image_format::binary)
     {
-        for (size_t j = 0; j < n_cells; j++)
+        image_file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+    }
+    else
+    {
+        for (size_t i = 0; i < n_cells*n_cells; i++)
         {
-            // r
-            image_file << std::min(static_cast<int>(density_xy[i * n_cells + j]), 255) << " ";
-            // g
-            image_file << std::min(std::max(static_cast<int>(density_xy[i * n_cells + j] - 255), 0), 255) << " ";
-            // b
-            image_file << std::min(std::max(static_cast<int>(density_xy[i * n_cells + j] - 550), 0), 255) << " ";
-
-            image_file << "\n";
+            image_file << static_cast<int>(pixels[3*i]) << " " << static_cast<int>(pixels[3*i + 1]) << " " << static_cast<int>(pixels[3*i + 2]) << " \n";
         }
     }
+    if(!image_file)
+    {
+        throw std::runtime_error("Failed to write image " + filename);
+    }
 }
 
-vector<double> correlationFunction(particle_group particles, int n_bins)
+vector<double> correlationFunction(particle_view particles, int n_bins, uint num_cells)
 {
     if(n_bins <= 0)
     {
         throw std::runtime_error("Correlation function requires a positive definite number of bins.");
     }
-
-    // Container for correlation function
-    std::vector<double> CR(n_bins, 0.0);
-
-    auto shortestDistance = [](double x1, double x2)
+    if (num_cells == 0)
     {
-        double d = std::abs(x1 - x2);
-        return d < 0.5 ? d : (1 - d);
-    };
-    
-    // Only take a limited sample of positions if there are too many 
-    int N = std::min(1000, int(particles.get_num_particles()));
-    for (int i = 0; i < N; i += 1)
+        num_cells = 4 * n_bins;
+    }
+    if (num_cells < 2 * static_cast<uint>(n_bins))
+    {
+        throw std::invalid_argument("Error - the correlation grid needs at least 2 cells per bin (num_cells >= 2 * n_bins)!");
+    }
+    size_t num_particles = particles.get_num_particles();
+    size_t num_cells_total = static_cast<size_t>(num_cells) * num_cells * num_cells;
+    size_t k_space_length = static_cast<size_t>(num_cells) * num_cells * (num_cells/2 + 1);
+    double * grid = (double *) fftw_malloc(sizeof(double) * num_cells_total);
+    fftw_complex * k_space = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * k_space_length);
+    std::fill(grid, grid + num_cells_total, 0.0);
+
+    // count particles per cell (nearest grid point, so each pair is counted at the separation of its cells)
+    #pragma omp parallel for
+    for (size_t p = 0; p < num_particles; p++)
     {
-        for (int j = i; j < N; j += 1)
+        uint cell[3];
+        for (uint dim = 0; dim < 3; dim++)
         {
+            uint c = particles.position[dim][p] * num_cells;
+            cell[dim] = c < num_cells ? c : num_cells - 1;
+        }
+        #pragma omp atomic
+        grid[cell[2] + num_cells * (cell[1] + static_cast<size_t>(num_cells) * cell[0])] += 1;
+    }
+
+    // autocorrelation of the counts: |FFT|^2 transformed back gives the number of pairs at every cell separation
+    std::shared_ptr<const FFTPlans> plans = FFTPlans::get_plans(num_cells, omp_get_max_threads());
+    plans->forward(grid, k_space);
+    #pragma omp parallel for simd
+    for (size_t k = 0; k < k_space_length; k++)
+    {
+        k_space[k][0] = k_space[k][0] * k_space[k][0] + k_space[k][1] * k_space[k][1];
+        k_space[k][1] = 0;
+    }
+    plans->backward(k_space, grid);
+    grid[0] -= static_cast<double>(num_particles) * num_cells_total; // remove each particle paired with itself
+
+    // uniformly distributed particles give N(N-1)/num_cells^3 ordered pairs per cell separation, and the unnormalised transforms multiply by num_cells^3
+    double expected_pairs = static_cast<double>(num_particles) * (num_particles - 1);
 
-            double dx = shortestDistance(particles.particles[i].position[0], particles.particles[j].position[0]);
-            double dy = shortestDistance(particles.particles[i].position[1], particles.particles[j].position[1]);
-            double dz = shortestDistance(particles.particles[i].position[2], particles.particles[j].position[2]);
-            double r = std::sqrt(dx * dx + dy * dy + dz * dz);
-            if(r < 0.5)  // within the 0.5 radius sphere to avoid edge effects from cube
+    int max_threads = omp_get_max_threads();
+    vector<vector<double>> thread_pairs(max_threads, vector<double>(n_bins, 0.0));
+    vector<vector<size_t>> thread_separations(max_threads, vector<size_t>(n_bins, 0));
+    #pragma omp parallel num_threads(max_threads)
+    {
+        vector<double> &pairs = thread_pairs[omp_get_thread_num()];
+        vector<size_t> &separations = thread_separations[omp_get_thread_num()];
+        int n = num_cells;
+        #pragma omp for collapse(2)
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
             {
-                int idx = static_cast<int>(r * n_bins * 2);
-                CR[idx] += 1 / (N * 4 * M_PI * r * r);
+                int di = std::min(i, n - i); // shortest periodic separation in cells
+                int dj = std::min(j, n - j);
+                size_t row_start = n * (j + static_cast<size_t>(n) * i);
+                for (int k = 0; k < n; k++)
+                {
+                    int dk = std::min(k, n - k);
+                    double r = std::sqrt(static_cast<double>(di * di + dj * dj + dk * dk)) / n;
+                    if (r < 0.5) // within the 0.5 radius sphere to avoid edge effects from cube
+                    {
+                        int idx = static_cast<int>(r * n_bins * 2);
+                        pairs[idx] += grid[row_start + k];
+                        separations[idx]++;
+                    }
+                }
             }
         }
     }
-    for (auto &c : CR)
+    fftw_free(grid);
+    fftw_free(k_space);
+
+    std::vector<double> CR(n_bins, 0.0);
+    std::vector<size_t> bin_separations(n_bins, 0);
+    for (int t = 0; t < max_threads; t++) // summed in thread order so the result does not depend on scheduling
     {
-        c = std::log(c);
+        for (int b = 0; b < n_bins; b++)
+        {
+            CR[b] += thread_pairs[t][b];
+            bin_separations[b] += thread_separations[t][b];
+        }
+    }
+    for (int b = 0; b < n_bins; b++)
+    {
+        CR[b] = std::log(CR[b] / (bin_separations[b] * expected_pairs));
     }
     return CR;
 }
@@ -144,6 +264,21 @@ void Save_Correlations_csv(const std::vector<std::vector<double>>& data, const s
     file.close();
 }
 
+void Append_csv_row(std::ostream& file, const std::vector<std::string>& labels, const std::vector<double>& values){
+    for (size_t i = 0; i < labels.size(); ++i) {
+        file << labels[i];
+        if (i < labels.size() - 1 || !values.empty()) file << ",";
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+        file << values[i];
+        if (i < values.size() - 1) file << ",";
+    }
+    file << std::endl; // flush so the row survives if a later job fails
+    if (!file) {
+        throw std::runtime_error("Failed to write to the file.");
+    }
+}
+
 
 
 void PotentialSavetoTxt(std::vector<double>& potential_vec, std::vector<double>& real_vec, std::string &filename){
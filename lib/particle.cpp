@@ -1,9 +1,18 @@
 #include "particle.hpp"
-#include <random>
 #include <stdexcept>
 #include <iostream>
+#include <cstdint>
 
-
+namespace {
+    /**
+     * @brief: SplitMix64 output function, a bijective mix of all 64 bits of the state.
+    */
+    inline uint64_t splitmix64_mix(uint64_t state){
+        state = (state ^ (state >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        state = (state ^ (state >> 27)) * 0x94D049BB133111EBULL;
+        return state ^ (state >> 31);
+    }
+}
 
 particle::particle(const std::array<double, 3> &initial_position){
     for (double pos: initial_position){
@@ -18,8 +27,9 @@ particle::particle(const std::array<double, 3> &initial_position){
 }
 
 
-particle_group::particle_group(double mass, uint num_particles, const std::vector<std::array<double,3>> &positions) : 
-                            mass(mass), num_particles(num_particles) 
+template <typename Real>
+basic_particle_group<Real>::basic_particle_group(double mass, uint num_particles, const std::vector<std::array<double,3>> &positions) : 
+                            mass(mass)
 {
     if (mass <= 0){
         throw std::invalid_argument("Error - The particle masses must be larger than 0!");
@@ -27,14 +37,19 @@ particle_group::particle_group(double mass, uint num_particles, const std::vecto
     if (num_particles != positions.size()){
         throw std::invalid_argument("Error - The number of particles does not match the size of the given position vector!");
     }
+    for (uint j = 0; j < 3; j++){
+        position[j].reserve(num_particles);
+        velocity[j].reserve(num_particles);
+    }
     for (uint i = 0; i < num_particles; i++){
-        particles.push_back(particle(positions[i]));
+        add_particle(particle(positions[i]));
     }
 }
 
 
-particle_group::particle_group(double mass, uint num_particles, uint random_seed) :
-                            mass(mass), num_particles(num_particles)
+template <typename Real>
+basic_particle_group<Real>::basic_particle_group(double mass, uint num_particles, uint random_seed, size_t first_particle) :
+                            mass(mass)
 {
     if (mass <= 0){
         throw std::invalid_argument("Error - The particle masses must be larger than 0!");
@@ -42,18 +57,65 @@ particle_group::particle_group(double mass, uint num_particles, uint random_seed
     if (num_particles > 10000000000){
         std::cerr << "Warning - More than 10,000,000,000 particles have been generated! This may negatively impact performance." << std::endl;
     }
-    std::default_random_engine generator(random_seed);
-    std::uniform_real_distribution<double> initial_dist(0, 1);
-    std::array<double, 3> initial_position;
-    for (uint i = 0; i < num_particles; i++){
+    for (uint j = 0; j < 3; j++){
+        position[j].resize(num_particles);
+        velocity[j].assign(num_particles, 0);
+    }
+    // coordinate j of particle i is the (3i + j)th output of the SplitMix64 sequence for the seed, which can be evaluated directly
+    // so every thread fills its own particles and the positions do not depend on the number of threads
+    uint64_t seed_state = splitmix64_mix(random_seed);
+    Real * coordinates[3] = {position[0].data(), position[1].data(), position[2].data()};
+    #pragma omp parallel for
+    for (size_t i = 0; i < num_particles; i++){
         for (uint j = 0; j < 3; j++){
-            initial_position[j] = initial_dist(generator);
+            uint64_t counter = 3 * static_cast<uint64_t>(first_particle + i) + j + 1;
+            uint64_t random_bits = splitmix64_mix(seed_state + counter * 0x9E3779B97F4A7C15ULL);
+            coordinates[j][i] = to_unit_interval((random_bits >> 11) * 0x1.0p-53); // top 53 bits give a uniform double in [0, 1)
         }
-        particles.push_back(particle(initial_position));
     }
 }
 
-size_t particle_group::get_num_particles(){
-    num_particles = particles.size();
+template <typename Real>
+size_t basic_particle_group<Real>::get_num_particles() const {
+    return position[0].size();
+}
+
+template <typename Real>
+void basic_particle_group<Real>::add_particle(const particle &new_particle){
+    for (uint j = 0; j < 3; j++){
+        position[j].push_back(to_unit_interval(new_particle.position[j]));
+        velocity[j].push_back(new_particle.velocity[j]);
+    }
+}
+
+template <typename Real>
+particle basic_particle_group<Real>::get_particle(size_t index) const {
+    particle single_particle(get_position(index));
+    single_particle.velocity = get_velocity(index);
+    return single_particle;
+}
+
+template <typename Real>
+std::array<double, 3> basic_particle_group<Real>::get_position(size_t index) const {
+    return {position[0][index], position[1][index], position[2][index]};
+}
+
+template <typename Real>
+std::array<double, 3> basic_particle_group<Real>::get_velocity(size_t index) const {
+    return {velocity[0][index], velocity[1][index], velocity[2][index]};
+}
+
+template <typename Real>
+basic_particle_view<Real>::basic_particle_view(const basic_particle_group<Real> &group) : mass(group.mass), num_particles(group.get_num_particles()),
+    position{group.position[0].data(), group.position[1].data(), group.position[2].data()},
+    velocity{group.velocity[0].data(), group.velocity[1].data(), group.velocity[2].data()} {}
+
+template <typename Real>
+size_t basic_particle_view<Real>::get_num_particles() const {
     return num_particles;
-}
\ No newline at end of file
+}
+
+template class basic_particle_group<double>;
+template class basic_particle_group<float>;
+template struct basic_particle_view<double>;
+template struct basic_particle_view<float>;
@@ -0,0 +1,109 @@
+#include <catch2/catch_session.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_all.hpp>
+#include <mpi.h>
+#include <cmath>
+#include "DistributedSimulation.hpp"
+#include "Simulation.hpp"
+
+using namespace Catch::Matchers;
+
+// run with any number of processes, e.g. mpirun -np 3 TestDistributedSimulation
+
+/**
+ * @brief: Share of the num_particles particles of random_seed that the calling process generates.
+*/
+particle_group LocalParticles(double mass, uint num_particles, uint random_seed)
+{
+    int process_id, num_proc;
+    MPI_Comm_rank(MPI_COMM_WORLD, &process_id);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_proc);
+    uint share = num_particles / num_proc;
+    uint remainder = num_particles % num_proc;
+    uint local_particles = share + (static_cast<uint>(process_id) < remainder ? 1 : 0);
+    size_t first_particle = process_id * share + std::min<uint>(process_id, remainder);
+    return particle_group(mass, local_particles, random_seed, first_particle);
+}
+
+TEST_CASE("Test DistributedSimulation constructor for error handling with invalid arguments", "[Distributed_Simulation]"){
+    int num_proc;
+    MPI_Comm_size(MPI_COMM_WORLD, &num_proc);
+    particle_group particles(0.01, 0, {});
+    REQUIRE_THROWS(DistributedSimulation(-1, 0.1, particles, 1, 8 * num_proc, 2));
+    REQUIRE_THROWS(DistributedSimulation(1, -0.1, particles, 1, 8 * num_proc, 2));
+    REQUIRE_THROWS(DistributedSimulation(1, 0.1, particles, -1, 8 * num_proc, 2));
+    REQUIRE_THROWS(DistributedSimulation(1, 0.1, particles, 1, 8 * num_proc, -2));
+    REQUIRE_THROWS(DistributedSimulation(1, 0.1, particles, 1, 2 * num_proc - 1, 2)); // a slab needs at least 2 planes
+}
+
+TEST_CASE("Ensure the distributed density and potential match a single process simulation", "[Distributed_Simulation]"){
+    uint num_cells = 12;
+    uint num_particles = 2000;
+    double mass = 0.5;
+    double width = 10.0;
+    for (mass_assignment scheme : {mass_assignment::NGP, mass_assignment::CIC, mass_assignment::TSC}){
+        Simulation sim(1, 0.1, particle_group(mass, num_particles, 7), width, num_cells, 1.0, scheme);
+        DistributedSimulation distributed_sim(1, 0.1, LocalParticles(mass, num_particles, 7), width, num_cells, 1.0, scheme);
+        sim.fill_density_buffer();
+        sim.fill_potential_buffer();
+        distributed_sim.fill_density_buffer();
+        distributed_sim.fill_potential_buffer();
+
+        size_t plane_size = num_cells * num_cells;
+        size_t slab_start = distributed_sim.get_local_first_plane() * plane_size;
+        for (size_t i = 0; i < distributed_sim.get_local_num_planes() * plane_size; i++){
+            REQUIRE_THAT(distributed_sim.get_density_slab()[i], WithinAbs(sim.get_density_buffer()[slab_start + i], 1e-9));
+            REQUIRE_THAT(distributed_sim.get_potential_slab()[i], WithinAbs(sim.get_potential_buffer()[slab_start + i], 1e-9));
+        }
+    }
+}
+
+TEST_CASE("Ensure distributed particles follow a single process simulation and are conserved when they change slab", "[Distributed_Simulation]"){
+    uint num_cells = 10;
+    uint num_particles = 500;
+    double mass = 2.0;
+    double width = 10.0;
+    Simulation sim(1, 0.05, particle_group(mass, num_particles, 3), width, num_cells, 1.01, mass_assignment::CIC);
+    DistributedSimulation distributed_sim(1, 0.05, LocalParticles(mass, num_particles, 3), width, num_cells, 1.01, mass_assignment::CIC);
+    for (uint step = 0; step < 10; step++){
+        sim.fill_density_buffer();
+        sim.fill_potential_buffer();
+        sim.update_particles();
+        sim.box_expansion();
+        distributed_sim.fill_density_buffer();
+        distributed_sim.fill_potential_buffer();
+        distributed_sim.update_particles();
+        distributed_sim.box_expansion();
+    }
+
+    // every particle must be owned by the process of its slab and none may be lost or duplicated
+    const particle_group & local_particles = distributed_sim.get_local_particles();
+    uint first_plane = distributed_sim.get_local_first_plane();
+    uint last_plane = first_plane + distributed_sim.get_local_num_planes();
+    for (size_t i = 0; i < local_particles.get_num_particles(); i++){
+        uint plane = std::floor(local_particles.position[0][i] * num_cells);
+        REQUIRE(plane >= first_plane);
+        REQUIRE(plane < last_plane);
+    }
+    unsigned long long local_count = local_particles.get_num_particles(), total_count = 0;
+    MPI_Allreduce(&local_count, &total_count, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    REQUIRE(total_count == num_particles);
+
+    // the particles are in a different order, so compare the densities they deposit
+    sim.fill_density_buffer();
+    distributed_sim.fill_density_buffer();
+    std::vector<double> density = distributed_sim.gather_density();
+    if (distributed_sim.get_rank() == 0){
+        for (size_t i = 0; i < density.size(); i++){
+            REQUIRE_THAT(density[i], WithinAbs(sim.get_density_buffer()[i], 1e-6));
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    MPI_Init(&argc, &argv);
+    int result = Catch::Session().run(argc, argv);
+    MPI_Finalize();
+    return result;
+}
@@ -2,9 +2,22 @@
 #include <catch2/matchers/catch_matchers_all.hpp>
 #include <cmath>
 #include "Simulation.hpp"
+#include "FFTPlans.hpp"
+#include "GreenFunction.hpp"
+#include "Checkpoint.hpp"
+#include "Snapshot.hpp"
+#include "OutputWriter.hpp"
+#include "PowerSpectrum.hpp"
+#include "SpatialSort.hpp"
 #include "Utils.hpp"
 #include <iostream>
 #include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <omp.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 using namespace Catch::Matchers;
 
@@ -33,6 +46,20 @@ TEST_CASE("Test particle group constructor for error handling with invalid argum
     REQUIRE_THROWS(particle_group(1, number_particles, {{1,1,1}}));
 }
 
+TEST_CASE("Test particle group stores coordinates in separate aligned arrays","[particle_constructor]"){
+    std::vector<std::array<double, 3>> particle_pos = {{0.1, 0.2, 0.3}, {0.4, 0.5, 0.6}, {0.7, 0.8, 0.9}};
+    particle_group particles(1, 3, particle_pos);
+    REQUIRE(particles.get_num_particles() == 3);
+    for (uint dim = 0; dim < 3; dim++){
+        REQUIRE(reinterpret_cast<std::uintptr_t>(particles.position[dim].data()) % 64 == 0);
+        REQUIRE(reinterpret_cast<std::uintptr_t>(particles.velocity[dim].data()) % 64 == 0);
+        for (uint i = 0; i < 3; i++){
+            REQUIRE(particles.position[dim][i] == particle_pos[i][dim]);
+            REQUIRE(particles.get_position(i)[dim] == particle_pos[i][dim]);
+            REQUIRE(particles.get_velocity(i)[dim] == 0);
+        }
+    }
+}
 
 TEST_CASE("Test density calculation function for no particles","[Density_Calc]"){
     double mass = 0.01;
@@ -43,10 +70,9 @@ TEST_CASE("Test density calculation function for no particles","[Density_Calc]")
     double cell_width = width/num_cells;
     Simulation sim(10, 0.1, particles, width, num_cells, 2);
     sim.fill_density_buffer();
-    const fftw_complex* density_buffer = sim.get_density_buffer();
+    const double* density_buffer = sim.get_density_buffer();
     for (uint i = 0; i < num_cells * num_cells * num_cells; i++){
-        CHECK(density_buffer[i][1] == 0);
-        CHECK_THAT(density_buffer[i][0], WithinRel(0,1e-10));
+        CHECK_THAT(density_buffer[i], WithinRel(0,1e-10));
     }
 }
 
@@ -60,14 +86,13 @@ TEST_CASE("Test density calculation function for a single particle","[Density_Ca
     double cell_width = width/num_cells;
     Simulation sim(10, 0.1, particles, width, num_cells, 2);
     sim.fill_density_buffer();
-    const fftw_complex* density_buffer = sim.get_density_buffer();
+    const double* density_buffer = sim.get_density_buffer();
     for (uint i = 0; i < num_cells * num_cells * num_cells; i++){
-        CHECK(density_buffer[i][1] == 0);
         if (45 + num_cells * (45 + num_cells * 45) == i){
-            CHECK_THAT(density_buffer[i][0], WithinRel(mass/(cell_width * cell_width * cell_width),1e-10));
+            CHECK_THAT(density_buffer[i], WithinRel(mass/(cell_width * cell_width * cell_width),1e-10));
         }
         else{
-            CHECK_THAT(density_buffer[i][0], WithinRel(0,1e-10));
+            CHECK_THAT(density_buffer[i], WithinRel(0,1e-10));
         }
     }
 }
@@ -83,7 +108,7 @@ TEST_CASE("Test density calculation function for multiple particles","[Density_C
     particle_group particles(mass, number_particles, particle_pos);
     Simulation sim(10, 0.1, particles, width, num_cells, 2);
     sim.fill_density_buffer();
-    const fftw_complex* density_buffer = sim.get_density_buffer();
+    const double* density_buffer = sim.get_density_buffer();
     for (uint i = 0; i < num_cells * num_cells * num_cells; i++){
         // set conditions for single particle cells
         bool condition1 = (1 + num_cells * (2 + num_cells * 3) == i);
@@ -94,20 +119,82 @@ TEST_CASE("Test density calculation function for multiple particles","[Density_C
         bool condition6 = (2 + num_cells * (2 + num_cells * 2) == i);
         bool condition7 = (3 + num_cells * (2 + num_cells * 1) == i);
         
-        CHECK(density_buffer[i][1] == 0);
         if (4 + num_cells * (4 + num_cells * 4) == i){
-            CHECK_THAT(density_buffer[i][0], WithinRel(3 * mass/(cell_width * cell_width * cell_width),1e-10));
+            CHECK_THAT(density_buffer[i], WithinRel(3 * mass/(cell_width * cell_width * cell_width),1e-10));
         }
         else if ( condition1|| condition2 || condition3 || condition4 || condition5 || condition6 || condition7)
         {
-            CHECK_THAT(density_buffer[i][0], WithinRel(mass/(cell_width * cell_width * cell_width),1e-10));
+            CHECK_THAT(density_buffer[i], WithinRel(mass/(cell_width * cell_width * cell_width),1e-10));
         }
         else{
-            CHECK_THAT(density_buffer[i][0], WithinRel(0,1e-10));
+            CHECK_THAT(density_buffer[i], WithinRel(0,1e-10));
         }
     }
 }
 
+TEST_CASE("Test CIC density calculation shares mass equally between cells around a cell corner","[Density_Calc]"){
+    double mass = 0.01;
+    double width = 1;
+    uint num_cells = 8;
+    double cell_width = width/num_cells;
+    particle_group particles(mass, 1, {{0.25, 0.25, 0.25}}); // corner shared by cells 1 and 2 in every dimension
+    Simulation sim(10, 0.1, particles, width, num_cells, 2, mass_assignment::CIC);
+    sim.fill_density_buffer();
+    const double* density_buffer = sim.get_density_buffer();
+    for (uint i = 0; i < num_cells; i++){
+        for (uint j = 0; j < num_cells; j++){
+            for (uint k = 0; k < num_cells; k++){
+                bool shared_cell = (i == 1 || i == 2) && (j == 1 || j == 2) && (k == 1 || k == 2);
+                double expected = shared_cell ? mass/(8 * cell_width * cell_width * cell_width) : 0;
+                CHECK_THAT(density_buffer[k + num_cells * (j + num_cells * i)], WithinAbs(expected, 1e-10));
+            }
+        }
+    }
+}
+
+TEST_CASE("Test TSC density calculation weights and mass conservation","[Density_Calc]"){
+    double mass = 0.01;
+    double width = 1;
+    uint num_cells = 8;
+    double cell_width = width/num_cells;
+    particle_group particles(mass, 2, {{0.5625, 0.5625, 0.5625}, {0.01, 0.99, 0.37}}); // first particle at the centre of cell 4
+    Simulation sim(10, 0.1, particles, width, num_cells, 2, mass_assignment::TSC);
+    sim.fill_density_buffer();
+    const double* density_buffer = sim.get_density_buffer();
+    double single_density = mass/(cell_width * cell_width * cell_width);
+    CHECK_THAT(density_buffer[4 + num_cells * (4 + num_cells * 4)], WithinRel(0.75 * 0.75 * 0.75 * single_density, 1e-10));
+    CHECK_THAT(density_buffer[4 + num_cells * (4 + num_cells * 3)], WithinRel(0.125 * 0.75 * 0.75 * single_density, 1e-10));
+    CHECK_THAT(density_buffer[5 + num_cells * (5 + num_cells * 5)], WithinRel(0.125 * 0.125 * 0.125 * single_density, 1e-10));
+    double total = std::accumulate(density_buffer, density_buffer + num_cells * num_cells * num_cells, 0.0);
+    CHECK_THAT(total, WithinRel(2 * single_density, 1e-10)); // second particle wraps around the boundaries
+}
+
+TEST_CASE("Test plane binned density deposit matches the atomic deposit and is independent of thread count","[Density_Calc]"){
+    particle_group particles(0.01, 5000, 7);
+    int max_threads = omp_get_max_threads();
+    for (uint num_cells : {2, 4, 10, 11}){
+        for (mass_assignment scheme : {mass_assignment::NGP, mass_assignment::CIC, mass_assignment::TSC}){
+            uint buffer_length = num_cells * num_cells * num_cells;
+            Simulation sim(10, 0.1, particles, 1, num_cells, 2, scheme);
+            sim.set_deposit_method(deposit_method::atomic);
+            sim.fill_density_buffer();
+            std::vector<double> atomic_density(sim.get_density_buffer(), sim.get_density_buffer() + buffer_length);
+
+            sim.set_deposit_method(deposit_method::plane_binned);
+            omp_set_num_threads(1);
+            sim.fill_density_buffer();
+            std::vector<double> serial_density(sim.get_density_buffer(), sim.get_density_buffer() + buffer_length);
+            omp_set_num_threads(4);
+            sim.fill_density_buffer();
+            omp_set_num_threads(max_threads);
+
+            for (uint i = 0; i < buffer_length; i++){
+                REQUIRE(sim.get_density_buffer()[i] == serial_density[i]); // bitwise identical whatever the thread count
+                REQUIRE_THAT(sim.get_density_buffer()[i], WithinRel(atomic_density[i], 1e-10));
+            }
+        }
+    }
+}
 
 /**
  * @brief Fill out this test function by filling in the TODOs
@@ -153,7 +240,7 @@ TEST_CASE("Test potential function for single particle", "[Potential_Calc]")
             double dx1 = std::abs(i - 50) * w_c;
             double dx2 = std::abs(i - 151) * w_c;
             double dx3 = std::abs(i + 51) * w_c;
-            double pot = sim.get_potential_buffer()[k + ncells * (j + ncells * i)][0]; //TODO = your potential function at indices (i,j,k)
+            double pot = sim.get_potential_buffer()[k + ncells * (j + ncells * i)]; //TODO = your potential function at indices (i,j,k)
             double expected_pot =  -mass *(1/ dx1 + 1/dx2 + 1/dx3);
             double diff = pot - expected_pot;
             REQUIRE_THAT(pot, WithinRel(expected_pot, 0.3));
@@ -170,8 +257,8 @@ TEST_CASE("Test gradient function for periodic f(x) = sin(x) + cos(y) + sin(z)",
     double width = 2*M_PI;
 
     uint buffer_length = num_cells * num_cells * num_cells;
-    fftw_complex * test_func_buffer = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * buffer_length);
-    std::memset(test_func_buffer, 0, sizeof(fftw_complex) * buffer_length);
+    double * test_func_buffer = (double *) fftw_malloc(sizeof(double) * buffer_length);
+    std::memset(test_func_buffer, 0, sizeof(double) * buffer_length);
     std::vector<double> func(buffer_length, 0);
     std::vector<std::vector<std::vector<std::array<double, 3>>>> test_grad;
     
@@ -183,7 +270,7 @@ TEST_CASE("Test gradient function for periodic f(x) = sin(x) + cos(y) + sin(z)",
                 double x = width * (i + 0.5)/num_cells;
                 double y = width * (j + 0.5)/num_cells;
                 double z = width * (k + 0.5)/num_cells;
-                test_func_buffer[k + num_cells * (j + num_cells * i)][0] = std::sin(x) + std::cos(y) + std::sin(z);
+                test_func_buffer[k + num_cells * (j + num_cells * i)] = std::sin(x) + std::cos(y) + std::sin(z);
                 std::array<double, 3> test_grad_section;
                 test_grad_section[0] = std::cos(x);
                 test_grad_section[1] = - std::sin(y);
@@ -198,14 +285,15 @@ TEST_CASE("Test gradient function for periodic f(x) = sin(x) + cos(y) + sin(z)",
     particle_group particles(1, 1, {{0.5, 0.5, 0.5}});
     Simulation sim(10, 1, particles, width, num_cells, 3);
 
-    std::vector<std::vector<std::vector<std::array<double, 3>>>> grad = sim.calculate_gradient(test_func_buffer);
+    const double * grad = sim.calculate_gradient(test_func_buffer);
+    size_t stride = sim.get_gradient_stride();
     
     for (uint i = 0; i < num_cells; i++){
         for (uint j = 0; j < num_cells; j++){
             for (uint k = 0; k < num_cells; k++){
-                REQUIRE_THAT(grad[i][j][k][0], WithinRel(test_grad[i][j][k][0], 1e-3));
-                REQUIRE_THAT(grad[i][j][k][1], WithinRel(test_grad[i][j][k][1], 1e-3));
-                REQUIRE_THAT(grad[i][j][k][2], WithinRel(test_grad[i][j][k][2], 1e-3));
+                REQUIRE_THAT(grad[k + num_cells * (j + num_cells * i)], WithinRel(test_grad[i][j][k][0], 1e-3));
+                REQUIRE_THAT(grad[stride + k + num_cells * (j + num_cells * i)], WithinRel(test_grad[i][j][k][1], 1e-3));
+                REQUIRE_THAT(grad[2 * stride + k + num_cells * (j + num_cells * i)], WithinRel(test_grad[i][j][k][2], 1e-3));
             }
         }
     }
@@ -219,8 +307,8 @@ TEST_CASE("Test gradient function for periodic f(x) = sin(x) + sin(y) + sin(z)",
     double width = 2*M_PI;
 
     uint buffer_length = num_cells * num_cells * num_cells;
-    fftw_complex * test_func_buffer = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * buffer_length);
-    std::memset(test_func_buffer, 0, sizeof(fftw_complex) * buffer_length);
+    double * test_func_buffer = (double *) fftw_malloc(sizeof(double) * buffer_length);
+    std::memset(test_func_buffer, 0, sizeof(double) * buffer_length);
     std::vector<double> func(buffer_length, 0);
     std::vector<std::vector<std::vector<std::array<double, 3>>>> test_grad;
     
@@ -232,7 +320,7 @@ TEST_CASE("Test gradient function for periodic f(x) = sin(x) + sin(y) + sin(z)",
                 double x = width * (i + 0.5)/num_cells;
                 double y = width * (j + 0.5)/num_cells;
                 double z = width * (k + 0.5)/num_cells;
-                test_func_buffer[k + num_cells * (j + num_cells * i)][0] = std::sin(x) + std::sin(y) + std::sin(z);
+                test_func_buffer[k + num_cells * (j + num_cells * i)] = std::sin(x) + std::sin(y) + std::sin(z);
                 std::array<double, 3> test_grad_section;
                 test_grad_section[0] = std::cos(x);
                 test_grad_section[1] = std::cos(y);
@@ -247,14 +335,15 @@ TEST_CASE("Test gradient function for periodic f(x) = sin(x) + sin(y) + sin(z)",
     particle_group particles(1, 1, {{0.5, 0.5, 0.5}});
     Simulation sim(10, 1, particles, width, num_cells, 3);
 
-    std::vector<std::vector<std::vector<std::array<double, 3>>>> grad = sim.calculate_gradient(test_func_buffer);
+    const double * grad = sim.calculate_gradient(test_func_buffer);
+    size_t stride = sim.get_gradient_stride();
     
     for (uint i = 0; i < num_cells; i++){
         for (uint j = 0; j < num_cells; j++){
             for (uint k = 0; k < num_cells; k++){
-                REQUIRE_THAT(grad[i][j][k][0], WithinRel(test_grad[i][j][k][0], 1e-3));
-                REQUIRE_THAT(grad[i][j][k][1], WithinRel(test_grad[i][j][k][1], 1e-3));
-                REQUIRE_THAT(grad[i][j][k][2], WithinRel(test_grad[i][j][k][2], 1e-3));
+                REQUIRE_THAT(grad[k + num_cells * (j + num_cells * i)], WithinRel(test_grad[i][j][k][0], 1e-3));
+                REQUIRE_THAT(grad[stride + k + num_cells * (j + num_cells * i)], WithinRel(test_grad[i][j][k][1], 1e-3));
+                REQUIRE_THAT(grad[2 * stride + k + num_cells * (j + num_cells * i)], WithinRel(test_grad[i][j][k][2], 1e-3));
             }
         }
     }
@@ -268,8 +357,8 @@ TEST_CASE("Test gradient function for periodic f(x) = cos^2(x) + sin^2(y) + cos(
     double width =2 * M_PI;
 
     uint buffer_length = num_cells * num_cells * num_cells;
-    fftw_complex * test_func_buffer = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * buffer_length);
-    std::memset(test_func_buffer, 0, sizeof(fftw_complex) * buffer_length);
+    double * test_func_buffer = (double *) fftw_malloc(sizeof(double) * buffer_length);
+    std::memset(test_func_buffer, 0, sizeof(double) * buffer_length);
     std::vector<double> func(buffer_length, 0);
     std::vector<std::vector<std::vector<std::array<double, 3>>>> test_grad;
     
@@ -281,7 +370,7 @@ TEST_CASE("Test gradient function for periodic f(x) = cos^2(x) + sin^2(y) + cos(
                 double x = width * (i + 0.5)/num_cells;
                 double y = width * (j + 0.5)/num_cells;
                 double z = width * (k + 0.5)/num_cells;
-                test_func_buffer[k + num_cells * (j + num_cells * i)][0] = std::cos(x) * std::cos(x) + std::sin(y) * std::sin(y) + std::cos(z);
+                test_func_buffer[k + num_cells * (j + num_cells * i)] = std::cos(x) * std::cos(x) + std::sin(y) * std::sin(y) + std::cos(z);
                 std::array<double, 3> test_grad_section;
                 test_grad_section[0] = -2 * std::sin(x) * std::cos(x);
                 test_grad_section[1] = 2 * std::sin(y) * std::cos(y);
@@ -296,14 +385,15 @@ TEST_CASE("Test gradient function for periodic f(x) = cos^2(x) + sin^2(y) + cos(
     particle_group particles(1, 1, {{0.5, 0.5, 0.5}});
     Simulation sim(10, 1, particles, width, num_cells, 3);
 
-    std::vector<std::vector<std::vector<std::array<double, 3>>>> grad = sim.calculate_gradient(test_func_buffer);
+    const double * grad = sim.calculate_gradient(test_func_buffer);
+    size_t stride = sim.get_gradient_stride();
     
     for (uint i = 0; i < num_cells; i++){
         for (uint j = 0; j < num_cells; j++){
             for (uint k = 0; k < num_cells; k++){
-                REQUIRE_THAT(grad[i][j][k][0], WithinRel(test_grad[i][j][k][0], 0.3));
-                REQUIRE_THAT(grad[i][j][k][1], WithinRel(test_grad[i][j][k][1], 0.3));
-                REQUIRE_THAT(grad[i][j][k][2], WithinRel(test_grad[i][j][k][2], 0.3));
+                REQUIRE_THAT(grad[k + num_cells * (j + num_cells * i)], WithinRel(test_grad[i][j][k][0], 0.3));
+                REQUIRE_THAT(grad[stride + k + num_cells * (j + num_cells * i)], WithinRel(test_grad[i][j][k][1], 0.3));
+                REQUIRE_THAT(grad[2 * stride + k + num_cells * (j + num_cells * i)], WithinRel(test_grad[i][j][k][2], 0.3));
             }
         }
     }
@@ -329,9 +419,9 @@ TEST_CASE("Ensure two particles approach each other:","[Update_Particle]"){
         const particle_group particle_collection = sim.get_particle_collection(); // testing particles approaching each other
         
         // given limited timesteps the particles must approach each other. Calculating total distance
-        double new_distance = std::pow((particle_collection.particles[0].position[0] - particle_collection.particles[1].position[0]), 2);
-        new_distance += std::pow((particle_collection.particles[0].position[1] - particle_collection.particles[1].position[1]), 2);
-        new_distance += std::pow((particle_collection.particles[0].position[2] - particle_collection.particles[1].position[2]), 2);
+        double new_distance = std::pow((particle_collection.get_position(0)[0] - particle_collection.get_position(1)[0]), 2);
+        new_distance += std::pow((particle_collection.get_position(0)[1] - particle_collection.get_position(1)[1]), 2);
+        new_distance += std::pow((particle_collection.get_position(0)[2] - particle_collection.get_position(1)[2]), 2);
         new_distance = std::sqrt(new_distance);
         REQUIRE(new_distance < prev_distance);
         prev_distance = new_distance;
@@ -363,17 +453,17 @@ TEST_CASE("Ensure displacement is centered around 0", "[Update_Particle]"){
         
         // given limited timesteps the particles must approach each other. Calculating total distance
 
-        double distance_x = (particle_collection.particles[0].position[0] - particle_collection.particles[1].position[0]);
-        double distance_y = (particle_collection.particles[0].position[1] - particle_collection.particles[1].position[1]);
-        double distance_z = (particle_collection.particles[0].position[2] - particle_collection.particles[1].position[2]);
+        double distance_x = (particle_collection.get_position(0)[0] - particle_collection.get_position(1)[0]);
+        double distance_y = (particle_collection.get_position(0)[1] - particle_collection.get_position(1)[1]);
+        double distance_z = (particle_collection.get_position(0)[2] - particle_collection.get_position(1)[2]);
 
         distances_x.push_back(distance_x);
         distances_y.push_back(distance_y);
         distances_z.push_back(distance_z);
 
-        double velocity_x = (particle_collection.particles[0].velocity[0] - particle_collection.particles[1].velocity[0]);
-        double velocity_y = (particle_collection.particles[0].velocity[1] - particle_collection.particles[1].velocity[1]);
-        double velocity_z = (particle_collection.particles[0].velocity[2] - particle_collection.particles[1].velocity[2]);
+        double velocity_x = (particle_collection.get_velocity(0)[0] - particle_collection.get_velocity(1)[0]);
+        double velocity_y = (particle_collection.get_velocity(0)[1] - particle_collection.get_velocity(1)[1]);
+        double velocity_z = (particle_collection.get_velocity(0)[2] - particle_collection.get_velocity(1)[2]);
 
         velocities_x.push_back(velocity_x);
         velocities_y.push_back(velocity_y);
@@ -420,19 +510,1174 @@ TEST_CASE("Ensure particles remain stationary when distance between them through
         
         // particles must remain stationary as gravitational force in either direction is the same. Total field at particle coordinates is uniform
 
-        REQUIRE_THAT(particle_collection.particles[0].position[0], WithinRel(0.25,1e-6));
-        REQUIRE_THAT(particle_collection.particles[0].position[1], WithinRel(0.25,1e-6));
-        REQUIRE_THAT(particle_collection.particles[0].position[2], WithinRel(0.25,1e-6));
-        REQUIRE_THAT(particle_collection.particles[1].position[0], WithinRel(0.75,1e-6));
-        REQUIRE_THAT(particle_collection.particles[1].position[1], WithinRel(0.75,1e-6));
-        REQUIRE_THAT(particle_collection.particles[1].position[2], WithinRel(0.75,1e-6));
+        REQUIRE_THAT(particle_collection.get_position(0)[0], WithinRel(0.25,1e-6));
+        REQUIRE_THAT(particle_collection.get_position(0)[1], WithinRel(0.25,1e-6));
+        REQUIRE_THAT(particle_collection.get_position(0)[2], WithinRel(0.25,1e-6));
+        REQUIRE_THAT(particle_collection.get_position(1)[0], WithinRel(0.75,1e-6));
+        REQUIRE_THAT(particle_collection.get_position(1)[1], WithinRel(0.75,1e-6));
+        REQUIRE_THAT(particle_collection.get_position(1)[2], WithinRel(0.75,1e-6));
         
-        REQUIRE_THAT(particle_collection.particles[0].velocity[0], WithinAbs(0,1e-6));
-        REQUIRE_THAT(particle_collection.particles[0].velocity[1], WithinAbs(0,1e-6));
-        REQUIRE_THAT(particle_collection.particles[0].velocity[2], WithinAbs(0,1e-6));
-        REQUIRE_THAT(particle_collection.particles[1].velocity[0], WithinAbs(0,1e-6));
-        REQUIRE_THAT(particle_collection.particles[1].velocity[1], WithinAbs(0,1e-6));
-        REQUIRE_THAT(particle_collection.particles[1].velocity[2], WithinAbs(0,1e-6));
+        REQUIRE_THAT(particle_collection.get_velocity(0)[0], WithinAbs(0,1e-6));
+        REQUIRE_THAT(particle_collection.get_velocity(0)[1], WithinAbs(0,1e-6));
+        REQUIRE_THAT(particle_collection.get_velocity(0)[2], WithinAbs(0,1e-6));
+        REQUIRE_THAT(particle_collection.get_velocity(1)[0], WithinAbs(0,1e-6));
+        REQUIRE_THAT(particle_collection.get_velocity(1)[1], WithinAbs(0,1e-6));
+        REQUIRE_THAT(particle_collection.get_velocity(1)[2], WithinAbs(0,1e-6));
+    }
+
+}
+TEST_CASE("Ensure FFTW wisdom is saved and reloaded for the grid size and thread count","[FFT_Plans]"){
+    std::string wisdom_folder = (std::filesystem::temp_directory_path() / "pm_simulation_test_wisdom").string();
+    uint num_cells = 12;
+    int num_threads = omp_get_max_threads();
+    std::string wisdom_file = FFTPlans::wisdom_filename(wisdom_folder, num_cells, num_threads);
+    std::filesystem::remove(wisdom_file);
+
+    particle_group particles(0.1, 1, {{0.5, 0.5, 0.5}});
+    FFTPlans::clear_cache();
+    Simulation sim(10, 0.1, particles, 1, num_cells, 1, mass_assignment::NGP, wisdom_folder);
+    REQUIRE(std::filesystem::exists(wisdom_file));
+    REQUIRE_FALSE(FFTPlans::get_plans(num_cells, num_threads)->get_wisdom_imported());
+
+    FFTPlans::clear_cache(); // plans are shared so clear them to force planning again
+    Simulation sim_with_wisdom(10, 0.1, particles, 1, num_cells, 1, mass_assignment::NGP, wisdom_folder);
+    REQUIRE(FFTPlans::get_plans(num_cells, num_threads)->get_wisdom_imported());
+}
+
+TEST_CASE("Ensure two particles approach each other with CIC and TSC mass assignment","[Update_Particle]"){
+    for (mass_assignment scheme : {mass_assignment::CIC, mass_assignment::TSC}){
+        particle_group particles(0.1, 2, {{0.3, 0.3, 0.3}, {0.7, 0.7, 0.7}});
+        Simulation sim(10, 0.1, particles, 1, 32, 2, scheme);
+        double prev_distance = std::sqrt(0.4 * 0.4 * 3);
+        for (uint i = 0; i < 10; i++){
+            sim.fill_density_buffer();
+            sim.fill_potential_buffer();
+            sim.update_particles();
+            const particle_group &particle_collection = sim.get_particle_collection();
+            double new_distance = 0;
+            for (uint dim = 0; dim < 3; dim++){
+                new_distance += std::pow(particle_collection.get_position(0)[dim] - particle_collection.get_position(1)[dim], 2);
+            }
+            new_distance = std::sqrt(new_distance);
+            REQUIRE(new_distance < prev_distance);
+            prev_distance = new_distance;
+        }
+    }
+}
+
+TEST_CASE("Ensure symmetric particles remain stationary with CIC and TSC mass assignment","[Update_Particle]"){
+    for (mass_assignment scheme : {mass_assignment::CIC, mass_assignment::TSC}){
+        particle_group particles(0.1, 2, {{0.25, 0.25, 0.25}, {0.75, 0.75, 0.75}});
+        Simulation sim(10, 0.01, particles, 1, 10, 2, scheme);
+        for (uint i = 0; i < 200; i++){
+            sim.fill_density_buffer();
+            sim.fill_potential_buffer();
+            sim.update_particles();
+        }
+        const particle_group &particle_collection = sim.get_particle_collection();
+        for (uint dim = 0; dim < 3; dim++){
+            REQUIRE_THAT(particle_collection.get_position(0)[dim], WithinRel(0.25, 1e-6));
+            REQUIRE_THAT(particle_collection.get_position(1)[dim], WithinRel(0.75, 1e-6));
+            REQUIRE_THAT(particle_collection.get_velocity(0)[dim], WithinAbs(0, 1e-6));
+            REQUIRE_THAT(particle_collection.get_velocity(1)[dim], WithinAbs(0, 1e-6));
+        }
+    }
+}
+
+TEST_CASE("Ensure the spectral gradient differentiates a single density mode exactly","[Gradient_Function]"){
+    // a lattice displaced along x by a sine wave has a density made of a single mode along x
+    uint lattice_size = 32;
+    uint num_cells = 16;
+    int mode = 4;
+    double amplitude = 0.1;
+    particle_group particles(0.001, 0, {});
+    for (uint i = 0; i < lattice_size; i++){
+        for (uint j = 0; j < lattice_size; j++){
+            for (uint k = 0; k < lattice_size; k++){
+                double x = (i + 0.5) / lattice_size;
+                x += amplitude * std::sin(2 * M_PI * mode * x) / (2 * M_PI * mode);
+                particles.add_particle(particle({x, (j + 0.5) / lattice_size, (k + 0.5) / lattice_size}));
+            }
+        }
+    }
+    Simulation finite_difference_sim(1, 0.1, particles, 1, num_cells, 1, mass_assignment::CIC);
+    Simulation spectral_sim(1, 0.1, particles, 1, num_cells, 1, mass_assignment::CIC);
+    spectral_sim.set_force_method(force_method::spectral);
+    REQUIRE(spectral_sim.get_force_method() == force_method::spectral);
+
+    finite_difference_sim.fill_density_buffer();
+    finite_difference_sim.fill_potential_buffer();
+    const double * finite_difference_gradient = finite_difference_sim.calculate_gradient(finite_difference_sim.get_potential_buffer());
+    spectral_sim.fill_density_buffer();
+    spectral_sim.fill_potential_buffer();
+    const double * spectral_gradient = spectral_sim.get_gradient_buffer();
+
+    const double * potential = finite_difference_sim.get_potential_buffer();
+    uint num_cells_total = num_cells * num_cells * num_cells;
+    double potential_power = 0, finite_difference_power = 0, spectral_power = 0;
+    for (uint i = 0; i < num_cells_total; i++){
+        potential_power += potential[i] * potential[i];
+        finite_difference_power += finite_difference_gradient[i] * finite_difference_gradient[i];
+        spectral_power += spectral_gradient[i] * spectral_gradient[i];
+    }
+    // the derivative of a mode scales its amplitude by the wavenumber, central differences by sin(kh)/h
+    double wavenumber = 2 * M_PI * mode;
+    double cell_width = 1.0 / num_cells;
+    REQUIRE(potential_power > 0);
+    REQUIRE_THAT(std::sqrt(spectral_power / potential_power), WithinRel(wavenumber, 1e-2));
+    REQUIRE_THAT(std::sqrt(finite_difference_power / potential_power), WithinRel(std::sin(wavenumber * cell_width) / cell_width, 1e-2));
+    for (uint i = 0; i < num_cells_total; i++){
+        REQUIRE_THAT(spectral_gradient[spectral_sim.get_gradient_stride() + i], WithinAbs(0, 1e-9));
+        REQUIRE_THAT(spectral_gradient[2 * spectral_sim.get_gradient_stride() + i], WithinAbs(0, 1e-9));
+    }
+}
+
+TEST_CASE("Ensure two particles approach each other with the spectral gradient","[Update_Particle]"){
+    particle_group particles(0.1, 2, {{0.3, 0.3, 0.3}, {0.7, 0.7, 0.7}});
+    Simulation sim(10, 0.1, particles, 1, 32, 2, mass_assignment::CIC);
+    sim.set_force_method(force_method::spectral);
+    double prev_distance = std::sqrt(0.4 * 0.4 * 3);
+    for (uint i = 0; i < 10; i++){
+        sim.fill_density_buffer();
+        sim.fill_potential_buffer();
+        sim.update_particles();
+        const particle_group &particle_collection = sim.get_particle_collection();
+        double new_distance = 0;
+        for (uint dim = 0; dim < 3; dim++){
+            new_distance += std::pow(particle_collection.get_position(0)[dim] - particle_collection.get_position(1)[dim], 2);
+        }
+        new_distance = std::sqrt(new_distance);
+        REQUIRE(new_distance < prev_distance);
+        prev_distance = new_distance;
+    }
+}
+
+TEST_CASE("Test Green's function table matches the solver's factor for every mode and is shared between simulations","[Potential_Calc]"){
+    uint num_cells = 8;
+    uint half_cells = num_cells/2 + 1;
+    auto plain = GreenFunction::get_table(num_cells);
+    const double * table = plain->data();
+    double normalisation = -4 * M_PI / (8.0 * num_cells * num_cells * num_cells);
+    // the factor of the transform indices averaged with the one of the mirrored mode
+    auto solver_factor = [&](uint i, uint j, uint k){
+        uint i_mirror = (num_cells - i) % num_cells, j_mirror = (num_cells - j) % num_cells, k_mirror = (num_cells - k) % num_cells;
+        return 0.5 * normalisation * (1.0 / (i * i + j * j + k * k) + 1.0 / (i_mirror * i_mirror + j_mirror * j_mirror + k_mirror * k_mirror));
+    };
+    REQUIRE(table[0] == 0);
+    for (uint i = 0; i < num_cells; i++){
+        for (uint j = 0; j < num_cells; j++){
+            for (uint k = (i == 0 && j == 0) ? 1 : 0; k < half_cells; k++){
+                REQUIRE_THAT(table[k + half_cells * (j + num_cells * i)], WithinRel(solver_factor(i, j, k), 1e-12));
+            }
+        }
+    }
+    // raw index 7 is frequency -1, which is looked up by its signed frequency
+    REQUIRE(table[half_cells * num_cells * 7] == GreenFunction::mode_value(-1, 0, 0, num_cells));
+    REQUIRE(table[half_cells * num_cells * 7] == table[half_cells * num_cells]);
+    REQUIRE(GreenFunction::get_table(num_cells, green_kernel::plain, mass_assignment::TSC, 3) == plain);
+
+    auto deconvolved = GreenFunction::get_table(num_cells, green_kernel::deconvolved, mass_assignment::CIC);
+    double sinc = std::sin(M_PI / num_cells) / (M_PI / num_cells);
+    REQUIRE_THAT(deconvolved->data()[1], WithinRel(solver_factor(0, 0, 1) / std::pow(sinc, 4), 1e-12));
+
+    double smoothing = 1.5;
+    auto gaussian = GreenFunction::get_table(num_cells, green_kernel::gaussian, mass_assignment::NGP, smoothing);
+    double k_smoothing = 2 * M_PI * smoothing / num_cells;
+    REQUIRE_THAT(gaussian->data()[2], WithinRel(solver_factor(0, 0, 2) * std::exp(-4 * k_smoothing * k_smoothing), 1e-12));
+    REQUIRE_THROWS(GreenFunction(num_cells, green_kernel::gaussian, mass_assignment::NGP, 0));
+
+    // the box width only scales the potential by W^2, so a box twice as wide (an eighth of the density) gives half the potential
+    particle_group particles(0.1, 2, {{0.3, 0.4, 0.5}, {0.6, 0.2, 0.9}});
+    Simulation sim(1, 0.1, particles, 1, num_cells, 1);
+    Simulation wide_sim(1, 0.1, particles, 2, num_cells, 1);
+    sim.fill_density_buffer();
+    sim.fill_potential_buffer();
+    wide_sim.fill_density_buffer();
+    wide_sim.fill_potential_buffer();
+    for (uint i = 0; i < num_cells * num_cells * num_cells; i++){
+        REQUIRE_THAT(wide_sim.get_potential_buffer()[i], WithinRel(0.5 * sim.get_potential_buffer()[i], 1e-9));
+    }
+    REQUIRE(sim.get_green_kernel() == green_kernel::plain);
+    sim.set_green_kernel(green_kernel::gaussian, smoothing);
+    REQUIRE(sim.get_green_kernel() == green_kernel::gaussian);
+}
+
+TEST_CASE("Ensure a run restarted from a checkpoint is bit-identical to an uninterrupted run","[Checkpoint]"){
+    std::string checkpoint_file = (std::filesystem::temp_directory_path() / "pm_simulation_test.checkpoint").string();
+    std::filesystem::remove(checkpoint_file);
+    particle_group particles(0.01, 2000, 7);
+    double time_step = 0.125; // exactly representable so both runs stop after the same number of steps
+
+    Simulation uninterrupted(20 * time_step, time_step, particles, 1, 16, 1.01, mass_assignment::CIC);
+    uninterrupted.run();
+
+    Simulation first_half(10 * time_step, time_step, particles, 1, 16, 1.01, mass_assignment::CIC);
+    first_half.set_checkpointing(checkpoint_file, 5);
+    first_half.run();
+    REQUIRE(std::filesystem::exists(checkpoint_file));
+
+    SimulationCheckpoint checkpoint = load_checkpoint(checkpoint_file);
+    REQUIRE(checkpoint.step == 10);
+    REQUIRE(checkpoint.scheme == mass_assignment::CIC);
+    checkpoint.time_max = 20 * time_step;
+    auto second_half = Simulation::from_checkpoint(checkpoint);
+    second_half->run();
+    REQUIRE(second_half->get_step() == 20);
+
+    const particle_group &expected = uninterrupted.get_particle_collection();
+    const particle_group &restarted = second_half->get_particle_collection();
+    REQUIRE(restarted.get_num_particles() == expected.get_num_particles());
+    for (uint dim = 0; dim < 3; dim++){
+        REQUIRE(restarted.position[dim] == expected.position[dim]);
+        REQUIRE(restarted.velocity[dim] == expected.velocity[dim]);
+    }
+
+    // files that are not checkpoints are rejected
+    std::ofstream(checkpoint_file) << "not a checkpoint";
+    REQUIRE_THROWS(load_checkpoint(checkpoint_file));
+    std::filesystem::remove(checkpoint_file);
+}
+
+TEST_CASE("Test grid correlation function matches a direct count of particle pairs at the separation of their cells","[Correlation_Function]"){
+    int n_bins = 10;
+    uint num_cells = 4 * n_bins; // the default grid
+    particle_group particles(0.1, 500, 11);
+    std::vector<double> correlation = correlationFunction(particles, n_bins);
+    REQUIRE(correlation.size() == static_cast<size_t>(n_bins));
+
+    // count every ordered pair of distinct particles at the periodic separation of their cells
+    auto cell_of = [&](uint p, uint dim){ return static_cast<int>(particles.position[dim][p] * num_cells); };
+    auto separation = [&](int a, int b){ int d = std::abs(a - b); return std::min<int>(d, num_cells - d); };
+    std::vector<double> pairs(n_bins, 0);
+    for (uint p = 0; p < particles.get_num_particles(); p++){
+        for (uint q = 0; q < particles.get_num_particles(); q++){
+            if (p == q){
+                continue;
+            }
+            int di = separation(cell_of(p, 0), cell_of(q, 0));
+            int dj = separation(cell_of(p, 1), cell_of(q, 1));
+            int dk = separation(cell_of(p, 2), cell_of(q, 2));
+            double r = std::sqrt(static_cast<double>(di * di + dj * dj + dk * dk)) / num_cells;
+            if (r < 0.5){
+                pairs[static_cast<int>(r * n_bins * 2)] += 1;
+            }
+        }
+    }
+    std::vector<double> separations(n_bins, 0);
+    for (uint i = 0; i < num_cells; i++){
+        for (uint j = 0; j < num_cells; j++){
+            for (uint k = 0; k < num_cells; k++){
+                int di = separation(i, 0), dj = separation(j, 0), dk = separation(k, 0);
+                double r = std::sqrt(static_cast<double>(di * di + dj * dj + dk * dk)) / num_cells;
+                if (r < 0.5){
+                    separations[static_cast<int>(r * n_bins * 2)] += 1;
+                }
+            }
+        }
+    }
+    double num_particles = particles.get_num_particles();
+    double expected_pairs = num_particles * (num_particles - 1) / (num_cells * num_cells * num_cells);
+    for (int b = 0; b < n_bins; b++){
+        REQUIRE_THAT(correlation[b], WithinAbs(std::log(pairs[b] / (separations[b] * expected_pairs)), 1e-9));
+    }
+}
+
+TEST_CASE("Test grid correlation function of clustered particles follows a direct count of their periodic separations","[Correlation_Function]"){
+    int n_bins = 10;
+    // clumps of 10 particles within 0.05 of their centre, some wrapped around the box
+    particle_group clustered(0.1, 0, {});
+    particle_group centres(0.1, 200, 13);
+    particle_group offsets(0.1, 2000, 17);
+    for (uint p = 0; p < offsets.get_num_particles(); p++){
+        std::array<double, 3> position = centres.get_position(p / 10);
+        for (uint dim = 0; dim < 3; dim++){
+            position[dim] = std::fmod(position[dim] + 0.1 * offsets.position[dim][p] + 0.95, 1.0);
+        }
+        clustered.add_particle(particle(position));
+    }
+    std::vector<double> correlation = correlationFunction(clustered, n_bins);
+
+    // every ordered pair of distinct particles at its shortest periodic separation, against the volume of its shell
+    std::vector<double> pairs(n_bins, 0);
+    size_t num_particles = clustered.get_num_particles();
+    for (size_t p = 0; p < num_particles; p++){
+        for (size_t q = 0; q < num_particles; q++){
+            if (p == q){
+                continue;
+            }
+            double r_squared = 0;
+            for (uint dim = 0; dim < 3; dim++){
+                double d = std::abs(clustered.position[dim][p] - clustered.position[dim][q]);
+                d = std::min(d, 1 - d);
+                r_squared += d * d;
+            }
+            double r = std::sqrt(r_squared);
+            if (r < 0.5){
+                pairs[static_cast<int>(r * n_bins * 2)] += 1;
+            }
+        }
+    }
+    double bin_width = 0.5 / n_bins;
+    for (int b = 0; b < n_bins; b++){
+        double shell_volume = 4 * M_PI / 3 * (std::pow((b + 1) * bin_width, 3) - std::pow(b * bin_width, 3));
+        double expected = std::log(pairs[b] / (shell_volume * num_particles * (num_particles - 1)));
+        REQUIRE_THAT(correlation[b], WithinAbs(expected, 0.05));
+    }
+    REQUIRE(correlation[0] > 1); // pairs within a clump are several times more common than between uniform particles
+}
+
+TEST_CASE("Test grid correlation function is flat for uniform particles and peaks at the separation of paired particles","[Correlation_Function]"){
+    int n_bins = 10;
+    particle_group uniform(0.1, 200000, 5);
+    for (double value : correlationFunction(uniform, n_bins)){
+        REQUIRE_THAT(value, WithinAbs(0, 0.02));
+    }
+
+    // pairs of particles separated by 0.225 along x, in the middle of bin 4
+    particle_group paired(0.1, 0, {});
+    particle_group centres(0.1, 20000, 9);
+    for (uint p = 0; p < centres.get_num_particles(); p++){
+        std::array<double, 3> position = centres.get_position(p);
+        paired.add_particle(particle(position));
+        position[0] = std::fmod(position[0] + 0.225, 1.0);
+        paired.add_particle(particle(position));
+    }
+    std::vector<double> correlation = correlationFunction(paired, n_bins, 40);
+    REQUIRE(std::max_element(correlation.begin(), correlation.end()) - correlation.begin() == 4);
+    REQUIRE_THROWS(correlationFunction(paired, n_bins, 19));
+}
+
+TEST_CASE("Ensure particles are moved into and out of a Simulation and viewed without copies","[particle_constructor]"){
+    particle_group particles(0.1, 1000, 3);
+    const double * x_data = particles.position[0].data();
+    const double * vz_data = particles.velocity[2].data();
+
+    particle_view view(particles);
+    REQUIRE(view.get_num_particles() == 1000);
+    REQUIRE(view.mass == 0.1);
+    REQUIRE(view.position[0] == x_data);
+    REQUIRE(view.velocity[2] == vz_data);
+
+    Simulation sim(1, 0.1, std::move(particles), 1, 8, 1);
+    REQUIRE(sim.get_particle_collection().position[0].data() == x_data);
+    REQUIRE(particle_view(sim.get_particle_collection()).position[0] == x_data);
+
+    particle_group released = sim.release_particle_collection();
+    REQUIRE(released.position[0].data() == x_data);
+    REQUIRE(released.velocity[2].data() == vz_data);
+    REQUIRE(released.get_num_particles() == 1000);
+    REQUIRE(sim.get_particle_collection().get_num_particles() == 0);
+}
+
+TEST_CASE("Test random particle group is uniform and independent of thread count","[particle_constructor]"){
+    int max_threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    particle_group serial(0.1, 100000, 42);
+    omp_set_num_threads(std::max(4, max_threads));
+    particle_group parallel(0.1, 100000, 42);
+    omp_set_num_threads(max_threads);
+    particle_group other_seed(0.1, 100000, 43);
+
+    for (uint dim = 0; dim < 3; dim++){
+        REQUIRE(serial.position[dim] == parallel.position[dim]);
+        REQUIRE(serial.position[dim] != other_seed.position[dim]);
+        double mean = std::accumulate(serial.position[dim].begin(), serial.position[dim].end(), 0.0) / serial.get_num_particles();
+        REQUIRE_THAT(mean, WithinAbs(0.5, 0.005));
+        for (size_t i = 0; i < serial.get_num_particles(); i++){
+            REQUIRE(serial.position[dim][i] >= 0);
+            REQUIRE(serial.position[dim][i] < 1);
+            REQUIRE(serial.velocity[dim][i] == 0);
+        }
+    }
+}
+
+TEST_CASE("Ensure density and particle snapshots are read back exactly with and without compression","[Snapshot]"){
+    uint num_cells = 12;
+    Simulation sim(1, 0.1, particle_group(0.3, 5000, 9), 10.0, num_cells, 1.0, mass_assignment::CIC);
+    sim.fill_density_buffer();
+    sim.fill_potential_buffer();
+    sim.update_particles();
+    const particle_group &particles = sim.get_particle_collection();
+    std::string density_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_density.pmsnap").string();
+    std::string particle_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_particles.pmsnap").string();
+
+    std::vector<snapshot_compression> compressions = {snapshot_compression::none};
+    if (snapshot_compression_available()){
+        compressions.push_back(snapshot_compression::zlib);
+    }
+    else{
+        REQUIRE_THROWS_AS(save_density_snapshot(density_file, sim.get_density_buffer(), num_cells, 0.5, 10.0, snapshot_compression::zlib), std::invalid_argument);
+    }
+    for (snapshot_compression compression : compressions){
+        save_density_snapshot(density_file, sim.get_density_buffer(), num_cells, 0.5, 10.0, compression);
+        save_particle_snapshot(particle_file, particles, num_cells, 0.5, 10.0, compression);
+
+        Snapshot density = load_snapshot(density_file);
+        REQUIRE(density.kind == "density");
+        REQUIRE(density.compression == compression);
+        REQUIRE(density.num_cells == num_cells);
+        REQUIRE(density.time == 0.5);
+        REQUIRE(density.box_width == 10.0);
+        REQUIRE(density.field("density").values == std::vector<double>(sim.get_density_buffer(), sim.get_density_buffer() + num_cells * num_cells * num_cells));
+
+        Snapshot particle_snapshot = load_snapshot(particle_file);
+        REQUIRE(particle_snapshot.kind == "particles");
+        REQUIRE(particle_snapshot.particle_mass == 0.3);
+        const char * names[2][3] = {{"x", "y", "z"}, {"vx", "vy", "vz"}};
+        for (uint dim = 0; dim < 3; dim++){
+            const std::vector<double> &x = particle_snapshot.field(names[0][dim]).values;
+            const std::vector<double> &v = particle_snapshot.field(names[1][dim]).values;
+            REQUIRE(std::equal(x.begin(), x.end(), particles.position[dim].begin(), particles.position[dim].end()));
+            REQUIRE(std::equal(v.begin(), v.end(), particles.velocity[dim].begin(), particles.velocity[dim].end()));
+        }
+    }
+    REQUIRE_THROWS_AS(load_snapshot(density_file + ".missing"), std::runtime_error);
+    std::filesystem::resize_file(particle_file, std::filesystem::file_size(particle_file) - 8);
+    REQUIRE_THROWS_AS(load_snapshot(particle_file), std::runtime_error);
+    std::filesystem::remove(density_file);
+    std::filesystem::remove(particle_file);
+}
+
+TEST_CASE("Ensure binary and text images hold the same pixels","[Snapshot]"){
+    size_t n_cells = 8;
+    std::vector<double> projection(n_cells * n_cells);
+    for (size_t i = 0; i < projection.size(); i++){
+        projection[i] = i % 7; // mean 3 so the brightest pixels saturate red and reach into green
+    }
+    std::string binary_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_image_binary.ppm").string();
+    std::string text_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_image_text.ppm").string();
+    SaveProjectionToFile(projection.data(), n_cells, binary_file, image_format::binary);
+    SaveProjectionToFile(projection.data(), n_cells, text_file, image_format::ascii);
+
+    std::ifstream binary_image(binary_file, std::ios::binary);
+    std::ifstream text_image(text_file);
+    std::string binary_magic, text_magic;
+    size_t width, height, max_value;
+    binary_image >> binary_magic >> width >> height >> max_value;
+    binary_image.get(); // single whitespace before the raster
+    REQUIRE(binary_magic == "P6");
+    REQUIRE(width == n_cells);
+    REQUIRE(height == n_cells);
+    REQUIRE(max_value == 255);
+    text_image >> text_magic >> width >> height >> max_value;
+    REQUIRE(text_magic == "P3");
+
+    std::vector<char> raster(3 * n_cells * n_cells);
+    binary_image.read(raster.data(), raster.size());
+    REQUIRE(binary_image.gcount() == static_cast<std::streamsize>(raster.size()));
+    REQUIRE(binary_image.peek() == EOF);
+    for (size_t i = 0; i < raster.size(); i++){
+        int value;
+        text_image >> value;
+        REQUIRE(static_cast<unsigned char>(raster[i]) == value);
+    }
+    REQUIRE(static_cast<unsigned char>(raster[3 * 6]) == 255); // density 6 is twice the mean
+    REQUIRE(static_cast<unsigned char>(raster[3 * 6 + 1]) == 255);
+    std::filesystem::remove(binary_file);
+    std::filesystem::remove(text_file);
+}
+
+TEST_CASE("Ensure the output writer runs tasks in order, bounds its queue and reports failures","[Output_Writer]"){
+    for (size_t max_pending : {0, 1, 3}){
+        std::vector<int> written;
+        std::atomic<size_t> queued{0}, most_queued{0};
+        {
+            OutputWriter writer(max_pending);
+            for (int task = 0; task < 20; task++){
+                most_queued = std::max<size_t>(most_queued, ++queued);
+                writer.submit([&written, &queued, task](){
+                    queued--;
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    written.push_back(task);
+                });
+            }
+            writer.flush();
+            REQUIRE(written.size() == 20);
+            for (int task = 0; task < 20; task++){
+                REQUIRE(written[task] == task);
+            }
+
+            writer.submit([](){ throw std::runtime_error("Error - disk full"); });
+            REQUIRE_THROWS_AS(writer.flush(), std::runtime_error);
+            writer.submit([&written](){ written.push_back(20); }); // the writer keeps working after reporting the failure
+            writer.flush();
+            REQUIRE(written.back() == 20);
+        }
+        // one more than the queue may be counted as queued while the writer has taken a task but not started it
+        REQUIRE(most_queued <= max_pending + 2);
+    }
+}
+
+TEST_CASE("Ensure asynchronous output writes the same images as synchronous output","[Output_Writer]"){
+    std::string folder = (std::filesystem::temp_directory_path() / "pm_simulation_test_output").string();
+    std::filesystem::remove_all(folder);
+    for (size_t queue_length : {0, 2}){
+        Simulation sim(0.2, 0.01, particle_group(0.5, 2000, 5), 10.0, 16, 1.01, mass_assignment::CIC);
+        sim.set_output_queue_length(queue_length);
+        OutputSchedule schedule;
+        schedule.every_steps(10, {output_type::projection, output_type::density, output_type::particles});
+        sim.set_output_schedule(schedule);
+        sim.run(folder + "/" + std::to_string(queue_length));
+    }
+    std::vector<std::string> names;
+    for (const auto &entry : std::filesystem::directory_iterator(folder + "/0/1.01")){
+        names.push_back(entry.path().filename().string());
+    }
+    REQUIRE(names.size() == 6); // 2 outputs of an image and 2 snapshots
+    for (const std::string &name : names){
+        std::ifstream sync_file(folder + "/0/1.01/" + name, std::ios::binary);
+        std::ifstream async_file(folder + "/2/1.01/" + name, std::ios::binary);
+        REQUIRE(async_file.is_open());
+        std::string sync_contents((std::istreambuf_iterator<char>(sync_file)), std::istreambuf_iterator<char>());
+        std::string async_contents((std::istreambuf_iterator<char>(async_file)), std::istreambuf_iterator<char>());
+        REQUIRE(sync_contents == async_contents);
+    }
+    std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("Test output schedule triggers on steps, times, expansions and the last step","[Output_Schedule]"){
+    OutputSchedule schedule;
+    REQUIRE(schedule.empty());
+    schedule.add_trigger("every:4:projection");
+    REQUIRE_FALSE(schedule.empty());
+    schedule.add_trigger("times:0.5,0.25:density,projection");
+    schedule.add_trigger("expansions:1.1:particles");
+    schedule.add_trigger("end:particles");
+    REQUIRE_THROWS_AS(schedule.add_trigger("every:0:projection"), std::invalid_argument);
+    REQUIRE_THROWS_AS(schedule.add_trigger("times:0.5"), std::invalid_argument);
+    REQUIRE_THROWS_AS(schedule.add_trigger("times:0.5x:density"), std::invalid_argument);
+    REQUIRE_THROWS_AS(schedule.add_trigger("sometimes:1:density"), std::invalid_argument);
+    REQUIRE_THROWS_AS(schedule.add_trigger("end:pictures"), std::invalid_argument);
+
+    // steps of 0.1 with 2% expansion per step, accumulated as run does
+    double time = 0, time_step = 0.1;
+    std::vector<std::vector<output_type>> outputs;
+    schedule.start(0, 1);
+    REQUIRE_THAT(schedule.next_time(0), WithinAbs(0.25, 1e-15));
+    for (uint step = 1; step <= 8; step++){
+        time += time_step;
+        outputs.push_back(schedule.due(step, time, std::pow(1.02, step), step == 8));
+    }
+    using o = output_type;
+    REQUIRE(outputs[0].empty());
+    REQUIRE(outputs[2] == std::vector<output_type>{o::projection, o::density}); // 0.3 is the first step past 0.25
+    REQUIRE(outputs[3] == std::vector<output_type>{o::projection}); // every 4 steps
+    REQUIRE(outputs[4] == std::vector<output_type>{o::projection, o::density, o::particles}); // t = 0.5 lands exactly despite rounding, 1.02^5 > 1.1
+    REQUIRE(outputs[5].empty()); // every requested value fires once
+    REQUIRE(outputs[7] == std::vector<output_type>{o::projection, o::particles});
+    REQUIRE(schedule.next_time(time) < 0);
+
+    // a restarted run skips what was written before the checkpoint
+    OutputSchedule restarted;
+    restarted.at_times({0.2, 0.6}, {o::density});
+    restarted.start(0.4, 1);
+    REQUIRE_FALSE(restarted.empty());
+    REQUIRE(restarted.due(5, 0.5, 1, false).empty());
+    REQUIRE(restarted.due(6, 0.6, 1, false) == std::vector<output_type>{o::density});
+    REQUIRE(restarted.empty());
+}
+
+TEST_CASE("Ensure run writes only the scheduled outputs","[Output_Schedule]"){
+    std::string folder = (std::filesystem::temp_directory_path() / "pm_simulation_test_schedule").string();
+    std::filesystem::remove_all(folder);
+    Simulation sim(0.1, 0.01, particle_group(0.5, 1000, 5), 10.0, 8, 1.0);
+    OutputSchedule schedule;
+    schedule.at_times({0.03}, {output_type::density});
+    schedule.at_end({output_type::particles});
+    sim.set_output_schedule(schedule);
+    sim.run(folder);
+    std::vector<std::string> names;
+    for (const auto &entry : std::filesystem::directory_iterator(folder + "/1.")){
+        names.push_back(entry.path().filename().string());
+    }
+    std::sort(names.begin(), names.end());
+    REQUIRE(names.size() == 2);
+    REQUIRE_THAT(names[0], StartsWith("UniverseSim_dt_0.01_time_0.03_num_cells_8_") && EndsWith("_density.pmsnap"));
+    REQUIRE(load_snapshot(folder + "/1./" + names[1]).kind == "particles");
+    REQUIRE(load_snapshot(folder + "/1./" + names[1]).time == sim.get_time()); // written after the last step
+    std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("Ensure run writes nothing when the schedule is empty","[Output_Schedule]"){
+    std::string folder = (std::filesystem::temp_directory_path() / "pm_simulation_test_empty_schedule").string();
+    std::filesystem::remove_all(folder);
+    Simulation sim(0.05, 0.01, particle_group(0.5, 1000, 5), 10.0, 8, 1.0);
+    sim.set_output_schedule(OutputSchedule());
+    sim.run(folder);
+    REQUIRE_THAT(sim.get_time(), WithinAbs(0.05, 1e-12));
+    REQUIRE_FALSE(std::filesystem::exists(folder));
+}
+
+TEST_CASE("Test density projection along every axis and over a slab matches a direct sum","[Projection]"){
+    size_t n_cells = 13;
+    std::vector<double> density(n_cells * n_cells * n_cells);
+    for (size_t index = 0; index < density.size(); index++){
+        density[index] = std::sin(0.37 * index) + 1.5;
+    }
+    std::vector<double> projection(n_cells * n_cells);
+    for (uint axis = 0; axis < 3; axis++){
+        for (auto [first_plane, num_planes] : {std::pair<size_t, size_t>{0, 0}, {4, 5}, {12, 1}}){
+            ProjectDensity(density.data(), n_cells, projection.data(), axis, first_plane, num_planes);
+            size_t last_plane = num_planes == 0 ? n_cells : first_plane + num_planes;
+            for (size_t a = 0; a < n_cells; a++){
+                for (size_t b = 0; b < n_cells; b++){
+                    double sum = 0;
+                    for (size_t plane = first_plane; plane < last_plane; plane++){
+                        size_t i = axis == 0 ? plane : a;
+                        size_t j = axis == 0 ? a : (axis == 1 ? plane : b);
+                        size_t k = axis == 2 ? plane : b;
+                        sum += density[k + n_cells * (j + n_cells * i)];
+                    }
+                    REQUIRE_THAT(projection[a * n_cells + b], WithinRel(sum, 1e-12));
+                }
+            }
+        }
+    }
+    REQUIRE_THROWS_AS(ProjectDensity(density.data(), n_cells, projection.data(), 3), std::invalid_argument);
+    REQUIRE_THROWS_AS(ProjectDensity(density.data(), n_cells, projection.data(), 2, 10, 4), std::invalid_argument);
+}
+
+TEST_CASE("Test power spectrum of a single density mode, its corrections and its mode count","[Power_Spectrum]"){
+    uint n_cells = 16;
+    double width = 2.0, amplitude = 0.3, volume = width * width * width;
+    std::vector<double> density(n_cells * n_cells * n_cells);
+    for (uint i = 0; i < n_cells; i++){
+        for (size_t index = i * n_cells * n_cells; index < (i + 1) * n_cells * n_cells; index++){
+            density[index] = 1 + amplitude * std::cos(2 * M_PI * 3 * i / n_cells); // delta = A cos(k x) with k three times the fundamental
+        }
+    }
+    std::vector<fftw_complex> spectrum(n_cells * n_cells * (n_cells/2 + 1));
+    FFTPlans::get_plans(n_cells, omp_get_max_threads())->forward(density.data(), spectrum.data());
+
+    PowerSpectrumOptions options;
+    options.num_bins = 8; // bins one fundamental frequency wide
+    PowerSpectrum plain = binPowerSpectrum(spectrum.data(), n_cells, width, 1000, mass_assignment::NGP, options);
+    uint64_t num_modes = 0, expected_modes = 0;
+    double total_power = 0;
+    for (size_t bin = 0; bin < plain.k.size(); bin++){
+        num_modes += plain.num_modes[bin];
+        total_power += plain.power[bin] * plain.num_modes[bin];
+        if (bin != 3){
+            REQUIRE_THAT(plain.power[bin], WithinAbs(0, 1e-12 * volume));
+        }
+    }
+    REQUIRE_THAT(total_power, WithinRel(volume * amplitude * amplitude / 2, 1e-10)); // the two modes at +-k each hold V A^2 / 4
+    REQUIRE(plain.power[3] > 0);
+    REQUIRE(plain.k[3] > 3 * 2 * M_PI / width);
+    REQUIRE(plain.k[3] < 4 * 2 * M_PI / width);
+    for (int i = 0; i < static_cast<int>(n_cells); i++){ // every mode of the full spectrum below the Nyquist frequency, counted directly
+        for (int j = 0; j < static_cast<int>(n_cells); j++){
+            for (int k = 0; k < static_cast<int>(n_cells); k++){
+                int f_i = i <= 8 ? i : i - 16, f_j = j <= 8 ? j : j - 16, f_k = k <= 8 ? k : k - 16;
+                double frequency = std::sqrt(f_i * f_i + f_j * f_j + f_k * f_k);
+                expected_modes += frequency > 0 && frequency < 8 ? 1 : 0;
+            }
+        }
+    }
+    REQUIRE(num_modes == expected_modes);
+
+    options.deconvolve_window = true;
+    options.subtract_shot_noise = true;
+    PowerSpectrum corrected = binPowerSpectrum(spectrum.data(), n_cells, width, 1000, mass_assignment::CIC, options);
+    double window = std::pow(std::sin(3 * M_PI / n_cells) / (3 * M_PI / n_cells), 2);
+    REQUIRE_THAT(corrected.power[3] + volume / 1000, WithinRel(plain.power[3] / (window * window), 1e-10));
+    REQUIRE_THAT(corrected.power[1], WithinAbs(-volume / 1000, 1e-12 * volume));
+    REQUIRE(corrected.num_modes[0] == 0); // only the excluded zero mode lies below the fundamental frequency
+
+    options.num_bins = 0;
+    REQUIRE_THROWS_AS(binPowerSpectrum(spectrum.data(), n_cells, width, 1000, mass_assignment::NGP, options), std::invalid_argument);
+}
+
+TEST_CASE("Test power spectrum of uniform random particles is their shot noise","[Power_Spectrum]"){
+    uint n_cells = 16, num_particles = 20000;
+    double width = 5.0, volume = width * width * width;
+    particle_group particles(1.0, num_particles, 11);
+    PowerSpectrumOptions options;
+    options.num_bins = 4;
+    // the NGP window summed over its aliases is 1, so the raw Poisson spectrum is flat at V / N_p
+    PowerSpectrum spectrum = powerSpectrum(particles, n_cells, width, mass_assignment::NGP, options);
+    double mean_power = 0;
+    uint64_t num_modes = 0;
+    for (size_t bin = 0; bin < spectrum.k.size(); bin++){
+        mean_power += spectrum.power[bin] * spectrum.num_modes[bin];
+        num_modes += spectrum.num_modes[bin];
+    }
+    REQUIRE_THAT(mean_power / num_modes, WithinRel(volume / num_particles, 0.1));
+
+    options.subtract_shot_noise = true;
+    PowerSpectrum subtracted = powerSpectrum(particles, n_cells, width, mass_assignment::NGP, options);
+    for (size_t bin = 0; bin < subtracted.k.size(); bin++){
+        REQUIRE_THAT(subtracted.power[bin], WithinAbs(spectrum.power[bin] - volume / num_particles, 1e-12 * volume));
+    }
+}
+
+TEST_CASE("Ensure the simulation bins the power spectrum of its own transform and writes it when scheduled","[Power_Spectrum]"){
+    uint n_cells = 16;
+    double width = 10.0;
+    Simulation sim(0.1, 0.01, particle_group(0.5, 5000, 3), width, n_cells, 1.0, mass_assignment::CIC);
+    REQUIRE_FALSE(sim.get_power_spectrum().has_value());
+    PowerSpectrumOptions options;
+    options.num_bins = 6;
+    options.deconvolve_window = true;
+    sim.set_power_spectrum_options(options);
+    sim.request_power_spectrum();
+    sim.fill_density_buffer();
+    sim.fill_potential_buffer();
+    REQUIRE(sim.get_power_spectrum().has_value());
+    PowerSpectrum expected = powerSpectrum(sim.get_particle_collection(), n_cells, width, mass_assignment::CIC, options);
+    for (size_t bin = 0; bin < expected.k.size(); bin++){
+        REQUIRE_THAT(sim.get_power_spectrum()->k[bin], WithinRel(expected.k[bin], 1e-12));
+        REQUIRE_THAT(sim.get_power_spectrum()->power[bin], WithinRel(expected.power[bin], 1e-9));
+        REQUIRE(sim.get_power_spectrum()->num_modes[bin] == expected.num_modes[bin]);
+    }
+
+    std::string folder = (std::filesystem::temp_directory_path() / "pm_simulation_test_power_spectrum").string();
+    std::filesystem::remove_all(folder);
+    OutputSchedule schedule;
+    schedule.add_trigger("end:power_spectrum");
+    sim.set_output_schedule(schedule);
+    sim.run(folder);
+    std::vector<std::string> names;
+    for (const auto &entry : std::filesystem::directory_iterator(folder + "/1.")){
+        names.push_back(entry.path().filename().string());
+    }
+    REQUIRE(names.size() == 1);
+    REQUIRE_THAT(names[0], EndsWith("_power_spectrum.csv"));
+    std::ifstream file(folder + "/1./" + names[0]);
+    std::string line;
+    uint num_lines = 0;
+    std::getline(file, line);
+    REQUIRE(line == "k,power,modes");
+    while (std::getline(file, line)){
+        num_lines++;
+    }
+    REQUIRE(num_lines == 6);
+    std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("Ensure the fused particle update and expansion is bit-identical to the separate passes","[Update_Particle]"){
+    for (mass_assignment scheme : {mass_assignment::NGP, mass_assignment::CIC, mass_assignment::TSC}){
+        for (force_method method : {force_method::finite_difference, force_method::spectral}){
+            Simulation separate(1, 0.05, particle_group(1.5, 2000, 17), 10.0, 12, 1.03, scheme);
+            Simulation fused(1, 0.05, particle_group(1.5, 2000, 17), 10.0, 12, 1.03, scheme);
+            separate.set_force_method(method);
+            fused.set_force_method(method);
+            for (uint step = 0; step < 5; step++){
+                separate.fill_density_buffer();
+                separate.fill_potential_buffer();
+                separate.update_particles();
+                separate.box_expansion();
+                fused.fill_density_buffer();
+                fused.fill_potential_buffer();
+                fused.update_particles_and_expand();
+            }
+            REQUIRE(separate.get_checkpoint().box_width == fused.get_checkpoint().box_width);
+            for (uint dim = 0; dim < 3; dim++){
+                REQUIRE(separate.get_particle_collection().position[dim] == fused.get_particle_collection().position[dim]);
+                REQUIRE(separate.get_particle_collection().velocity[dim] == fused.get_particle_collection().velocity[dim]);
+            }
+        }
+    }
+}
+
+TEST_CASE("Ensure comoving velocities follow the physical ones and are converted back for snapshots, checkpoints and release","[Update_Particle]"){
+    double expansion = 1.04;
+    Simulation physical(1, 0.05, particle_group(1.5, 2000, 23), 10.0, 12, expansion, mass_assignment::CIC);
+    Simulation comoving(1, 0.05, particle_group(1.5, 2000, 23), 10.0, 12, expansion, mass_assignment::CIC);
+    comoving.set_velocity_frame(velocity_frame::comoving);
+    for (uint step = 0; step < 8; step++){
+        physical.fill_density_buffer();
+        physical.fill_potential_buffer();
+        physical.update_particles_and_expand();
+        comoving.fill_density_buffer();
+        comoving.fill_potential_buffer();
+        comoving.update_particles_and_expand();
+    }
+    REQUIRE_THAT(comoving.get_velocity_scale(), WithinRel(std::pow(expansion, 8), 1e-14));
+    REQUIRE(physical.get_velocity_scale() == 1);
+
+    // the expansion alone only changes the scale
+    particle_group before = comoving.get_particle_collection();
+    comoving.box_expansion();
+    physical.box_expansion();
+    REQUIRE(comoving.get_particle_collection().velocity[0] == before.velocity[0]);
+
+    particle_group physical_particles = comoving.get_physical_particle_collection();
+    for (uint dim = 0; dim < 3; dim++){
+        for (size_t i = 0; i < physical_particles.get_num_particles(); i++){
+            REQUIRE_THAT(physical_particles.position[dim][i], WithinAbs(physical.get_particle_collection().position[dim][i], 1e-12));
+            REQUIRE_THAT(physical_particles.velocity[dim][i], WithinAbs(physical.get_particle_collection().velocity[dim][i], 1e-12));
+        }
+    }
+
+    std::string snapshot_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_comoving.pmsnap").string();
+    save_particle_snapshot(snapshot_file, comoving.get_particle_collection(), 12, 0, 10, snapshot_compression::none, comoving.get_velocity_scale());
+    Snapshot snapshot = load_snapshot(snapshot_file);
+    REQUIRE(snapshot.field("vy").values == std::vector<double>(physical_particles.velocity[1].begin(), physical_particles.velocity[1].end()));
+    REQUIRE(snapshot.field("y").values == std::vector<double>(physical_particles.position[1].begin(), physical_particles.position[1].end()));
+    std::filesystem::remove(snapshot_file);
+
+    std::string checkpoint_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_comoving.pmsim").string();
+    save_checkpoint(comoving.get_checkpoint(), checkpoint_file);
+    std::unique_ptr<Simulation> restored = Simulation::from_checkpoint(load_checkpoint(checkpoint_file));
+    REQUIRE(restored->get_velocity_frame() == velocity_frame::comoving);
+    REQUIRE(restored->get_velocity_scale() == comoving.get_velocity_scale());
+    std::filesystem::remove(checkpoint_file);
+
+    particle_group released = comoving.release_particle_collection();
+    REQUIRE(released.velocity[2] == physical_particles.velocity[2]);
+    REQUIRE(comoving.get_velocity_frame() == velocity_frame::physical);
+    REQUIRE(comoving.get_velocity_scale() == 1);
+}
+
+TEST_CASE("Test Morton sort orders particles by cell, keeps their ids and does not depend on the thread count","[Spatial_Sort]"){
+    REQUIRE(morton_key(0, 0, 1) == 1);
+    REQUIRE(morton_key(0, 1, 0) == 2);
+    REQUIRE(morton_key(1, 0, 0) == 4);
+    REQUIRE(morton_key(3, 0, 0) == 36);
+    REQUIRE(morton_key(0, 0, 2) == 8);
+
+    uint num_cells = 20;
+    particle_group original(1.0, 5000, 31);
+    for (size_t i = 0; i < original.get_num_particles(); i++){
+        original.velocity[0][i] = i; // tags each particle so the permutation can be checked
+    }
+    int max_threads = omp_get_max_threads();
+    std::vector<particle_group> sorted;
+    std::vector<std::vector<uint64_t>> sorted_ids;
+    for (int threads : {1, 3}){
+        omp_set_num_threads(threads);
+        particle_group particles = original;
+        std::vector<uint64_t> ids;
+        SpatialSortBuffers buffers;
+        sort_particles_by_cell(particles, ids, num_cells, buffers);
+        sorted.push_back(std::move(particles));
+        sorted_ids.push_back(std::move(ids));
+    }
+    omp_set_num_threads(max_threads);
+    REQUIRE(sorted[0].position[0] == sorted[1].position[0]);
+    REQUIRE(sorted_ids[0] == sorted_ids[1]);
+
+    const particle_group &particles = sorted[0];
+    const std::vector<uint64_t> &ids = sorted_ids[0];
+    uint64_t previous_key = 0;
+    size_t previous_id = 0;
+    for (size_t i = 0; i < particles.get_num_particles(); i++){
+        REQUIRE(particles.position[1][i] == original.position[1][ids[i]]);
+        REQUIRE(particles.velocity[0][i] == ids[i]);
+        uint64_t key = morton_key(particles.position[0][i] * num_cells, particles.position[1][i] * num_cells, particles.position[2][i] * num_cells);
+        REQUIRE(key >= previous_key);
+        if (i > 0 && key == previous_key){
+            REQUIRE(ids[i] > previous_id); // particles sharing a cell keep their order
+        }
+        previous_key = key;
+        previous_id = ids[i];
+    }
+    std::vector<uint64_t> all_ids = ids;
+    std::sort(all_ids.begin(), all_ids.end());
+    for (size_t i = 0; i < all_ids.size(); i++){
+        REQUIRE(all_ids[i] == i);
+    }
+}
+
+TEST_CASE("Ensure sorted runs match unsorted runs by particle id and keep their order and ids in checkpoints","[Spatial_Sort]"){
+    Simulation unsorted(0.2, 0.02, particle_group(1.5, 3000, 41), 10.0, 16, 1.01, mass_assignment::CIC);
+    Simulation sorted(0.2, 0.02, particle_group(1.5, 3000, 41), 10.0, 16, 1.01, mass_assignment::CIC);
+    sorted.set_output_schedule(OutputSchedule());
+    unsorted.set_output_schedule(OutputSchedule());
+    sorted.set_particle_sorting(3);
+    REQUIRE(sorted.get_particle_ids().empty());
+
+    sorted.fill_density_buffer();
+    sorted.sort_particles();
+    std::vector<double> density_before(sorted.get_density_buffer(), sorted.get_density_buffer() + 16 * 16 * 16);
+    sorted.fill_density_buffer();
+    for (size_t i = 0; i < density_before.size(); i++){
+        REQUIRE_THAT(sorted.get_density_buffer()[i], WithinAbs(density_before[i], 1e-12));
+    }
+
+    sorted.run();
+    unsorted.run();
+    const std::vector<uint64_t> &ids = sorted.get_particle_ids();
+    REQUIRE(ids.size() == 3000);
+    for (uint dim = 0; dim < 3; dim++){
+        for (size_t i = 0; i < ids.size(); i++){
+            REQUIRE_THAT(sorted.get_particle_collection().velocity[dim][i], WithinAbs(unsorted.get_particle_collection().velocity[dim][ids[i]], 1e-9));
+        }
+    }
+
+    std::string checkpoint_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_sorted.pmsim").string();
+    save_checkpoint(sorted.get_checkpoint(), checkpoint_file);
+    std::unique_ptr<Simulation> restored = Simulation::from_checkpoint(load_checkpoint(checkpoint_file));
+    REQUIRE(restored->get_particle_sorting() == 3);
+    REQUIRE(restored->get_particle_ids() == ids);
+    REQUIRE(restored->get_particle_collection().position[2] == sorted.get_particle_collection().position[2]);
+    std::filesystem::remove(checkpoint_file);
+
+    std::string snapshot_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_sorted.pmsnap").string();
+    save_particle_snapshot(snapshot_file, sorted.get_particle_collection(), 16, 0, 10, snapshot_compression::none, 1, ids.data());
+    Snapshot snapshot = load_snapshot(snapshot_file);
+    REQUIRE(snapshot.field("id").values[17] == ids[17]);
+    std::filesystem::remove(snapshot_file);
+}
+
+TEST_CASE("Ensure leapfrog steps end exactly on requested output times and t_max and expand by the elapsed time","[Integrator]"){
+    std::string folder = (std::filesystem::temp_directory_path() / "pm_simulation_test_integrator").string();
+    std::filesystem::remove_all(folder);
+    double time_step = 0.25;
+    double expansion_factor = 1.02;
+    Simulation sim(1.0, time_step, particle_group(0.01, 500, 5), 1, 8, expansion_factor, mass_assignment::CIC);
+    REQUIRE_THROWS_AS(sim.set_integrator(integrator::leapfrog_kdk, 0), std::invalid_argument);
+    sim.set_integrator(integrator::leapfrog_kdk, 0.25);
+    REQUIRE(sim.get_integrator() == integrator::leapfrog_kdk);
+    OutputSchedule schedule;
+    schedule.at_times({0.3, 0.7}, {output_type::particles});
+    sim.set_output_schedule(schedule);
+    sim.run(folder);
+
+    std::vector<double> times;
+    for (const auto &entry : std::filesystem::directory_iterator(folder + "/1.02")){
+        times.push_back(load_snapshot(entry.path().string()).time);
+    }
+    std::sort(times.begin(), times.end());
+    REQUIRE(times == std::vector<double>{0.3, 0.7});
+    REQUIRE(sim.get_time() == 1.0);
+    REQUIRE(sim.get_step() > 4); // the particles are fast enough for the Courant limit to shorten some steps
+    REQUIRE_THAT(sim.get_checkpoint().box_width, WithinRel(std::pow(expansion_factor, 1.0 / time_step), 1e-12));
+    std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("Test leapfrog converges at second order and the Euler integrator at first order","[Integrator]"){
+    particle_group particles(0.01, 64, 3);
+    double t_max = 1.0;
+    auto run_with = [&](integrator method, double time_step){
+        Simulation sim(t_max, time_step, particles, 1, 8, 1.0, mass_assignment::TSC);
+        sim.set_output_schedule(OutputSchedule());
+        sim.set_integrator(method, 1e9); // the Courant limits never apply, so every step is time_step
+        sim.run();
+        REQUIRE(sim.get_step() == static_cast<uint64_t>(std::round(t_max / time_step)));
+        return sim.get_physical_particle_collection();
+    };
+    auto rms_error = [](const particle_group &a, const particle_group &b){
+        double sum = 0;
+        for (uint dim = 0; dim < 3; dim++){
+            for (size_t index = 0; index < a.get_num_particles(); index++){
+                double difference = a.position[dim][index] - b.position[dim][index];
+                difference -= std::round(difference); // periodic
+                sum += difference * difference;
+            }
+        }
+        return std::sqrt(sum / a.get_num_particles());
+    };
+    particle_group reference = run_with(integrator::leapfrog_kdk, t_max / 1024);
+    double euler_coarse = rms_error(run_with(integrator::euler, t_max / 16), reference);
+    double euler_fine = rms_error(run_with(integrator::euler, t_max / 32), reference);
+    double leapfrog_coarse = rms_error(run_with(integrator::leapfrog_kdk, t_max / 16), reference);
+    double leapfrog_fine = rms_error(run_with(integrator::leapfrog_kdk, t_max / 32), reference);
+    REQUIRE_THAT(euler_coarse / euler_fine, WithinAbs(2, 0.3));
+    REQUIRE_THAT(leapfrog_coarse / leapfrog_fine, WithinAbs(4, 0.5));
+    REQUIRE(leapfrog_coarse < euler_fine);
+}
+
+TEST_CASE("Ensure a leapfrog run restarted from a checkpoint is bit-identical to an uninterrupted run","[Integrator]"){
+    std::string checkpoint_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_leapfrog.checkpoint").string();
+    std::filesystem::remove(checkpoint_file);
+    particle_group particles(0.01, 2000, 7);
+    double half_time = 1.25;
+    OutputSchedule schedule;
+    schedule.at_times({half_time}, {output_type::power_spectrum}); // makes the uninterrupted run end a step where the first half stops
+    auto configure = [&](Simulation &sim){
+        sim.set_integrator(integrator::leapfrog_kdk, 0.3, 0.5);
+        sim.set_particle_sorting(3);
+        sim.set_output_schedule(schedule);
+    };
+
+    Simulation uninterrupted(2 * half_time, 0.25, particles, 1, 16, 1.01, mass_assignment::CIC);
+    configure(uninterrupted);
+    uninterrupted.run();
+
+    Simulation first_half(half_time, 0.25, particles, 1, 16, 1.01, mass_assignment::CIC);
+    configure(first_half);
+    first_half.set_checkpointing(checkpoint_file, 1);
+    first_half.run();
+
+    SimulationCheckpoint checkpoint = load_checkpoint(checkpoint_file);
+    REQUIRE(checkpoint.time == half_time);
+    REQUIRE(checkpoint.time_integrator == integrator::leapfrog_kdk);
+    REQUIRE(checkpoint.courant_factor == 0.3);
+    REQUIRE(checkpoint.max_time_step == 0.5);
+    checkpoint.time_max = 2 * half_time;
+    auto second_half = Simulation::from_checkpoint(checkpoint);
+    second_half->run();
+    REQUIRE(second_half->get_step() == uninterrupted.get_step());
+
+    const particle_group &expected = uninterrupted.get_particle_collection();
+    const particle_group &restarted = second_half->get_particle_collection();
+    for (uint dim = 0; dim < 3; dim++){
+        REQUIRE(restarted.position[dim] == expected.position[dim]);
+        REQUIRE(restarted.velocity[dim] == expected.velocity[dim]);
+    }
+    REQUIRE(second_half->get_particle_ids() == uninterrupted.get_particle_ids());
+    std::filesystem::remove(checkpoint_file);
+}
+
+TEST_CASE("Ensure single and mixed precision runs follow the double precision run","[Precision]"){
+    REQUIRE(precision_from_string("float") == precision::single_precision);
+    REQUIRE(precision_from_string("MIXED") == precision::mixed);
+    REQUIRE(precision_from_string("Double") == precision::double_precision);
+    REQUIRE_THROWS_AS(precision_from_string("half"), std::invalid_argument);
+    REQUIRE(FFTPlansFloat::wisdom_filename("wisdom", 16, 2) == "wisdom/fftwf_wisdom_num_cells_16_threads_2.wisdom");
+
+    particle_group particles(0.01, 2000, 7);
+    uint num_cells = 16;
+    // 5 steps, as rounding differences grow quickly once close pairs form
+    Simulation reference(0.25, 0.05, particles, 1, num_cells, 1.01, mass_assignment::CIC);
+    SimulationFloat single(0.25, 0.05, particle_group_float(particles), 1, num_cells, 1.01, mass_assignment::CIC);
+    SimulationMixed mixed(0.25, 0.05, particle_group_float(particles), 1, num_cells, 1.01, mass_assignment::CIC);
+
+    reference.fill_density_buffer();
+    single.fill_density_buffer();
+    double max_error = 0, max_density = 0;
+    for (size_t cell = 0; cell < num_cells * num_cells * num_cells; cell++){
+        max_density = std::max(max_density, reference.get_density_buffer()[cell]);
+        max_error = std::max(max_error, std::abs(single.get_density_buffer()[cell] - reference.get_density_buffer()[cell]));
+    }
+    REQUIRE(max_error < 1e-5 * max_density);
+
+    // a cell collecting many particles loses precision when summed in float but not in mixed precision
+    particle_group clustered(0.01, 100000, 3);
+    for (uint dim = 0; dim < 3; dim++){
+        for (double &coordinate : clustered.position[dim]){
+            coordinate = 0.5 + coordinate / 32; // all in the NGP cell (8, 8, 8)
+        }
+    }
+    Simulation clustered_reference(0.5, 0.05, clustered, 1, num_cells, 1.01);
+    SimulationFloat clustered_single(0.5, 0.05, particle_group_float(clustered), 1, num_cells, 1.01);
+    SimulationMixed clustered_mixed(0.5, 0.05, particle_group_float(clustered), 1, num_cells, 1.01);
+    clustered_reference.fill_density_buffer();
+    clustered_single.fill_density_buffer();
+    clustered_mixed.fill_density_buffer();
+    size_t cluster_cell = 8 + num_cells * (8 + num_cells * 8);
+    double expected_density = clustered_reference.get_density_buffer()[cluster_cell];
+    REQUIRE(clustered_mixed.get_density_buffer()[cluster_cell] == expected_density);
+    REQUIRE(clustered_single.get_density_buffer()[cluster_cell] != expected_density);
+    REQUIRE_THAT(clustered_single.get_density_buffer()[cluster_cell], WithinRel(expected_density, 1e-2));
+
+    reference.run();
+    single.run();
+    mixed.run();
+    REQUIRE(single.get_step() == reference.get_step());
+    const particle_group &expected = reference.get_particle_collection();
+    for (const particle_group_float *result : {&single.get_particle_collection(), &mixed.get_particle_collection()}){
+        for (uint dim = 0; dim < 3; dim++){
+            for (size_t index = 0; index < expected.get_num_particles(); index++){
+                double difference = std::abs(result->position[dim][index] - expected.position[dim][index]);
+                REQUIRE(std::min(difference, 1 - difference) < 1e-4); // periodic distance
+                REQUIRE_THAT(result->velocity[dim][index], WithinAbs(expected.velocity[dim][index], 1e-3)); // speeds of a few units
+            }
+        }
     }
+}
+
+TEST_CASE("Ensure a single precision run restarted from a checkpoint is bit-identical and other precisions reject it","[Precision]"){
+    std::string checkpoint_file = (std::filesystem::temp_directory_path() / "pm_simulation_test_float.checkpoint").string();
+    std::filesystem::remove(checkpoint_file);
+    particle_group_float particles(particle_group(0.01, 2000, 7));
+    double time_step = 0.125;
+
+    SimulationFloat uninterrupted(20 * time_step, time_step, particles, 1, 16, 1.01, mass_assignment::TSC);
+    uninterrupted.run();
 
-}
\ No newline at end of file
+    SimulationFloat first_half(10 * time_step, time_step, particles, 1, 16, 1.01, mass_assignment::TSC);
+    first_half.set_checkpointing(checkpoint_file, 10);
+    first_half.run();
+
+    SimulationCheckpoint checkpoint = load_checkpoint(checkpoint_file);
+    REQUIRE(checkpoint.real_precision == precision::single_precision);
+    checkpoint.time_max = 20 * time_step;
+    REQUIRE_THROWS_AS(Simulation::from_checkpoint(checkpoint), std::invalid_argument);
+    REQUIRE_THROWS_AS(SimulationMixed::from_checkpoint(checkpoint), std::invalid_argument);
+    auto second_half = SimulationFloat::from_checkpoint(checkpoint);
+    second_half->run();
+
+    const particle_group_float &expected = uninterrupted.get_particle_collection();
+    const particle_group_float &restarted = second_half->get_particle_collection();
+    for (uint dim = 0; dim < 3; dim++){
+        REQUIRE(restarted.position[dim] == expected.position[dim]);
+        REQUIRE(restarted.velocity[dim] == expected.velocity[dim]);
+    }
+    std::filesystem::remove(checkpoint_file);
+}
+
+TEST_CASE("Ensure converting particles to single precision keeps them in the unit cube","[Precision]"){
+    particle_group particles(0.5, 2, {{1 - 1e-10, 0.25, 0.5}, {0.1, 0.999999999, 0.75}}); // round to 1 in float
+    particle_group_float converted(particles);
+    REQUIRE(converted.mass == 0.5);
+    REQUIRE(converted.get_position(0)[0] == 0.0f);
+    REQUIRE(converted.get_position(1)[1] == 0.0f);
+    REQUIRE(converted.get_position(0)[1] == 0.25f);
+    REQUIRE(converted.get_position(1)[0] == 0.1f);
+
+    // float positions are exactly representable in double, so converting back and forth is exact
+    particle_group widened(converted);
+    particle_group_float narrowed(widened);
+    for (uint dim = 0; dim < 3; dim++){
+        REQUIRE(narrowed.position[dim] == converted.position[dim]);
+    }
+}
+
+TEST_CASE("Ensure plans can be made and destroyed on several threads and the planner lock excludes them","[FFT_Plans]"){
+    std::vector<std::thread> threads;
+    for (uint num_cells : {6, 8, 10, 12}){
+        threads.emplace_back([num_cells](){
+            for (uint repeat = 0; repeat < 3; repeat++){
+                FFTPlans plans(num_cells, 1); // planned and destroyed outside the cache
+                FFTPlansFloat float_plans(num_cells, 1);
+            }
+        });
+    }
+    for (std::thread &thread : threads){
+        thread.join();
+    }
+
+    std::unique_lock<std::mutex> lock = FFTPlans::lock_planner();
+    std::atomic<bool> planned = false;
+    std::thread planner([&](){
+        FFTPlans::get_plans(14, 1);
+        planned = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE_FALSE(planned); // the cache plans under the same lock
+    lock.unlock();
+    planner.join();
+    REQUIRE(planned);
+    FFTPlans::clear_cache(); // destroys the cached plans without holding the lock they take
+}
+
+TEST_CASE("Test plane binning of a slab keeps the particles of every plane in order for any number of threads","[Density_Deposit]"){
+    uint num_cells = 16, first_plane = 4, num_planes = 4;
+    particle_group particles(0.1, 5000, 13);
+    for (double &x : particles.position[0]){
+        x = (first_plane + x * num_planes) / num_cells; // all in planes 4 to 7
+    }
+    PlaneBins serial, parallel;
+    int max_threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    bin_particles_by_plane(particles.position[0].data(), particles.get_num_particles(), num_cells, first_plane, num_planes, serial);
+    omp_set_num_threads(std::max(max_threads, 3));
+    bin_particles_by_plane(particles.position[0].data(), particles.get_num_particles(), num_cells, first_plane, num_planes, parallel);
+    omp_set_num_threads(max_threads);
+
+    REQUIRE(parallel.particles == serial.particles);
+    REQUIRE(parallel.offsets == serial.offsets);
+    REQUIRE(serial.offsets.back() == particles.get_num_particles());
+    for (uint plane = 0; plane < num_planes; plane++){
+        for (size_t n = serial.offsets[plane]; n < serial.offsets[plane + 1]; n++){
+            uint index = serial.particles[n];
+            REQUIRE(static_cast<uint>(particles.position[0][index] * num_cells) == first_plane + plane);
+            if (n > serial.offsets[plane]){
+                REQUIRE(index > serial.particles[n - 1]);
+            }
+        }
+    }
+}